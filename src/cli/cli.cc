@@ -1447,7 +1447,7 @@ namespace PeterDB {
         // Set up the iterator
         RM_ScanIterator rmsi;
         RID rid;
-        void *data_returned = malloc(4096);
+        void *data_returned = malloc(PAGE_SIZE);
 
 
         // convert attributes to vector<string>
@@ -0,0 +1,23 @@
+#ifndef _crc32c_h_
+#define _crc32c_h_
+
+#define CRC32C_POLY 0x82F63B78          // Castagnoli polynomial, bit reversed
+
+#include <cstddef>
+
+namespace PeterDB {
+    // CRC32C computes the Castagnoli CRC that SSE4.2 has an instruction for.
+    // The instruction is used when the CPU has it, otherwise a slice-by-8 table does the same work.
+    class CRC32C {
+    public:
+        static unsigned compute(const void *data, size_t size);            // CRC32C of size bytes
+
+        static bool isHardwareAccelerated();                                // Does compute() use SSE4.2
+
+    private:
+        static unsigned computeHardware(const void *data, size_t size);
+
+        static unsigned computeTable(const void *data, size_t size);
+    };
+} // namespace PeterDB
+#endif // _crc32c_h_
@@ -4,7 +4,7 @@
 #define ROOT_PAGE_NUM_SIZE sizeof(unsigned)
 #define IS_LEAF_SIZE sizeof(bool)
 #define NXT_PN_SIZE sizeof(int)
-#define ORDER 2043
+#define ORDER (PAGE_SIZE / 2 - 5)       // a split keeps keys on the left until less than this is left for the right
 
 #include <vector>
 #include <string>
@@ -31,7 +31,7 @@ namespace PeterDB {
         RC destroyFile(const std::string &fileName);
 
         // Open an index and return an ixFileHandle.
-        RC openFile(const std::string &fileName, IXFileHandle &ixFileHandle);
+        RC openFile(const std::string &fileName, IXFileHandle &ixFileHandle, FileOpenMode mode = ReadWriteMode);
 
         // Close an ixFileHandle for an index.
         RC closeFile(IXFileHandle &ixFileHandle);
@@ -57,23 +57,23 @@ namespace PeterDB {
         /*********************************************/
         /*****    Getter and Setter functions  *******/
         /*********************************************/
-        unsigned short getKeyLength(const void *key, AttrType attrType);
+        PageCount getKeyLength(const void *key, AttrType attrType);
 
         unsigned getRootPageNum(IXFileHandle &ixFileHandle) const;
 
         bool getIsLeaf(void* pageBuffer) const;
 
-        unsigned short getNumKeys(void* pageBuffer) const;
+        PageCount getNumKeys(void* pageBuffer) const;
 
-        unsigned short getFreeBytes(void* pageBuffer) const;
+        PageCount getFreeBytes(void* pageBuffer) const;
 
         int getNextPageNum(void* pageBuffer) const;
 
         void setIsLeaf(void* pageBuffer, bool isLeaf);
 
-        void setNumKeys(void* pageBuffer, unsigned short numKeys);
+        void setNumKeys(void* pageBuffer, PageCount numKeys);
 
-        void setFreeBytes(void* pageBuffer, unsigned short freeBytes);
+        void setFreeBytes(void* pageBuffer, PageCount freeBytes);
 
         void setNextPageNum(void* pageBuffer, int nextPageNum);
 
@@ -86,21 +86,21 @@ namespace PeterDB {
         RC insertEntryRec(IXFileHandle &ixFileHandle, void* pageBuffer, unsigned pageNum, unsigned keyLength,
                        AttrType attrType, const void *key, const RID &rid, void* &newChildEntry, unsigned rootPageNum);
 
-        RC insertEntryToPage(void* pageBuffer, const void *key, unsigned short bytesNeeded,
-                             unsigned short freeBytes, unsigned short numKeys,
+        RC insertEntryToPage(void* pageBuffer, const void *key, PageCount bytesNeeded,
+                             PageCount freeBytes, PageCount numKeys,
                              AttrType attrType, bool isLeaf, bool isHuge);
 
         RC findPageNumToBeHandled(void* pageBuffer, unsigned keyLength, const void *key, const RID &rid,
-                                  unsigned short numKeys, AttrType attrType, unsigned& pageNumToBeInserted);
+                                  PageCount numKeys, AttrType attrType, unsigned& pageNumToBeInserted);
 
-        RC splitNode(IXFileHandle &ixFileHandle, void* pageBuffer, const void *key, unsigned short bytesNeeded,
-                     void* &newChildEntry, unsigned pageNum, unsigned short freeBytes, unsigned short numKeys,
+        RC splitNode(IXFileHandle &ixFileHandle, void* pageBuffer, const void *key, PageCount bytesNeeded,
+                     void* &newChildEntry, unsigned pageNum, PageCount freeBytes, PageCount numKeys,
                      AttrType attrType, bool isLeaf, bool isRoot);
 
-        RC initLeafNode(void* pageBuffer, void* entryPtr, unsigned short bytesNeeded,
+        RC initLeafNode(void* pageBuffer, void* entryPtr, PageCount bytesNeeded,
                         int numKeys, int nextPageNum);
 
-        RC initNonLeafNode(void* pageBuffer, void* entryPtr, unsigned short bytesNeeded, int numKeys);
+        RC initNonLeafNode(void* pageBuffer, void* entryPtr, PageCount bytesNeeded, int numKeys);
 
         RC printNode(IXFileHandle &ixFileHandle, AttrType attrType, unsigned pageNum,
                      int indent, std::ostream &out) const;
@@ -134,7 +134,7 @@ namespace PeterDB {
         // Terminate index scan
         RC close();
 
-        IXFileHandle* ixFileHandle;
+        IXFileHandle* ixFileHandle = nullptr;
 
     private:
         IndexManager* ix;
@@ -144,13 +144,16 @@ namespace PeterDB {
         const void* highKey;
         bool lowKeyInclusive;
         bool highKeyInclusive;
-        unsigned short ixCurrKeyPtr;
+        PageCount ixCurrKeyPtr;
         bool isFirstGetNextEntry;
-        void* currPageBuffer;
+        void* currPageBuffer = nullptr;     // current page, points into the mapping if the index file is mapped
+        void* ownPageBuffer = nullptr;
+
+        RC loadPage(unsigned pageNum);
 
         RC findNextNonEmptyLeaf();
 
-        RC findEntryToOutput(int& keyIdx, unsigned short numKeys, bool isLeaf);
+        RC findEntryToOutput(int& keyIdx, PageCount numKeys, bool isLeaf);
     };
 
     class IXFileHandle {
@@ -171,6 +174,10 @@ namespace PeterDB {
         // Put the current counter values of associated PF FileHandles into variables
         RC collectCounterValues(unsigned &readPageCount, unsigned &writePageCount, unsigned &appendPageCount);
 
+        // Also put the buffer pool hits and misses into variables
+        RC collectCounterValues(unsigned &readPageCount, unsigned &writePageCount, unsigned &appendPageCount,
+                                unsigned &hitCount, unsigned &missCount);
+
     };
 }// namespace PeterDB
 #endif // _ix_h_
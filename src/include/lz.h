@@ -0,0 +1,29 @@
+#ifndef _lz_h_
+#define _lz_h_
+
+#define LZ_MIN_MATCH 4                  // shortest match worth a token
+#define LZ_MAX_OFFSET 65535             // matches reach back at most this far, offsets are stored in 2 bytes
+#define LZ_HASH_BITS 12                 // the match finder remembers 2^LZ_HASH_BITS positions
+#define LZ_LAST_LITERALS 5              // the block always ends with this many literals
+
+#include <cstddef>
+
+namespace PeterDB {
+    // LZ is a small LZ77 codec in the style of LZ4, fast enough to compress every page that is written.
+    // A block is a sequence of tokens. The high nibble of a token counts the literals that follow it, the low
+    // nibble the length of the match after them minus LZ_MIN_MATCH; a nibble of 15 means extra length bytes
+    // follow, each adding up to 255. A match is a 2 byte little-endian offset back into the output.
+    // The last token of a block carries literals only.
+    class LZ {
+    public:
+        // Compress srcSize bytes into dst, returns the compressed size or 0 if it doesn't fit in dstCapacity
+        static size_t compress(const void *src, size_t srcSize, void *dst, size_t dstCapacity);
+
+        // Decompress a block into exactly dstSize bytes, returns -1 if the block is corrupt
+        static int decompress(const void *src, size_t srcSize, void *dst, size_t dstSize);
+
+    private:
+        static size_t writeLength(unsigned char *dst, size_t length);      // Extra length bytes, returns count
+    };
+} // namespace PeterDB
+#endif // _lz_h_
@@ -1,19 +1,392 @@
 #ifndef _pfm_h_
 #define _pfm_h_
 
-#define PAGE_SIZE 4096
+#ifndef PAGE_SIZE
+#define PAGE_SIZE 4096                  // set at build time, e.g. cmake -DPAGE_SIZE=16384
+#endif
+#if PAGE_SIZE < 4096 || PAGE_SIZE > 65536 || (PAGE_SIZE & (PAGE_SIZE - 1)) != 0
+#error "PAGE_SIZE must be a power of two between 4096 and 65536"
+#endif
+
+#define PFM_DEFAULT_NUM_FRAMES 1024
+#define PFM_IO_ALIGNMENT 4096
+#define PFM_EXTENT_PAGES 64             // pages preallocated at a time when the file grows
+#define PFM_MAX_IOVECS 64               // pages transferred by a single preadv/pwritev call
+#define PFM_READ_AHEAD_TRIGGER 2        // consecutive sequential reads before reading ahead
+#define PFM_MIN_READ_AHEAD 4            // first read-ahead window in pages
+#define PFM_MAX_READ_AHEAD 64           // read-ahead window stops growing here
+#define PFM_DEFAULT_IO_THREADS 4
+#define PFM_IO_QUEUE_DEPTH 64           // requests a single I/O thread queues before submitters block
+#define PFM_MAX_IDLE_FILES 32           // files kept open by the open-file table after their last handle closes
+#define PFM_HEADER_FIELDS 12            // unsigned fields in front of the free list in the hidden page
+#define PFM_FILE_COMPRESSED 1           // header flag of a file whose pages are compressed
+#define PFM_FILE_CHECKSUMMED 2          // header flag of a file whose pages have checksums
+#define PFM_MAX_FREE_PAGES (PAGE_SIZE / sizeof(unsigned) - PFM_HEADER_FIELDS)  // free list capacity of a file
+#define PFM_WAL_SUFFIX ".wal"           // the write-ahead log of a file is kept next to it
+#define PFM_MAP_SUFFIX ".pmap"          // so is the page map of a compressed file
+#define PFM_CRC_SUFFIX ".crc"           // and the page checksums
+#define PFM_WAL_COPY_SUFFIX ".tmp"      // a log being cut at a checkpoint is rewritten into <log>.tmp first
+#define PFM_COMPRESS_SECTOR 512         // compressed pages take whole sectors of this size
+#define PFM_RECLAIM_SECTORS 1024        // sync a compressed file once this many sectors wait to be reused
+#define PFM_DEFAULT_TEMP_MEMORY (64 << 20)      // bytes a temporary file keeps in memory before it spills
+#define PFM_TEMP_DIR "/tmp"             // where temporary files spill to when TMPDIR isn't set
+#define PFM_TEMP_NAME_PREFIX "temp#"    // temporary files are named this and a number, they have no path
+#define PFM_WAL_BUFFER_RECORDS 64       // log records buffered in memory before they are forced out
+#define PFM_WAL_CHECKPOINT_BYTES (16 << 20)     // log size that triggers a checkpoint when a handle closes
+#define PFM_DEFAULT_DIRTY_PERCENT 10    // the background writer cleans pages while more frames than this are dirty
+#define PFM_DEFAULT_CHECKPOINT_INTERVAL_MS 5000
+#define PFM_WRITER_INTERVAL_MS 100      // the background writer wakes up at least this often
+#define PFM_MAX_DIRTY_AGE_MS 1000       // pages dirty for longer are written back even below the dirty target
+#define PFM_WRITER_BATCH_PAGES 64       // pages written back by one round of the background writer
+#define PFM_LATENCY_BUCKETS 32          // bucket i of a latency histogram counts I/Os under 2^i microseconds
 
 #include <string>
 #include <cstring>
 #include <fstream>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <list>
+#include <map>
+#include <chrono>
+#include <sys/types.h>
+
+struct iovec;
 
 namespace PeterDB {
 
     typedef unsigned PageNum;
     typedef int RC;
+    typedef unsigned long long LSN;     // log sequence number, position of a record in the write-ahead log
+
+    // Offsets, lengths and counts within a page. Offsets are signed, -1 marks deleted and moved records.
+#if PAGE_SIZE > 32768
+    typedef int PageOffset;
+    typedef unsigned PageCount;
+#else
+    typedef short PageOffset;
+    typedef unsigned short PageCount;
+#endif
 
     class FileHandle;
 
+    class WriteAheadLog;
+
+    class CompressedPageMap;
+
+    class PageChecksums;
+
+    class MemoryPageStore;
+
+    struct OpenFile;
+
+    // A latency histogram with power of two buckets of microseconds, the first bucket is under 1 microsecond
+    typedef struct {
+        unsigned long long buckets[PFM_LATENCY_BUCKETS];    // the last bucket also counts everything slower
+        unsigned long long count;
+        unsigned long long totalMicros;
+        unsigned long long maxMicros;
+    } LatencyHistogram;
+
+    // Disk I/O of a file, or of all files, since it was opened or the statistics were reset.
+    // A transfer is sequential if it starts where the previous one of the same kind ended.
+    typedef struct {
+        unsigned long long pagesRead;
+        unsigned long long pagesWritten;        // pages that were in the file already
+        unsigned long long pagesAppended;       // pages that grew the file
+        unsigned long long bytesRead;           // bytes that went to or from disk, compressed pages count their
+        unsigned long long bytesWritten;        // stored size, pages of a temporary file in memory count nothing
+        unsigned long long sequentialReads;     // transfers, not pages
+        unsigned long long randomReads;
+        unsigned long long sequentialWrites;    // appends included
+        unsigned long long randomWrites;
+        LatencyHistogram readLatency;
+        LatencyHistogram writeLatency;
+        LatencyHistogram appendLatency;
+    } IOStatistics;
+
+    // IOStatsCollector gathers IOStatistics from any number of threads without a latch
+    class IOStatsCollector {
+    public:
+        typedef enum {
+            ReadIO = 0, WriteIO, AppendIO
+        } IOKind;
+
+        IOStatsCollector();
+
+        void record(IOKind kind, PageNum firstPageNum, unsigned count, size_t numBytes,
+                    unsigned long long nanoseconds);
+
+        void collect(IOStatistics &stats);                                  // Copy the statistics out
+
+        void reset();
+
+        // Upper bound of the bucket the percentile (0 to 100) falls in, in microseconds
+        static unsigned long long getLatencyPercentile(const LatencyHistogram &histogram, double percentile);
+
+    private:
+        typedef struct {
+            std::atomic<unsigned long long> buckets[PFM_LATENCY_BUCKETS];
+            std::atomic<unsigned long long> count;
+            std::atomic<unsigned long long> totalMicros;
+            std::atomic<unsigned long long> maxMicros;
+        } AtomicHistogram;
+
+        std::atomic<unsigned long long> numPages[3];            // indexed by IOKind
+        std::atomic<unsigned long long> numBytes[3];
+        std::atomic<unsigned long long> numSequential[3];
+        std::atomic<unsigned long long> numRandom[3];
+        std::atomic<PageNum> nextPageNum[3];                    // where a sequential transfer would start
+        AtomicHistogram latency[3];
+
+        static void collectHistogram(AtomicHistogram &histogram, LatencyHistogram &result);
+    };
+
+    // How a file is opened
+    typedef enum {
+        ReadWriteMode = 0,          // pages are copied in and out with readPage() and writePage()
+        MappedReadOnlyMode          // file is mmap'ed read only, pages can also be accessed with pageView(),
+                                    // compressed files can't be mapped
+    } FileOpenMode;
+
+    typedef struct {
+        std::string fileName;       // file the cached page belongs to
+        PageNum pageNum;            // page number of the cached page
+        OpenFile* file;             // open file the page is written back to when it is dirty
+        unsigned pinCount;          // number of callers currently holding the page
+        bool isDirty;               // page has been modified since it was read from disk
+        bool refBit;                // reference bit for the clock replacement policy
+        bool isValid;               // frame holds a page
+        bool isLoading;             // page is being read from disk, wait before using the frame
+        LSN pageLSN;                // log record of the latest change, the log is flushed up to it before write back
+        LSN recLSN;                 // log record that first dirtied the page, older records are in the file
+        unsigned long long dirtySeq;    // changes whenever the page is dirtied, to notice changes during a write
+        std::chrono::steady_clock::time_point dirtyTime;    // when the page became dirty
+        bool isWriting;             // the background writer is writing a copy of the page
+    } BufferFrame;
+
+    // A file opened by one or more FileHandles. Entries live in the open-file table of PagedFileManager,
+    // so handles opened on the same path share one descriptor, the page count and the hidden page.
+    typedef struct OpenFile {
+        std::string fileName;
+        int fd;                             // POSIX descriptor of the file
+        std::atomic<bool> isDirectIO;       // fd is opened with O_DIRECT, page buffers must be aligned
+        dev_t device;                       // identity of the opened file, to notice it was removed and recreated
+        ino_t inode;
+        unsigned refCount;                  // handles using the file, the entry is idle at 0
+        bool isInTable;                     // false once the file was destroyed or recreated while still open
+        std::list<std::string>::iterator idlePos;   // position in the idle list while refCount is 0
+
+        std::atomic<unsigned> numPages;     // only grows after the appended page is on disk
+        unsigned allocatedPages;            // physical pages (hidden page included) with space reserved on disk
+
+        // the hidden page, written lazily
+        unsigned long long readPageCounter;
+        unsigned long long writePageCounter;
+        unsigned long long appendPageCounter;
+        std::vector<PageNum> freePages;     // free list, the most recently freed page is reused first
+        std::vector<bool> freePageMap;      // freePageMap[pageNum] is set while pageNum is on the free list
+        bool headerDirty;                   // hidden page in memory is newer than on disk
+        unsigned headerUpdates;             // header changes since the hidden page was written
+        unsigned headerSyncInterval;
+
+        WriteAheadLog* wal;                 // page images are logged here before they reach the file, nullptr if off
+        bool isCompressed;                  // pages are compressed, kept in the hidden page
+        CompressedPageMap* pageMap;         // where the compressed pages are, nullptr if not compressed
+        bool hasChecksums;                  // pages have checksums, kept in the hidden page
+        PageChecksums* checksums;           // CRC32C of every page, nullptr if the file has none
+        std::atomic<bool> verifyChecksums;  // check pages read from disk against their checksums
+        MemoryPageStore* memoryPages;       // pages of a temporary file, nullptr for a file on disk
+        IOStatsCollector ioStats;           // disk I/O of the file while it is open
+        LSN checkpointLSN;                  // log records up to here are in the file, kept in the hidden page
+
+        std::mutex writeLatch;              // serializes writers and header updates, page reads never take it
+    } OpenFile;
+
+    // WriteAheadLog keeps full images of written pages in a log file next to the data file.
+    // A page image is logged before the page itself may be written back, so dirty pages can stay in the buffer
+    // pool after a write, and pages are brought back from the log when a file is opened after a crash.
+    // Several threads committing at the same time share one log write and one fdatasync (group commit).
+    class WriteAheadLog {
+    public:
+        WriteAheadLog();
+
+        ~WriteAheadLog();
+
+        RC open(const std::string &logName, LSN lastLSN);                  // Start an empty log after lastLSN
+
+        RC close();
+
+        LSN append(PageNum pageNum, const void *data);                      // Buffer a page image, 0 on failure
+
+        RC flush(LSN lsn);                                                  // Wait until the log is durable up to lsn
+
+        LSN getLastLSN();
+
+        LSN getDurableLSN();
+
+        off_t getLogSize();                                                 // Bytes of the log file on disk
+
+        RC truncate(LSN checkpointLSN);     // Drop the records up to checkpointLSN from the log file
+
+        // Write the page images logged after checkpointLSN into the file, stops at the first torn record
+        static RC replay(const std::string &logName, OpenFile *file, LSN checkpointLSN,
+                         std::vector<PageNum> &replayedPages, LSN &lastLSN);
+
+    private:
+        typedef struct {
+            LSN lsn;
+            PageNum pageNum;
+            unsigned checksum;              // over the record with this field zeroed, detects torn records
+        } LogRecordHeader;
+
+        int fd;
+        std::string logName;
+        char* buffer;                       // records not handed to the file yet
+        char* flushBuffer;                  // records being written by the current flush
+        size_t bufferBytes;
+        LSN lastLSN;                        // last record appended
+        LSN durableLSN;                     // last record on disk
+        LSN firstLSN;                       // record at the start of the log file
+        off_t logSize;
+        bool isFlushing;                    // a thread is writing out the log, others wait for it
+        std::mutex latch;
+        std::condition_variable flushDone;
+
+        /**********************************/
+        /*****    Helper functions  *******/
+        /**********************************/
+        static unsigned computeChecksum(const LogRecordHeader &header, const void *data);
+
+        static size_t getRecordSize();
+
+        RC copyRecords(int copyFd, off_t offset, size_t numBytes);      // Caller is the flushing thread
+    };
+
+    // CompressedPageMap places the pages of a compressed file. Every page is compressed on its own with LZ and
+    // stored in whole sectors after the hidden page; pages that don't shrink are stored as they are.
+    // The map, kept in <file>.pmap, says which sectors hold a page, so page numbers stay stable while pages
+    // change size and move. Sectors a page moved away from are reused only after the map is synced, until then
+    // the map on disk may still point at them.
+    class CompressedPageMap {
+    public:
+        CompressedPageMap();
+
+        ~CompressedPageMap();
+
+        RC open(const std::string &mapName);                                // Load the map, find the free sectors
+
+        RC close();
+
+        unsigned getNumPages();                                             // Pages in the map
+
+        // numBytes is set to the bytes that went to or from the data file
+        RC readPages(int dataFd, PageNum firstPageNum, unsigned count, void *data, size_t &numBytes);
+
+        RC writePages(int dataFd, PageNum firstPageNum, unsigned count, const void *data, size_t &numBytes);
+
+        RC discardPage(PageNum pageNum);            // Give the sectors of a page back, it reads as zeros
+
+        RC sync();                          // Make the map durable, the pages it points at must be already
+
+    private:
+        typedef struct {
+            unsigned sector;                // first sector of the page, counted from the end of the hidden page
+            unsigned length;                // stored bytes, PAGE_SIZE if not compressed, 0 if never written
+        } MapEntry;
+
+        int fd;
+        std::vector<MapEntry> entries;      // entries[pageNum]
+        std::map<unsigned, unsigned> freeRuns;      // first sector -> number of free sectors
+        std::vector<std::pair<unsigned, unsigned>> movedRuns;      // freed since the last sync, not reusable yet
+        unsigned numMovedSectors;
+        unsigned endSector;                 // sectors from here on are not used
+        std::mutex latch;                   // held across data I/O, so sectors aren't reused under a reader
+
+        /**********************************/
+        /*****    Helper functions  *******/
+        /**********************************/
+        static unsigned getNumSectors(unsigned length);
+
+        unsigned allocateSectors(unsigned numSectors);
+
+        void releaseSectors(unsigned sector, unsigned numSectors);
+
+        RC storeEntry(PageNum pageNum);                                     // Write one entry to the map file
+
+        RC syncMap();                                       // sync() with the latch held
+
+        RC writePage(int dataFd, PageNum pageNum, const char *data, char *buffer, size_t &numBytes);
+    };
+
+    // PageChecksums keeps a CRC32C of every page of a file in <file>.crc, 4 bytes per page.
+    // The checksums are held in memory, a checksum is written through once its page is written,
+    // and made durable together with the pages. While a page is being written both its old and its
+    // new checksum are accepted. Pages are checksummed as the caller sees them, before compression.
+    class PageChecksums {
+    public:
+        PageChecksums();
+
+        ~PageChecksums();
+
+        RC open(const std::string &crcName);                                // Load the checksums
+
+        RC close();
+
+        RC update(PageNum firstPageNum, unsigned count, const void *data);  // Pages were written
+
+        // Pages are about to be written, their new checksums are returned for commit()
+        void stage(PageNum firstPageNum, unsigned count, const void *data, std::vector<unsigned> &pageChecksums);
+
+        // The write of staged pages is done, their new checksums replace the old ones if it succeeded
+        RC commit(PageNum firstPageNum, const std::vector<unsigned> &pageChecksums, bool isWritten);
+
+        // Check pages just read, returns the number of pages that don't match, the first one in badPageNum
+        unsigned verify(PageNum firstPageNum, unsigned count, const void *data, PageNum &badPageNum);
+
+        RC sync();
+
+    private:
+        int fd;
+        std::vector<unsigned> checksums;    // checksums[pageNum]
+        std::vector<bool> isKnown;          // pages past the end of <file>.crc have no checksum to verify
+        std::unordered_map<PageNum, unsigned> stagedChecksums;  // new checksums of pages being written
+        std::mutex latch;
+    };
+
+    // MemoryPageStore holds the pages of a temporary file in memory. Once they would take more than the
+    // memory limit, all pages are written to the spill file, an unlinked file in TMPDIR, and are read and
+    // written there from then on. Nothing reaches the disk before that. The limit does not count copies of
+    // the pages held by the buffer pool.
+    class MemoryPageStore {
+    public:
+        MemoryPageStore(size_t memoryLimit);
+
+        ~MemoryPageStore();
+
+        // numBytes is set to the bytes that went to or from the spill file, 0 while the pages are in memory
+        RC readPages(int spillFd, PageNum firstPageNum, unsigned count, void *data, size_t &numBytes);
+
+        RC writePages(int spillFd, PageNum firstPageNum, unsigned count, const void *data, size_t &numBytes);
+
+        bool isSpilled();
+
+    private:
+        size_t maxPages;                    // pages kept in memory at most
+        std::vector<char*> pages;           // pages[pageNum], PAGE_SIZE bytes each, empty once spilled
+        bool spilled;
+        std::mutex latch;
+
+        RC spill(int spillFd);                                              // Move all pages to the spill file
+    };
+
     class PagedFileManager {
     public:
         static PagedFileManager &instance();                                // Access to the singleton instance
@@ -22,12 +395,126 @@ namespace PeterDB {
 
         RC destroyFile(const std::string &fileName);                        // Destroy a file
 
-        RC openFile(const std::string &fileName, FileHandle &fileHandle);   // Open a file
+        RC openFile(const std::string &fileName, FileHandle &fileHandle,
+                    FileOpenMode mode = ReadWriteMode);                     // Open a file
 
         RC closeFile(FileHandle &fileHandle);                               // Close a file
 
+        // Open an anonymous file for scratch space, kept in memory up to memoryLimit bytes, see MemoryPageStore.
+        // Its pages are cached in the buffer pool like any other, so they can take up to memoryLimit plus the
+        // pool's frames. The file and its cached pages are gone when its last handle is closed.
+        RC createTempFile(FileHandle &fileHandle, size_t memoryLimit = PFM_DEFAULT_TEMP_MEMORY);
+
+        void setDirectIO(bool directIO);                                    // Open files with O_DIRECT from now on
+
+        bool getDirectIO();
+
+        // Keep at most numFiles files open after their last handle is closed, 0 closes them right away
+        void setMaxIdleFiles(unsigned numFiles);
+
+        unsigned getMaxIdleFiles();
+
+        // Punch freed pages out of their files so the file system can reuse the space
+        void setPunchHoles(bool punchHoles);
+
+        bool getPunchHoles();
+
+        // Log page writes of files opened from now on, see WriteAheadLog
+        void setWALEnabled(bool walEnabled);
+
+        bool getWALEnabled();
+
+        // Compress the pages of files created from now on, see CompressedPageMap
+        void setCompressionEnabled(bool compressionEnabled);
+
+        bool getCompressionEnabled();
+
+        // Keep checksums of the pages of files created from now on, see PageChecksums
+        void setChecksumsEnabled(bool checksumsEnabled);
+
+        bool getChecksumsEnabled();
+
+        void collectIOStatistics(IOStatistics &stats);                      // Disk I/O of all files
+
+        void resetIOStatistics();
+
     private:
-        void initHiddenPage(std::fstream& file);
+        friend class FileHandle;
+        friend class BufferPoolManager;
+        friend class WriteAheadLog;
+
+        bool directIO;
+        bool punchHoles;
+        bool walEnabled;
+        bool compressionEnabled;
+        bool checksumsEnabled;
+        unsigned maxIdleFiles;
+        std::atomic<unsigned> numTempFiles;     // names temporary files
+        IOStatsCollector ioStats;
+        std::unordered_map<std::string, OpenFile*> openFiles;  // open-file table keyed by path
+        std::list<std::string> idleFiles;                       // files without handles, most recently used first
+        std::mutex tableLatch;                                  // protects the table, idle list and refcounts
+
+        /**********************************/
+        /*****    Helper functions  *******/
+        /**********************************/
+        RC initHiddenPage(int fd, unsigned flags);
+
+        RC acquireFile(const std::string &fileName, bool directIO, OpenFile* &file);    // Open or share, refCount + 1
+
+        void retainFile(OpenFile* file);                                    // Another handle shares the file
+
+        void releaseFile(OpenFile* file);                                   // refCount - 1, may close the file
+
+        RC syncFile(const std::string &fileName);           // Bring the file on disk up to date for a mapped open
+
+        RC recoverFile(const std::string &fileName);        // Replay the log left by a crash, caller holds tableLatch
+
+        RC checkpointFile(OpenFile* file);                  // Write back logged pages and empty the log
+
+        void checkpointOpenFiles();                         // Fuzzy checkpoint of every open file
+
+        RC fuzzyCheckpoint(OpenFile* file);                 // Skip what is in the file already, writers keep going
+
+        RC readFileHeader(OpenFile* file);
+
+        // Fill the file from a hidden page, fails if the page was written with another page size
+        RC loadFileHeader(OpenFile* file, const unsigned* header);
+
+        RC writeFileHeader(OpenFile* file);                                 // Caller holds file->writeLatch
+
+        // Transfer pages and count them in the I/O statistics of the file and of all files
+        static RC readBlocks(OpenFile* file, off_t offset, unsigned count, void *data);
+
+        static RC writeBlocks(OpenFile* file, off_t offset, unsigned count, const void *data);
+
+        // preadv pages, numBytes is set to the bytes that were read from disk
+        static RC readStoredBlocks(OpenFile* file, off_t offset, unsigned count, void *data, size_t &numBytes);
+
+        // Write pages and then their checksums, numBytes is set to the bytes that were written to disk
+        static RC writeStoredBlocks(OpenFile* file, off_t offset, unsigned count, const void *data,
+                                    size_t &numBytes);
+
+        // pwritev pages, numBytes is set to the bytes that were written to disk
+        static RC writeDataBlocks(OpenFile* file, off_t offset, unsigned count, const void *data,
+                                  size_t &numBytes);
+
+        static int fillIovecs(struct iovec* iov, char* buffer, size_t numBytes);
+
+        static void disableDirectIO(OpenFile* file);                        // Fall back to buffered I/O
+
+        static RC syncData(OpenFile* file);                 // fdatasync the file, and its page map if compressed
+
+        static RC openPageMap(OpenFile* file);              // Compressed pages are found through the map
+
+        static RC openChecksums(OpenFile* file);
+
+        // The helpers below expect the caller to hold tableLatch
+        void detachFile(const std::string &fileName, bool writeBack);      // Drop the path from the table
+
+        void evictIdleFiles();
+
+        void closeOpenFile(OpenFile* file, bool writeBack);
 
     protected:
         PagedFileManager();                                                 // Prevent construction
@@ -39,40 +526,349 @@ namespace PeterDB {
         PagedFileManager &operator=(const PagedFileManager &);              // Prevent assignment
     };
 
+    // BufferPoolManager caches pages of all open files in a fixed number of frames.
+    // Pages are looked up by (file name, page number), so handles opened on the same file share cached pages.
+    // The way to use it is like the following:
+    //  void* pageData;
+    //  bpm.fetchPage(fileHandle, pageNum, pageData);     // pin the page
+    //  read or modify pageData;
+    //  bpm.unpinPage(fileHandle, pageNum, isDirty);      // unpin the page, dirty pages are written back later
+    // FileHandle::readPage() and FileHandle::writePage() go through the buffer pool as well.
+    // All methods may be called from several threads, disk reads and writes happen outside the pool latch.
+    // Written pages stay dirty in the pool, a background writer writes them back once they are old enough or
+    // the pool gets dirtier than the target, and takes fuzzy checkpoints of the open files.
+    class BufferPoolManager {
+    public:
+        static BufferPoolManager &instance();                               // Access to the singleton instance
+
+        RC setNumFrames(unsigned numFrames);                                // Resize the pool, 0 disables caching
+
+        unsigned getNumFrames();                                            // Get the number of frames
+
+        RC fetchPage(FileHandle &fileHandle, PageNum pageNum, void* &pageData);     // Pin a page in the pool
+
+        RC unpinPage(FileHandle &fileHandle, PageNum pageNum, bool isDirty);        // Unpin a pinned page
+
+        RC flushPage(FileHandle &fileHandle, PageNum pageNum);              // Write a dirty page back to disk
+
+        RC flushFile(FileHandle &fileHandle);                               // Write back all dirty pages of a file
+
+        RC discardFile(const std::string &fileName);                        // Drop all cached pages, fails if pinned
+
+        RC discardPage(FileHandle &fileHandle, PageNum pageNum);            // Drop a cached page without writing it
+
+        RC readPage(FileHandle &fileHandle, PageNum pageNum, void *data);   // Copy a page out of the pool
+
+        RC writePage(FileHandle &fileHandle, PageNum pageNum, const void *data);    // Dirty the page in the pool
+
+        RC prefetchPage(FileHandle &fileHandle, PageNum pageNum);           // Bring a page into the pool
+
+        // Bring pages into the pool on the I/O threads and wait until they are in. A mapped file or a pool
+        // without frames only gets the kernel to read them ahead.
+        RC prefetchPages(FileHandle &fileHandle, const std::vector<PageNum> &pageNums);
+
+        void setTargetDirtyPercent(unsigned percent);                       // Keep at most this share of frames dirty
+
+        unsigned getTargetDirtyPercent();
+
+        void setCheckpointInterval(unsigned milliseconds);                  // 0 stops the periodic checkpoints
+
+        unsigned getCheckpointInterval();
+
+        unsigned getNumDirtyFrames();                                       // Frames not written back yet
+
+        unsigned long long getNumWriteBacks();                              // Dirty pages written to disk so far
+
+        // Copy dirty cached pages of a range over data, returns the number of pages of the range in the pool
+        unsigned overlayPages(FileHandle &fileHandle, PageNum firstPageNum, unsigned count, void *data);
+
+        // Refresh cached pages of a range that was written to disk, lsn is the last log record of the range
+        void updateCachedPages(FileHandle &fileHandle, PageNum firstPageNum, unsigned count, const void *data,
+                               LSN lsn);
+
+    private:
+        friend class PagedFileManager;
+
+        std::vector<BufferFrame> frames;
+        char* frameData;
+        unsigned clockHand;
+        unsigned long long numWriteBacks;           // a direct read that raced a write back may be stale
+        unsigned numDirtyFrames;
+        unsigned long long numDirtyings;            // source of BufferFrame::dirtySeq
+        unsigned targetDirtyPercent;
+        unsigned checkpointInterval;
+
+        // background writer
+        std::thread writer;
+        bool isWriterStopping;
+        unsigned numBusyWriters;                    // batches and evicted pages being written without the latch
+        char* writerBuffer;                         // copies of the pages of a batch
+        std::condition_variable writerWakeup;
+        std::condition_variable writerDone;
+        std::function<void()> checkpointHandler;    // run by the writer every checkpointInterval
+        std::unordered_map<std::string, std::unordered_map<PageNum, unsigned>> pageTable;
+        std::mutex poolLatch;                       // protects frames, pageTable and the clock hand
+        std::condition_variable frameLoaded;        // signaled when a frame finishes loading
+
+        /**********************************/
+        /*****    Helper functions  *******/
+        /**********************************/
+        RC findFrame(FileHandle &fileHandle, PageNum pageNum, unsigned &frameIdx);
+
+        bool lookupFrame(std::unique_lock<std::mutex> &lock, FileHandle &fileHandle, PageNum pageNum,
+                         unsigned &frameIdx);                               // findFrame() that waits for loading
+
+        // Find a free frame. Writing a dirty victim back releases the latch, isReleased tells the caller
+        // to look up again what it found before.
+        RC evictFrame(std::unique_lock<std::mutex> &lock, unsigned &frameIdx, bool &isReleased);
+
+        void removeFrame(unsigned frameIdx);
+
+        RC writeBackFrame(unsigned frameIdx);
+
+        RC writeBackVictim(std::unique_lock<std::mutex> &lock, unsigned frameIdx);  // writeBackFrame() unlatched
+
+        // Read a window of count pages, count is set to the pages that were read
+        RC readAhead(std::unique_lock<std::mutex> &lock, FileHandle &fileHandle, PageNum pageNum,
+                     unsigned &count, unsigned frameIdx);
+
+        void* getFrameData(unsigned frameIdx);
+
+        void markDirty(unsigned frameIdx, LSN lsn);
+
+        void markClean(unsigned frameIdx);
+
+        void runWriter();
+
+        unsigned writeBackBatch(std::unique_lock<std::mutex> &lock);       // Returns the number of pages written
+
+        void waitForWriter(std::unique_lock<std::mutex> &lock);            // Until nothing is written unlatched
+
+        // The helpers below are used by PagedFileManager
+        void stopWriter();
+
+        void setCheckpointHandler(std::function<void()> handler);
+
+        RC flushOpenFile(OpenFile* file);                                   // Write back dirty pages of an open file
+
+        void detachOpenFile(OpenFile* file, bool writeBack);                // The open file is about to be closed
+
+        LSN getMinRecLSN(OpenFile* file);                                   // Oldest recLSN of the file, 0 if clean
+
+    protected:
+        BufferPoolManager();                                                // Prevent construction
+
+        ~BufferPoolManager();                                               // Prevent unwanted destruction
+
+        BufferPoolManager(const BufferPoolManager &);                       // Prevent construction by copying
+
+        BufferPoolManager &operator=(const BufferPoolManager &);            // Prevent assignment
+    };
+
+    // AsyncIOManager runs page reads and writes on a fixed pool of I/O threads.
+    // Every request returns a future that becomes ready when the page has been transferred.
+    // Writes to one file are always queued on the same thread, so they complete in submission order,
+    // and reads of a file with writes in flight are queued behind them.
+    class AsyncIOManager {
+    public:
+        static AsyncIOManager &instance();                                  // Access to the singleton instance
+
+        RC setNumThreads(unsigned numThreads);                              // Finish queued I/O and resize the pool
+
+        unsigned getNumThreads();
+
+        std::future<RC> submitRead(FileHandle &fileHandle, PageNum pageNum, void *data);
+
+        std::future<RC> submitWrite(FileHandle &fileHandle, PageNum pageNum, const void *data);
+
+        std::future<RC> submitPrefetch(FileHandle &fileHandle, PageNum pageNum);    // See prefetchPage()
+
+        void waitForFile(const std::string &fileName);                      // Block until the file has no I/O queued
+
+    private:
+        typedef struct {
+            std::thread thread;
+            std::deque<std::function<void()>> queue;
+            std::mutex latch;
+            std::condition_variable notEmpty;
+            std::condition_variable notFull;
+            bool isStopping;
+        } IOWorker;
+
+        unsigned numThreads;
+        std::vector<std::unique_ptr<IOWorker>> workers;
+        unsigned nextWorker;                                    // round robin position for reads
+        std::unordered_map<std::string, unsigned> pendingIOs;   // queued requests per file
+        std::unordered_map<std::string, unsigned> pendingWrites;
+        std::mutex stateLatch;                                  // protects everything above
+        std::condition_variable ioDone;
+
+        /**********************************/
+        /*****    Helper functions  *******/
+        /**********************************/
+        void startWorkers();
+
+        void stopWorkers();
+
+        void runWorker(IOWorker* worker);
+
+        std::future<RC> submit(const std::string &fileName, bool isWrite, std::function<RC()> request);
+
+    protected:
+        AsyncIOManager();                                                   // Prevent construction
+
+        ~AsyncIOManager();                                                  // Prevent unwanted destruction
+
+        AsyncIOManager(const AsyncIOManager &);                             // Prevent construction by copying
+
+        AsyncIOManager &operator=(const AsyncIOManager &);                  // Prevent assignment
+    };
+
+    // A FileHandle can be shared by threads: any number of them may read pages at the same time,
+    // while writes, appends and header updates are serialized on the write latch of the open file.
     class FileHandle {
     public:
         // variables to keep the counter for each operation
-        unsigned readPageCounter;
-        unsigned writePageCounter;
-        unsigned appendPageCounter;
+        std::atomic<unsigned long long> readPageCounter;
+        std::atomic<unsigned long long> writePageCounter;
+        std::atomic<unsigned long long> appendPageCounter;
+
+        // variables to keep the buffer pool counters, not persisted in the hidden page
+        std::atomic<unsigned long long> hitCounter;
+        std::atomic<unsigned long long> missCounter;
+
+        // pages read from disk that failed their checksum, not persisted either
+        std::atomic<unsigned long long> checksumErrorCounter;
 
-        unsigned numPages;
+        std::string fileName;
 
         FileHandle();                                                       // Default constructor
 
         ~FileHandle();                                                      // Destructor
 
-        RC openFile(const std::string &fileName);
+        FileHandle(const FileHandle &fileHandle);                           // Copy the state, not the latch
+
+        FileHandle &operator=(const FileHandle &fileHandle);                // Assign the state, not the latch
+
+        RC openFile(const std::string &fileName, bool directIO = false);
+
+        RC openFileMapped(const std::string &fileName);                     // Open a file read only through mmap
+
+        RC openTempFile(size_t memoryLimit);                                // Open a new temporary file
 
         RC closeFile();
 
+        bool isMapped();                                                    // Is the file opened with openFileMapped()
+
+        bool isTemporary();                                                 // Is the file opened with openTempFile()
+
+        bool isSpilled();                                                   // Has the temporary file gone to disk
+
+        // Zero-copy access to a page of a mapped file, nullptr if the file isn't mapped or the page doesn't exist.
+        // The view stays valid until the file is closed.
+        const void* pageView(PageNum pageNum);
+
+        RC adviseWillNeed(PageNum pageNum, unsigned count);                 // Hint that pages will be read soon
+
+        RC sync();                                                          // Write back cached pages and header, fsync
+
+        RC commit();                                                        // Make the writes so far durable
+
+        // Write the header every numUpdates header changes, 0 only writes it on close and sync()
+        void setHeaderSyncInterval(unsigned numUpdates);
+
         RC readPage(PageNum pageNum, void *data);                           // Get a specific page
 
         RC writePage(PageNum pageNum, const void *data);                    // Write a specific page
 
         RC appendPage(const void *data);                                    // Append a specific page
 
+        // Write data into a free page, or append it if there is none. The page used is returned in pageNum.
+        RC allocatePage(const void *data, PageNum &pageNum);
+
+        RC freePage(PageNum pageNum);                                       // Put a page on the free list
+
+        bool isPageFree(PageNum pageNum);                                   // Is the page on the free list
+
+        unsigned getNumberOfFreePages();
+
+        RC readPages(PageNum firstPageNum, unsigned count, void *data);     // Get count consecutive pages
+
+        RC writePages(PageNum firstPageNum, unsigned count, const void *data);  // Write count consecutive pages
+
+        // Read a page on an I/O thread, data must stay valid until the future is ready
+        std::future<RC> readPageAsync(PageNum pageNum, void *data);
+
+        // Write a page on an I/O thread, data is copied before returning
+        std::future<RC> writePageAsync(PageNum pageNum, const void *data);
+
         unsigned getNumberOfPages();                                        // Get the number of pages in the file
 
+        // Check pages read from disk against their checksums, on by default for files that have them.
+        // The setting is shared by all handles of the file.
+        void setChecksumVerification(bool verifyChecksums);
+
+        bool getChecksumVerification();
+
         RC collectCounterValues(unsigned &readPageCount, unsigned &writePageCount,
                                 unsigned &appendPageCount);                 // Put current counter values into variables
 
+        RC collectCounterValues(unsigned &readPageCount, unsigned &writePageCount, unsigned &appendPageCount,
+                                unsigned &hitCount, unsigned &missCount);   // Also put buffer pool hits and misses
+
+        RC collectCounterValues(unsigned &readPageCount, unsigned &writePageCount, unsigned &appendPageCount,
+                                unsigned &hitCount, unsigned &missCount,
+                                unsigned &checksumErrorCount);              // Also put checksum failures
+
+        RC collectCounterValues(unsigned long long &readPageCount, unsigned long long &writePageCount,
+                                unsigned long long &appendPageCount);       // The counters without wrapping
+
+        // Disk I/O of the file, shared by all handles of it. Reads served by the buffer pool are not counted.
+        RC collectIOStatistics(IOStatistics &stats);
+
     private:
-        std::fstream* fileToBeHandled;
+        friend class BufferPoolManager;
+        friend class AsyncIOManager;
+
+        std::atomic<bool> hasAsyncIO;   // async requests were submitted, wait for them before closing
+
+        OpenFile* file;         // shared state of the open file, nullptr if closed
+        int fd;                 // file->fd, -1 if closed
+        char* mappedData;       // start of the read only mapping, nullptr if not mapped
+        size_t mappedLength;
+
+        // sequential read detection for read-ahead
+        PageNum lastReadPageNum;
+        unsigned sequentialRun;         // consecutive reads of the next page
+        unsigned readAheadPages;        // current read-ahead window, grows while reads stay sequential
+
+        unsigned trackRead(PageNum pageNum);                                // Pages to read if pageNum misses
+
+        void growReadAhead(unsigned numPagesRead);
+
+        void markHeaderDirty();                                             // Caller holds file->writeLatch
+
+        void copyState(const FileHandle &fileHandle);
+
+        RC reserveExtent(unsigned numPhysicalPages);                        // Preallocate space before growing
+
+        RC appendNewPage(const void *data);                                 // Caller holds file->writeLatch
+
+        RC readBlock(off_t offset, void *data);                             // pread a whole page at offset
+
+        RC writeBlock(off_t offset, const void *data);                      // pwrite a whole page at offset
+
+        RC readBlocks(off_t offset, unsigned count, void *data);            // preadv count pages at offset
+
+        RC writeBlocks(off_t offset, unsigned count, const void *data);     // pwritev count pages at offset
+
+        RC readPhysicalPage(PageNum pageNum, void *data);                   // Read a page from disk
+
+        RC writePhysicalPage(PageNum pageNum, const void *data);            // Write a page to disk
 
         void readHiddenPage();
 
-        void writeHiddenPage();
+        void writeHiddenPage();                                             // Caller holds file->writeLatch
     };
 
 } // namespace PeterDB
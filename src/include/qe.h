@@ -13,6 +13,7 @@
 namespace PeterDB {
 
 #define QE_EOF (-1)  // end of the index scan
+#define QE_PREFETCH_DEPTH 32    // index entries read ahead by IndexScan before fetching their tuples
     typedef enum AggregateOp {
         MIN = 0, MAX, COUNT, SUM, AVG
     } AggregateOp;
@@ -37,16 +38,16 @@ namespace PeterDB {
 
     typedef struct TupleInfo {
         int offsetOnBlock;
-        short length;
+        PageOffset length;
     } TupleInfo;
 
     int getMaxTupleLength(std::vector<Attribute> attrs);
 
     RC getTargetAttrValue(std::vector<Attribute> attrs, void* tupleBuffer, std::string targetAttrName, void* targetAttr);
 
-    void parseTuple(void* tupleBuffer, std::vector<Attribute> attrs, std::string conditionAttr, int &keyOffset, short &tupleLength);
+    void parseTuple(void* tupleBuffer, std::vector<Attribute> attrs, std::string conditionAttr, int &keyOffset, PageOffset &tupleLength);
 
-    void generateJoinedTuple(void* leftTuple, void* rightTuple, short leftTupleLength, short rightTupleLength,
+    void generateJoinedTuple(void* leftTuple, void* rightTuple, PageOffset leftTupleLength, PageOffset rightTupleLength,
             std::vector<Attribute> leftAttrs, std::vector<Attribute> rightAttrs, void* data);
 
     class Iterator {
@@ -125,6 +126,28 @@ namespace PeterDB {
         std::vector<Attribute> attrs;
         char key[PAGE_SIZE];
         RID rid;
+        std::vector<RID> prefetchedRids;    // entries already taken from the index, their pages are being read
+        unsigned prefetchIdx = 0;
+        FileHandle tableFileHandle;         // kept open for prefetching, so a batch does not open the table again
+        bool isTableOpen = false;           // without the table open, tuples are read without prefetching
+
+        RC prefetchNextEntries() {
+            prefetchedRids.clear();
+            prefetchIdx = 0;
+            while (prefetchedRids.size() < QE_PREFETCH_DEPTH && iter.getNextEntry(rid, key) == 0) {
+                prefetchedRids.push_back(rid);
+            }
+            if (prefetchedRids.empty()) return QE_EOF;
+
+            // A single tuple is cheaper to read directly
+            if (isTableOpen && prefetchedRids.size() > 1) {
+                std::vector<PageNum> pageNums;
+                for (const RID &prefetchedRid : prefetchedRids) pageNums.push_back(prefetchedRid.pageNum);
+                RC rc = BufferPoolManager::instance().prefetchPages(tableFileHandle, pageNums);
+                if (rc != 0) return rc;
+            }
+            return 0;
+        };
     public:
         IndexScan(RelationManager &rm, const std::string &tableName, const std::string &attrName,
                   const char *alias = NULL) : rm(rm) {
@@ -137,6 +160,7 @@ namespace PeterDB {
 
             // Call rm indexScan to get iterator
             rm.indexScan(tableName, attrName, NULL, NULL, true, true, iter);
+            isTableOpen = RecordBasedFileManager::instance().openFile(tableName, tableFileHandle) == 0;
 
             // Set alias
             if (alias) this->tableName = alias;
@@ -145,15 +169,18 @@ namespace PeterDB {
         // Start a new iterator given the new key range
         void setIterator(void *lowKey, void *highKey, bool lowKeyInclusive, bool highKeyInclusive) {
             iter.close();
+            prefetchedRids.clear();
+            prefetchIdx = 0;
             rm.indexScan(tableName, attrName, lowKey, highKey, lowKeyInclusive, highKeyInclusive, iter);
         };
 
         RC getNextTuple(void *data) override {
-            RC rc = iter.getNextEntry(rid, key);
-            if (rc == 0) {
-                rc = rm.readTuple(tableName, rid, data);
+            if (prefetchIdx == prefetchedRids.size()) {
+                RC rc = prefetchNextEntries();
+                if (rc != 0) return rc;
             }
-            return rc;
+            rid = prefetchedRids[prefetchIdx++];
+            return rm.readTuple(tableName, rid, data);
         };
 
         RC getAttributes(std::vector<Attribute> &attributes) const override {
@@ -165,10 +192,12 @@ namespace PeterDB {
             for (Attribute &attribute : attributes) {
                 attribute.name = tableName + "." + attribute.name;
             }
+            return 0;
         };
 
         ~IndexScan() override {
             iter.close();
+            if (isTableOpen) RecordBasedFileManager::instance().closeFile(tableFileHandle);
         };
     };
 
@@ -1,8 +1,8 @@
 #ifndef _rbfm_h_
 #define _rbfm_h_
 
-#define REC_OFF_SIZE sizeof(short)
-#define REC_LEN_SIZE sizeof(short)
+#define REC_OFF_SIZE sizeof(PageOffset)
+#define REC_LEN_SIZE sizeof(PageOffset)
 #define NUM_ATTR_SIZE sizeof(unsigned)
 #define ATTR_OFF_SIZE sizeof(int)
 
@@ -14,16 +14,29 @@
 #define PTR_PN_SIZE sizeof(unsigned)
 #define PTR_SN_SIZE sizeof(short)
 
-#define N_SIZE sizeof(short)
-#define F_SIZE sizeof(short)
+#define N_SIZE sizeof(PageCount)
+#define F_SIZE sizeof(PageCount)
 
 #define ATTR_TYPE_SIZE sizeof(AttrType)
 #define ATTR_LEN_SIZE sizeof(AttrLength)
 
+// Free space map: every data page gets a few bits holding its free-space class.
+// Page 0 and every (FSM_PAGE_SPAN+1)-th page after it are map pages, each one covers the data pages that follow it.
+#define FSM_CLASS_BITS 4
+#define FSM_NUM_CLASSES (1 << FSM_CLASS_BITS)
+#define FSM_CLASS_BYTES (PAGE_SIZE / FSM_NUM_CLASSES)           // free bytes guaranteed per class step
+#define FSM_PAGE_SPAN (PAGE_SIZE * 8 / FSM_CLASS_BITS)          // data pages covered by one map page
+
+#define RBFM_VACUUM_DRAIN_BYTES (PAGE_SIZE / 4)     // pages using less are emptied of moved records by vacuum
+
 #include <vector>
 
 #include "pfm.h"
 #include <cmath>
+#include <algorithm>
+#include <climits>
+#include <functional>
+#include <thread>
 #include <string>
 #include <cstring>
 #include <iostream>
@@ -60,6 +73,25 @@ namespace PeterDB {
         NO_OP       // no condition
     } CompOp;
 
+    // One condition of a multi-condition scan
+    typedef struct ScanCondition {
+        std::string attribute;  // condition attribute name
+        CompOp compOp;          // comparison type such as "<" and "="
+        const void *value;      // used in the comparison, stored like the attribute in insertRecord() data
+    } ScanCondition;
+
+    // What a vacuum call did
+    typedef struct VacuumStatistics {
+        unsigned chainsCollapsed = 0;       // forwarding chains of several hops cut down to one
+        unsigned recordsMovedHome = 0;      // moved records back on their home page, no hop left
+        unsigned recordsRelocated = 0;      // moved records taken off nearly empty pages
+        unsigned slotsReclaimed = 0;        // dead slots dropped from the end of slot directories
+        unsigned pagesFreed = 0;            // pages left without records and given back to the file
+    } VacuumStatistics;
+
+    // Receives the records of a parallel scan: the partition, the record's RID and its projected data
+    typedef std::function<RC(unsigned partition, const RID &rid, const void *data)> ScanConsumer;
+
     class RBFM_ScanIterator;
 
     class RecordBasedFileManager {
@@ -70,7 +102,8 @@ namespace PeterDB {
 
         RC destroyFile(const std::string &fileName);                        // Destroy a record-based file
 
-        RC openFile(const std::string &fileName, FileHandle &fileHandle);   // Open a record-based file
+        RC openFile(const std::string &fileName, FileHandle &fileHandle,
+                    FileOpenMode mode = ReadWriteMode);                     // Open a record-based file
 
         RC closeFile(FileHandle &fileHandle);                               // Close a record-based file
 
@@ -93,6 +126,11 @@ namespace PeterDB {
         RC insertRecord(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor, const void *data,
                         RID &rid);
 
+        // Insert a batch of records, each in the format above. Pages are built in memory up to fillFactor
+        // of their space and appended to the file. rids receives the RID of every record, in batch order.
+        RC insertRecords(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor,
+                         const std::vector<const void *> &batch, std::vector<RID> &rids, float fillFactor = 1.0);
+
         // Read a record identified by the given rid.
         RC readRecord(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor, const RID &rid, void *data);
 
@@ -127,24 +165,50 @@ namespace PeterDB {
                 const std::vector<std::string> &attributeNames, // a list of projected attributes
                 RBFM_ScanIterator &rbfm_ScanIterator);
 
+        // Scan with several conditions, a record qualifies if all of them hold, or any of them with anyCondition.
+        // The conditions are checked on the stored record, the one most likely to decide it goes first.
+        RC scan(const std::vector<Attribute> &recordDescriptor,
+                const std::vector<ScanCondition> &conditions,
+                const std::vector<std::string> &attributeNames,
+                RBFM_ScanIterator &rbfm_ScanIterator,
+                bool anyCondition = false);
+
+        // Scan a file on numPartitions threads, 0 uses one per core. The file's pages are split into that many
+        // disjoint ranges, each scanned by its own iterator. consumer gets every qualifying record, it is called
+        // from the scanning threads, never twice at once for the same partition. A non-zero return stops the scan.
+        RC parallelScan(const std::string &fileName, const std::vector<Attribute> &recordDescriptor,
+                        const std::vector<ScanCondition> &conditions, const std::vector<std::string> &attributeNames,
+                        unsigned numPartitions, const ScanConsumer &consumer, bool anyCondition = false);
+
+        // Vacuum up to maxPages pages from pageNum on, pageNum is left at the next page to vacuum.
+        // Calls can be spread out over time, a pass over the file is done once pageNum reaches getNumberOfPages().
+        // Forwarding chains are cut to one hop, or none when the home page has room again, moved records leave
+        // nearly empty pages, and dead slots at the end of slot directories are dropped.
+        // RIDs returned by insertRecord() stay valid, RIDs a scan returned for moved records may not.
+        RC vacuum(FileHandle &fileHandle, unsigned &pageNum, unsigned maxPages);
+
+        RC vacuum(FileHandle &fileHandle, unsigned &pageNum, unsigned maxPages, VacuumStatistics &stats);
+
         /*********************************************/
         /*****    Getter and Setter functions  *******/
         /*********************************************/
-        unsigned short getNumSlots(void* pageBuffer);
+        PageCount getNumSlots(void* pageBuffer);
+
+        PageCount getFreeBytes(void* pageBuffer);
 
-        unsigned short getFreeBytes(void* pageBuffer);
+        PageOffset getRecordLength(void* pageBuffer, unsigned short slotNum);
 
-        short getRecordLength(void* pageBuffer, unsigned short slotNum);
+        PageOffset getRecordOffset(void* pageBuffer, unsigned short slotNum);
 
-        short getRecordOffset(void* pageBuffer, unsigned short slotNum);
+        void setNumSlots(void* pageBuffer, PageCount numSlots);
 
-        void setNumSlots(void* pageBuffer, unsigned short numSlots);
+        void setFreeBytes(void* pageBuffer, PageCount freeBytes);
 
-        void setFreeBytes(void* pageBuffer, unsigned short freeBytes);
+        void setRecordLength(void* pageBuffer, unsigned short slotNum, PageOffset recordLength);
 
-        void setRecordLength(void* pageBuffer, unsigned short slotNum, short recordLength);
+        void setRecordOffset(void* pageBuffer, unsigned short slotNum, PageOffset recordOffset);
 
-        void setRecordOffset(void* pageBuffer, unsigned short slotNum, short recordOffset);
+        bool isFreeSpaceMapPage(unsigned pageNum);          // map pages hold no records
 
     private:
         PagedFileManager* pfm;
@@ -152,25 +216,59 @@ namespace PeterDB {
         /**********************************/
         /*****    Helper functions  *******/
         /**********************************/
-        short generateRecordLength(const std::vector<Attribute> &recordDescriptor, const void *data);
+        PageOffset generateRecordLength(const std::vector<Attribute> &recordDescriptor, const void *data);
 
         void generateRecord(const std::vector<Attribute> &recordDescriptor, const void *data, void *recordBuffer);
 
-        short getInsertStartOffset(void* pageBuffer);
+        PageOffset getInsertStartOffset(void* pageBuffer);
 
         bool hasEmptySlot(void* pageBuffer);
 
+        bool isPageDead(void* pageBuffer);                  // every slot of the page is deleted
+
         void initNewPage(void* recordBuffer, unsigned recordLength, void* pageBuffer);
 
-        bool insertRecordToPage(void* recordBuffer, short& recordOffset, short recordLength, void* pageBuffer);
+        bool insertRecordToPage(void* recordBuffer, PageOffset& recordOffset, PageOffset recordLength, void* pageBuffer);
+
+        PageCount reuseOrInsertSlot(PageOffset recordOffset, PageOffset recordLength, void* pageBuffer);
+
+        void shiftRecord(void* pageBuffer, PageOffset recordOffset, PageOffset recordLength, PageOffset distance);
+
+        RC checkAndFindRecord(FileHandle &fileHandle, void *pageBuffer, PageOffset &recordOffset, PageOffset &recordLength, RID &rid);
+
+        RC findRecord(FileHandle &fileHandle, void *pageBuffer, PageOffset &recordOffset, PageOffset &recordLength, RID &rid);
+
+        unsigned char getFreeSpaceClass(void* pageBuffer);
+
+        RC findPageWithSpace(FileHandle &fileHandle, PageOffset recordLength, unsigned &pageNum,
+                             void* fsmBuffer, int &fsmPageNum);
+
+        RC updateFreeSpaceMap(FileHandle &fileHandle, unsigned pageNum, unsigned char spaceClass,
+                              void* fsmBuffer, int &fsmPageNum);
+
+        RC allocateRecordPage(FileHandle &fileHandle, void* pageBuffer, unsigned &pageNum);
+
+        bool setFreeSpaceEntry(void* fsmBuffer, unsigned pageNum, unsigned char spaceClass);    // true if it changed
 
-        unsigned short reuseOrInsertSlot(short recordOffset, short recordLength, void* pageBuffer);
+        RC appendRecordPage(FileHandle &fileHandle, void* pageBuffer, unsigned &pageNum,
+                            void* fsmBuffer, int &fsmPageNum, bool &fsmDirty);
 
-        void shiftRecord(void* pageBuffer, short recordOffset, short recordLength, short distance);
+        void removeRecord(void* pageBuffer, unsigned short slotNum);    // record or forwarding stub
 
-        RC checkAndFindRecord(FileHandle &fileHandle, void *pageBuffer, short &recordOffset, short &recordLength, RID &rid);
+        PageCount trimDeadSlots(void* pageBuffer);
 
-        RC findRecord(FileHandle &fileHandle, void *pageBuffer, short &recordOffset, short &recordLength, RID &rid);
+        RC writeVacuumedPage(FileHandle &fileHandle, unsigned pageNum, void* pageBuffer,
+                             void* fsmBuffer, int &fsmPageNum, VacuumStatistics &stats);
+
+        RC removeSlot(FileHandle &fileHandle, const RID &rid, void* fsmBuffer, int &fsmPageNum, VacuumStatistics &stats);
+
+        RC vacuumPage(FileHandle &fileHandle, unsigned pageNum, void* fsmBuffer, int &fsmPageNum, VacuumStatistics &stats);
+
+        RC collapseForwarding(FileHandle &fileHandle, unsigned pageNum, unsigned short slotNum,
+                              void* fsmBuffer, int &fsmPageNum, VacuumStatistics &stats);
+
+        RC placeRecord(FileHandle &fileHandle, void* recordBuffer, PageOffset recordLength, void* pageBuffer,
+                       unsigned &pageNum, PageOffset &recordOffset, void* fsmBuffer, int &fsmPageNum);
 
     protected:
         RecordBasedFileManager();                                                   // Prevent construction
@@ -188,6 +286,8 @@ namespace PeterDB {
     ********************************************************************/
 
 # define RBFM_EOF (-1)  // end of a scan operator
+# define RBFM_BUFFER_TOO_SMALL (-2)     // the next record of a scan does not fit the caller's buffer
+# define RBFM_REORDER_INTERVAL 4096     // records checked between reorderings of scan conditions
 
     //  RBFM_ScanIterator is an iterator to go through records
     //  The way to use it is like the following:
@@ -200,6 +300,11 @@ namespace PeterDB {
 
     class RBFM_ScanIterator {
     public:
+        // A condition compiled for one attribute type and operator, applied to the stored attribute value
+        typedef bool (*Predicate)(const char* attr, const char* value);
+
+        static Predicate compilePredicate(AttrType type, CompOp compOp);
+
         RBFM_ScanIterator() = default;
 
         ~RBFM_ScanIterator() = default;
@@ -208,12 +313,24 @@ namespace PeterDB {
                       const std::string &conditionAttribute, const CompOp compOp, const void *value,
                       const std::vector<std::string> &attributeNames, RecordBasedFileManager* rbfm);
 
+        RC initialize(const std::vector<Attribute> &recordDescriptor,
+                      const std::vector<ScanCondition> &conditions, bool anyCondition,
+                      const std::vector<std::string> &attributeNames, RecordBasedFileManager* rbfm);
+
         // Never keep the results in the memory. When getNextRecord() is called,
         // a satisfying record needs to be fetched from the file.
         // "data" follows the same format as RecordBasedFileManager::insertRecord().
 
         RC getNextRecord(RID &rid, void *data);
 
+        // Only scan pages firstPageNum up to but not including endPageNum, call after initialize()
+        RC setPageRange(unsigned firstPageNum, unsigned endPageNum);
+
+        // Fetch up to maxRecords records at once. The records are placed back to back in buffer, each in the
+        // getNextRecord() format, and their RIDs in rids. count is set to the number fetched.
+        // Returns RBFM_EOF when nothing is left, RBFM_BUFFER_TOO_SMALL if the next record alone does not fit in bufferSize.
+        RC getNextBatch(RID *rids, void *buffer, size_t bufferSize, unsigned maxRecords, unsigned &count);
+
         RC close();
 
         FileHandle fileHandle;
@@ -221,19 +338,42 @@ namespace PeterDB {
     private:
         RecordBasedFileManager* rbfm;
 
+        // A condition ready to be checked, with how often it was checked and held so far
+        typedef struct CompiledCondition {
+            short attrIdx;
+            CompOp compOp;
+            const void* value;
+            Predicate predicate;
+            unsigned numChecked;
+            unsigned numPassed;
+        } CompiledCondition;
+
         std::vector<Attribute> recordDescriptor;
-        CompOp compOp;
-        const void* value;
         std::vector<std::string> attributeNames;
-        int currPageNum;
+        unsigned currPageNum;
         short currSlotNum;
         std::vector<short> targetAttrIdxs;
-        short conditionAttrIdx;
-        AttrType conditionType;
+        std::vector<CompiledCondition> conditions;     // in checking order, empty matches every record
+        bool anyCondition;                              // conditions are ORed instead of ANDed
+        bool matchesAll;                                // an ORed NO_OP condition lets every record through
+        unsigned numMatched;                            // records checked since the conditions were last ordered
+        unsigned endPageNum;                            // the scan stops before this page
+        std::vector<char> pageBuffer;   // copy of the page being walked, unused for mapped files
+        unsigned bufferedPageNum;       // page held in pageBuffer, UINT_MAX if none
+        unsigned nullIndicatorSize;     // of a projected record
+        unsigned attrDataOffset;        // from the start of a stored record to its attribute values
+
+        RC parseAttr(PageOffset &attrLen, PageOffset &attrOffset, void* pageBuffer, PageOffset recordOffset, short idx, int numAttrs);
+
+        bool matchCondition(const CompiledCondition &condition, void* pageBuffer, PageOffset recordOffset);
+
+        bool matchRecord(void* pageBuffer, PageOffset recordOffset);
+
+        void orderConditions();
 
-        RC parseAttr(short &attrLen, short &attrOffset, void* pageBuffer, short recordOffset, short idx, int numAttrs);
+        size_t getProjectedSize(void* pageBuffer, PageOffset recordOffset);
 
-        bool findCondAttr(const void *checkAttr, short attrLen);
+        void projectRecord(void* pageBuffer, PageOffset recordOffset, void* data);
     };
 
 } // namespace PeterDB
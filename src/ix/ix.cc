@@ -21,8 +21,8 @@ namespace PeterDB {
         return pfm->destroyFile(fileName);
     }
 
-    RC IndexManager::openFile(const std::string &fileName, IXFileHandle &ixFileHandle) {
-        return pfm->openFile(fileName, ixFileHandle.fileHandle);
+    RC IndexManager::openFile(const std::string &fileName, IXFileHandle &ixFileHandle, FileOpenMode mode) {
+        return pfm->openFile(fileName, ixFileHandle.fileHandle, mode);
     }
 
     RC IndexManager::closeFile(IXFileHandle &ixFileHandle) {
@@ -32,7 +32,7 @@ namespace PeterDB {
     RC IndexManager::insertEntry(IXFileHandle &ixFileHandle, const Attribute &attribute, const void *key, const RID &rid) {
         void* pageBuffer = malloc(PAGE_SIZE);
         AttrType attrType = attribute.type;
-        unsigned short keyLength = getKeyLength(key, attrType);
+        PageCount keyLength = getKeyLength(key, attrType);
 
         // B+ tree has 0 node
         if (ixFileHandle.fileHandle.getNumberOfPages() == 0) {
@@ -45,7 +45,7 @@ namespace PeterDB {
             if (errCode != 0) return errCode;
 
             // set up the first leaf node (root)
-            unsigned short bytesNeeded = keyLength + PTR_PN_SIZE + PTR_SN_SIZE;
+            PageCount bytesNeeded = keyLength + PTR_PN_SIZE + PTR_SN_SIZE;
             void* firstEntry = malloc(bytesNeeded);
             memcpy((char*) firstEntry, (char*) key, keyLength);
             memcpy((char*) firstEntry+keyLength, &rid.pageNum, PTR_PN_SIZE);
@@ -82,7 +82,7 @@ namespace PeterDB {
 
         void* pageBuffer = malloc(PAGE_SIZE);
         AttrType attrType = attribute.type;
-        unsigned short keyLength = getKeyLength(key, attrType);
+        PageCount keyLength = getKeyLength(key, attrType);
 
         // get root page
         unsigned pageNumTobeDeleted = getRootPageNum(ixFileHandle);
@@ -91,7 +91,7 @@ namespace PeterDB {
 
         // find the leaf node (potentially) containing the entry
         bool isLeaf = getIsLeaf(pageBuffer);
-        unsigned short numKeys = getNumKeys(pageBuffer);
+        PageCount numKeys = getNumKeys(pageBuffer);
         while (!isLeaf) {
             errCode = findPageNumToBeHandled(pageBuffer, keyLength, key, rid,
                                              numKeys, attrType, pageNumTobeDeleted);
@@ -105,10 +105,10 @@ namespace PeterDB {
         }
         //std::cout << "inside deleteEntry, pageNumTobeDeleted is "<<pageNumTobeDeleted<<std::endl;
 
-        unsigned short currKeyPtr = IS_LEAF_SIZE;
+        PageCount currKeyPtr = IS_LEAF_SIZE;
         unsigned currPageNum;
         unsigned short currSlotNum;
-        unsigned short sizePassed;
+        PageCount sizePassed;
         int keyIdx;
         // attribute type is varChar
         if (attrType == TypeVarChar) {
@@ -225,7 +225,7 @@ namespace PeterDB {
     /*********************************************/
     /*****    Getter and Setter functions  *******/
     /*********************************************/
-    unsigned short IndexManager::getKeyLength(const void *key, AttrType attrType) {
+    PageCount IndexManager::getKeyLength(const void *key, AttrType attrType) {
         unsigned keyLength;
         if (attrType == TypeVarChar) {
             memcpy(&keyLength, key, VC_LEN_SIZE);
@@ -234,7 +234,7 @@ namespace PeterDB {
         else {
             keyLength = INT_OR_FLT_SIZE;
         }
-        return (unsigned short) keyLength;
+        return (PageCount) keyLength;
     }
 
     unsigned IndexManager::getRootPageNum(IXFileHandle &ixFileHandle) const {
@@ -256,14 +256,14 @@ namespace PeterDB {
         return isLeaf;
     }
 
-    unsigned short IndexManager::getNumKeys(void* pageBuffer) const {
-        unsigned short numKeys;
+    PageCount IndexManager::getNumKeys(void* pageBuffer) const {
+        PageCount numKeys;
         memcpy(&numKeys, (char*) pageBuffer+PAGE_SIZE-N_SIZE-F_SIZE, N_SIZE);
         return numKeys;
     }
 
-    unsigned short IndexManager::getFreeBytes(void* pageBuffer) const {
-        unsigned short freeBytes;
+    PageCount IndexManager::getFreeBytes(void* pageBuffer) const {
+        PageCount freeBytes;
         memcpy(&freeBytes, (char*) pageBuffer+PAGE_SIZE-F_SIZE, F_SIZE);
         return freeBytes;
     }
@@ -278,11 +278,11 @@ namespace PeterDB {
         memcpy((char*) pageBuffer, &isLeaf, IS_LEAF_SIZE);
     }
 
-    void IndexManager::setNumKeys(void* pageBuffer, unsigned short numKeys) {
+    void IndexManager::setNumKeys(void* pageBuffer, PageCount numKeys) {
         memcpy((char*) pageBuffer+PAGE_SIZE-N_SIZE-F_SIZE, &numKeys, N_SIZE);
     }
 
-    void IndexManager::setFreeBytes(void* pageBuffer, unsigned short freeBytes) {
+    void IndexManager::setFreeBytes(void* pageBuffer, PageCount freeBytes) {
         memcpy((char*) pageBuffer+PAGE_SIZE-F_SIZE, &freeBytes, F_SIZE);
     }
 
@@ -298,14 +298,14 @@ namespace PeterDB {
                                   const RID &rid, void* &newChildEntry, unsigned rootPageNum) {
         bool isRoot = pageNum == rootPageNum;
         bool isLeaf = getIsLeaf(pageBuffer);
-        unsigned short freeBytes = getFreeBytes(pageBuffer);
-        unsigned short numKeys = getNumKeys(pageBuffer);
+        PageCount freeBytes = getFreeBytes(pageBuffer);
+        PageCount numKeys = getNumKeys(pageBuffer);
         //std::cout << "Inside insertEntry1, isLeaf? " << isLeaf << std::endl;
 
         // node is non-leaf node
         if (isLeaf) {
             // generate the entry to be inserted to leaf node
-            unsigned short bytesNeeded = keyLength + PTR_PN_SIZE + PTR_SN_SIZE;
+            PageCount bytesNeeded = keyLength + PTR_PN_SIZE + PTR_SN_SIZE;
             void* entryToBeInserted = malloc(bytesNeeded);
             memcpy((char*) entryToBeInserted, (char*) key, keyLength);
             memcpy((char*) entryToBeInserted + keyLength, &rid.pageNum, PTR_PN_SIZE);
@@ -351,7 +351,7 @@ namespace PeterDB {
                 errCode = ixFileHandle.fileHandle.readPage(pageNum, pageBuffer);
                 if(errCode != 0) return errCode;
 
-                unsigned short bytesNeeded = getKeyLength(newChildEntry, attrType)+PTR_PN_SIZE+PTR_SN_SIZE+PTR_PN_SIZE;
+                PageCount bytesNeeded = getKeyLength(newChildEntry, attrType)+PTR_PN_SIZE+PTR_SN_SIZE+PTR_PN_SIZE;
                 // newChildEntry can be inserted in this non-leaf node
                 if (bytesNeeded <= freeBytes) {
                     RC errCode = insertEntryToPage(pageBuffer, newChildEntry, bytesNeeded,
@@ -376,13 +376,13 @@ namespace PeterDB {
         return 0;
     }
 
-    RC IndexManager::insertEntryToPage(void* pageBuffer, const void *key, unsigned short bytesNeeded,
-                                       unsigned short freeBytes, unsigned short numKeys,
+    RC IndexManager::insertEntryToPage(void* pageBuffer, const void *key, PageCount bytesNeeded,
+                                       PageCount freeBytes, PageCount numKeys,
                                        AttrType attrType, bool isLeaf, bool isHuge) {
         // initialize currKeyPtr, sizeToBeShifted and keyLength
-        unsigned short currKeyPtr;
-        unsigned short sizeToBeShifted;
-        unsigned short keyLength;
+        PageCount currKeyPtr;
+        PageCount sizeToBeShifted;
+        PageCount keyLength;
         if (isLeaf) {
             currKeyPtr = IS_LEAF_SIZE;
             sizeToBeShifted = PAGE_SIZE-F_SIZE-N_SIZE-NXT_PN_SIZE-freeBytes-IS_LEAF_SIZE;
@@ -401,7 +401,7 @@ namespace PeterDB {
 
         unsigned currPageNum;
         unsigned short currSlotNum;
-        unsigned short sizePassed;
+        PageCount sizePassed;
         // attribute type is varChar
         if (attrType == TypeVarChar) {
             // generate key varChar
@@ -505,8 +505,8 @@ namespace PeterDB {
     }
 
     RC IndexManager::findPageNumToBeHandled(void* pageBuffer, unsigned keyLength, const void *key, const RID &rid,
-                                             unsigned short numKeys, AttrType attrType, unsigned& pageNumToBeHandled) {
-        unsigned short currKeyPtr = IS_LEAF_SIZE + PTR_PN_SIZE;
+                                             PageCount numKeys, AttrType attrType, unsigned& pageNumToBeHandled) {
+        PageCount currKeyPtr = IS_LEAF_SIZE + PTR_PN_SIZE;
         unsigned currPageNum;
         unsigned short currSlotNum;
         // attribute type is varChar
@@ -533,7 +533,7 @@ namespace PeterDB {
                 else if (newKeyVarChar < currKeyVarChar) break;
 
                 // if not, go to next varChar
-                unsigned short sizePassed = currVarCharLen+VC_LEN_SIZE+PTR_PN_SIZE+PTR_SN_SIZE+PTR_PN_SIZE;
+                PageCount sizePassed = currVarCharLen+VC_LEN_SIZE+PTR_PN_SIZE+PTR_SN_SIZE+PTR_PN_SIZE;
                 currKeyPtr += sizePassed;
             }
         }
@@ -561,7 +561,7 @@ namespace PeterDB {
                 else if (newKeyInt < currKeyInt) break;
 
                 // if not, go to next int
-                unsigned short sizePassed = INT_SIZE+PTR_PN_SIZE+PTR_SN_SIZE+PTR_PN_SIZE;
+                PageCount sizePassed = INT_SIZE+PTR_PN_SIZE+PTR_SN_SIZE+PTR_PN_SIZE;
                 currKeyPtr += sizePassed;
             }
         }
@@ -589,7 +589,7 @@ namespace PeterDB {
                 else if (newKeyFlt < currKeyFlt) break;
 
                 // if not, go to next float
-                unsigned short sizePassed = FLT_SIZE+PTR_PN_SIZE+PTR_SN_SIZE+PTR_PN_SIZE;
+                PageCount sizePassed = FLT_SIZE+PTR_PN_SIZE+PTR_SN_SIZE+PTR_PN_SIZE;
                 currKeyPtr += sizePassed;
             }
         }
@@ -599,8 +599,8 @@ namespace PeterDB {
         return 0;
     }
 
-    RC IndexManager::splitNode(IXFileHandle &ixFileHandle, void* pageBuffer, const void *key, unsigned short bytesNeeded,
-                               void* &newChildEntry, unsigned pageNum, unsigned short freeBytes, unsigned short numKeys,
+    RC IndexManager::splitNode(IXFileHandle &ixFileHandle, void* pageBuffer, const void *key, PageCount bytesNeeded,
+                               void* &newChildEntry, unsigned pageNum, PageCount freeBytes, PageCount numKeys,
                                AttrType attrType, bool isLeaf, bool isRoot) {
         // initialize huge page buffer
         void* hugePageBuffer = malloc(2*PAGE_SIZE);
@@ -612,8 +612,8 @@ namespace PeterDB {
         if(errCode != 0) return errCode;
 
         // initialize currKeyPtr and sizeToBeCopied (to right sibling)
-        unsigned short currKeyPtr;
-        unsigned short sizeToBeCopied;
+        PageCount currKeyPtr;
+        PageCount sizeToBeCopied;
         if (isLeaf) {
             currKeyPtr = IS_LEAF_SIZE;
             sizeToBeCopied = PAGE_SIZE-F_SIZE-N_SIZE-NXT_PN_SIZE-freeBytes-IS_LEAF_SIZE+bytesNeeded;
@@ -623,7 +623,7 @@ namespace PeterDB {
             sizeToBeCopied = PAGE_SIZE-F_SIZE-N_SIZE-freeBytes-IS_LEAF_SIZE-PTR_PN_SIZE+bytesNeeded;
         }
 
-        unsigned short sizeToBePassed;
+        PageCount sizeToBePassed;
         int keyIdx;
         // attribute type is varChar
         if (attrType == TypeVarChar) {
@@ -636,7 +636,7 @@ namespace PeterDB {
 
                     // set numKeys and freeBytes of left sibling (original pageBuffer)
                     setNumKeys(pageBuffer, keyIdx-1);
-                    unsigned short leftSiblingFreeBytes;
+                    PageCount leftSiblingFreeBytes;
                     if (isLeaf) leftSiblingFreeBytes = PAGE_SIZE-currKeyPtr+sizeToBePassed-F_SIZE-N_SIZE-NXT_PN_SIZE;
                     else leftSiblingFreeBytes = PAGE_SIZE-currKeyPtr+sizeToBePassed-F_SIZE-N_SIZE;
                     setFreeBytes(pageBuffer, leftSiblingFreeBytes);
@@ -669,7 +669,7 @@ namespace PeterDB {
 
                     // set numKeys and freeBytes of left sibling (original pageBuffer)
                     setNumKeys(pageBuffer, keyIdx-1);
-                    unsigned short leftSiblingFreeBytes;
+                    PageCount leftSiblingFreeBytes;
                     if (isLeaf) leftSiblingFreeBytes = PAGE_SIZE-currKeyPtr+sizeToBePassed-F_SIZE-N_SIZE-NXT_PN_SIZE;
                     else leftSiblingFreeBytes = PAGE_SIZE-currKeyPtr+sizeToBePassed-F_SIZE-N_SIZE;
                     setFreeBytes(pageBuffer, leftSiblingFreeBytes);
@@ -701,13 +701,14 @@ namespace PeterDB {
         if(errCode != 0) return errCode;
         free(hugePageBuffer);
 
-        // append right sibling
-        errCode = ixFileHandle.fileHandle.appendPage(rightSiblingPageBuffer);
+        // write right sibling into a free page or append it
+        PageNum allocatedPageNum;
+        errCode = ixFileHandle.fileHandle.allocatePage(rightSiblingPageBuffer, allocatedPageNum);
         if(errCode != 0) return errCode;
         free(rightSiblingPageBuffer);
 
         // finish prepare left sibling and newChildEntry
-        int rightSiblingPageNum = ixFileHandle.fileHandle.getNumberOfPages()-1;
+        int rightSiblingPageNum = allocatedPageNum;
         if (isLeaf) {
             memcpy((char*) newChildEntry+sizeToBePassed, &rightSiblingPageNum, PTR_PN_SIZE);
             setNextPageNum(pageBuffer, rightSiblingPageNum);
@@ -725,7 +726,7 @@ namespace PeterDB {
             void* newRootPageBuffer = malloc(PAGE_SIZE);
 
             // new root entry contains ptr to left sibling, varChar/int/float, rid, ptr to right sibling
-            unsigned short newRootEntryLength;
+            PageCount newRootEntryLength;
             if (isLeaf) newRootEntryLength = sizeToBePassed + 2*PTR_PN_SIZE;
             else newRootEntryLength = sizeToBePassed + PTR_PN_SIZE;
 
@@ -738,12 +739,12 @@ namespace PeterDB {
             errCode = initNonLeafNode(newRootPageBuffer, newRootEntry, newRootEntryLength, 1);
             if(errCode != 0) return errCode;
 
-            // append new root node
-            errCode = ixFileHandle.fileHandle.appendPage(newRootPageBuffer);
+            // write new root node into a free page or append it
+            unsigned newRootPageNum;
+            errCode = ixFileHandle.fileHandle.allocatePage(newRootPageBuffer, newRootPageNum);
             if(errCode != 0) return errCode;
 
             // update meta data page
-            unsigned newRootPageNum = ixFileHandle.fileHandle.getNumberOfPages()-1;
             errCode = ixFileHandle.fileHandle.readPage(0, pageBuffer);
             if (errCode != 0) return errCode;
 
@@ -758,7 +759,7 @@ namespace PeterDB {
         return 0;
     }
 
-    RC IndexManager::initLeafNode(void* pageBuffer, void* entryPtr, unsigned short bytesNeeded,
+    RC IndexManager::initLeafNode(void* pageBuffer, void* entryPtr, PageCount bytesNeeded,
                                   int numKeys, int nextPageNum){
         bool isLeaf = true;
         setIsLeaf(pageBuffer, isLeaf);
@@ -769,7 +770,7 @@ namespace PeterDB {
         return 0;
     }
 
-    RC IndexManager::initNonLeafNode(void* pageBuffer, void* entryPtr, unsigned short bytesNeeded, int numKeys){
+    RC IndexManager::initNonLeafNode(void* pageBuffer, void* entryPtr, PageCount bytesNeeded, int numKeys){
         bool isLeaf = false;
         setIsLeaf(pageBuffer, isLeaf);
         memcpy((char*) pageBuffer + IS_LEAF_SIZE, entryPtr, bytesNeeded);
@@ -784,12 +785,12 @@ namespace PeterDB {
         ixFileHandle.fileHandle.readPage(pageNum, pageBuffer);
 
         bool isLeaf = getIsLeaf(pageBuffer);
-        unsigned short numKeys = getNumKeys(pageBuffer);
+        PageCount numKeys = getNumKeys(pageBuffer);
 
         for (int i = 0; i < indent; i++) out << " ";
 
         if (isLeaf) {
-            unsigned short currKeyPtr = IS_LEAF_SIZE;
+            PageCount currKeyPtr = IS_LEAF_SIZE;
             unsigned currPageNum;
             unsigned short currSlotNum;
             out << "{\"keys\": [";
@@ -814,7 +815,7 @@ namespace PeterDB {
                     if (i == numKeys-1) out << "]\"";
 
                     // go to next varChar
-                    unsigned short sizePassed = currVarCharLen + VC_LEN_SIZE + PTR_PN_SIZE + PTR_SN_SIZE;
+                    PageCount sizePassed = currVarCharLen + VC_LEN_SIZE + PTR_PN_SIZE + PTR_SN_SIZE;
                     currKeyPtr += sizePassed;
                     prevKeyVarChar = currKeyVarChar;
                 }
@@ -838,7 +839,7 @@ namespace PeterDB {
                     if (i == numKeys-1) out << "]\"";
 
                     // go to next int
-                    unsigned short sizePassed = INT_SIZE + PTR_PN_SIZE + PTR_SN_SIZE;
+                    PageCount sizePassed = INT_SIZE + PTR_PN_SIZE + PTR_SN_SIZE;
                     currKeyPtr += sizePassed;
                     prevKeyInt = currKeyInt;
                 }
@@ -862,7 +863,7 @@ namespace PeterDB {
                     if (i == numKeys-1) out << "]\"";
 
                     // go to next float
-                    unsigned short sizePassed = FLT_SIZE + PTR_PN_SIZE + PTR_SN_SIZE;
+                    PageCount sizePassed = FLT_SIZE + PTR_PN_SIZE + PTR_SN_SIZE;
                     currKeyPtr += sizePassed;
                     prevKeyFlt = currKeyFlt;
                 }
@@ -872,7 +873,7 @@ namespace PeterDB {
         // node is non-leaf node
         else {
             out << "{\"keys\": [";
-            unsigned short currKeyPtr = IS_LEAF_SIZE+PTR_PN_SIZE;
+            PageCount currKeyPtr = IS_LEAF_SIZE+PTR_PN_SIZE;
             std::vector<int> pageNumVector;
             int currPageNum;
 
@@ -904,7 +905,7 @@ namespace PeterDB {
                     else out << ",";
 
                     // go to next varChar
-                    unsigned short sizePassed = currVarCharLen + VC_LEN_SIZE + PTR_PN_SIZE + PTR_SN_SIZE + PTR_PN_SIZE;
+                    PageCount sizePassed = currVarCharLen + VC_LEN_SIZE + PTR_PN_SIZE + PTR_SN_SIZE + PTR_PN_SIZE;
                     currKeyPtr += sizePassed;
                 }
             }
@@ -929,7 +930,7 @@ namespace PeterDB {
                     else out << ",";
 
                     // go to next int
-                    unsigned short sizePassed = INT_SIZE + PTR_PN_SIZE + PTR_SN_SIZE + PTR_PN_SIZE;
+                    PageCount sizePassed = INT_SIZE + PTR_PN_SIZE + PTR_SN_SIZE + PTR_PN_SIZE;
                     currKeyPtr += sizePassed;
                 }
             }
@@ -954,7 +955,7 @@ namespace PeterDB {
                     else out << ",";
 
                     // go to next float
-                    unsigned short sizePassed = FLT_SIZE + PTR_PN_SIZE + PTR_SN_SIZE + PTR_PN_SIZE;
+                    PageCount sizePassed = FLT_SIZE + PTR_PN_SIZE + PTR_SN_SIZE + PTR_PN_SIZE;
                     currKeyPtr += sizePassed;
                 }
             }
@@ -992,18 +993,20 @@ namespace PeterDB {
         this->isFirstGetNextEntry = true;
 
         unsigned rootPageNum = this->ix->getRootPageNum(*this->ixFileHandle);
-        this->currPageBuffer = malloc(PAGE_SIZE);
-        return this->ixFileHandle->fileHandle.readPage(rootPageNum, currPageBuffer);
+        this->ownPageBuffer = malloc(PAGE_SIZE);
+        this->currPageBuffer = ownPageBuffer;
+        return loadPage(rootPageNum);
     }
 
     RC IX_ScanIterator::getNextEntry(RID &rid, void *key) {
+        if (ixFileHandle == nullptr || currPageBuffer == nullptr) return -1;
         if (ixFileHandle->fileHandle.getNumberOfPages() == 0) return -1;
-        unsigned short numKeys = ix->getNumKeys(currPageBuffer);
+        PageCount numKeys = ix->getNumKeys(currPageBuffer);
 
         // if the first time call getNextEntry, need to find first leaf node from root node
         if (isFirstGetNextEntry) {
             int pageNumTobeScanned;
-            //unsigned short currKeyPtr;
+            //PageCount currKeyPtr;
             isFirstGetNextEntry = false;
 
             bool isLeaf = ix->getIsLeaf(currPageBuffer);
@@ -1019,7 +1022,7 @@ namespace PeterDB {
 
                 // read pageNumTobeScanned
                 memcpy(&pageNumTobeScanned, (char*) currPageBuffer+ixCurrKeyPtr-PTR_PN_SIZE, PTR_PN_SIZE);
-                RC errCode = ixFileHandle->fileHandle.readPage(pageNumTobeScanned, currPageBuffer);
+                RC errCode = loadPage(pageNumTobeScanned);
                 if (errCode != 0) return errCode;
 
                 isLeaf = ix->getIsLeaf(currPageBuffer);
@@ -1045,8 +1048,8 @@ namespace PeterDB {
         // if not the first time call getNextEntry
         else {
             // freeBytes is a number stored, bytesLeft is the bytes after ixCurrKeyPtr
-            unsigned short freeBytes = ix->getFreeBytes(currPageBuffer);
-            unsigned short bytesLeft = PAGE_SIZE - ixCurrKeyPtr - NXT_PN_SIZE - N_SIZE - F_SIZE;
+            PageCount freeBytes = ix->getFreeBytes(currPageBuffer);
+            PageCount bytesLeft = PAGE_SIZE - ixCurrKeyPtr - NXT_PN_SIZE - N_SIZE - F_SIZE;
             //std::cout << "Inside getNextEntry, freeBytes is " << freeBytes << ", bytesLeft is " << bytesLeft << std::endl;
 
             // reached the last entry in leaf node
@@ -1061,7 +1064,7 @@ namespace PeterDB {
             // attribute type is varChar
             if (attrType == TypeVarChar) {
                 // generate high key varChar
-                unsigned short highKeyLength = ix->getKeyLength(highKey, attrType);
+                PageCount highKeyLength = ix->getKeyLength(highKey, attrType);
                 std::string highKeyVarChar = std::string((char*) highKey+VC_LEN_SIZE, highKeyLength-VC_LEN_SIZE);
 
                 // generate current varChar
@@ -1110,7 +1113,7 @@ namespace PeterDB {
             }
         }
 
-        unsigned short keyLength = ix->getKeyLength((char*) currPageBuffer+ixCurrKeyPtr, attrType);
+        PageCount keyLength = ix->getKeyLength((char*) currPageBuffer+ixCurrKeyPtr, attrType);
         memcpy((char*) key, (char*) currPageBuffer+ixCurrKeyPtr, keyLength);
         memcpy(&rid.pageNum, (char*) currPageBuffer+ixCurrKeyPtr+keyLength, PTR_PN_SIZE);
         memcpy(&rid.slotNum, (char*) currPageBuffer+ixCurrKeyPtr+keyLength+PTR_PN_SIZE, PTR_SN_SIZE);
@@ -1119,7 +1122,29 @@ namespace PeterDB {
     }
 
     RC IX_ScanIterator::close() {
-        free(currPageBuffer);
+        free(ownPageBuffer);
+        ownPageBuffer = nullptr;
+        currPageBuffer = nullptr;
+        return 0;
+    }
+
+    RC IX_ScanIterator::loadPage(unsigned pageNum) {
+        FileHandle& fileHandle = ixFileHandle->fileHandle;
+        if (!fileHandle.isMapped()) {
+            RC errCode = fileHandle.readPage(pageNum, ownPageBuffer);
+            if (errCode != 0) return errCode;
+        }
+        // Mapped index is scanned in place
+        else {
+            currPageBuffer = (void*) fileHandle.pageView(pageNum);
+            if (currPageBuffer == nullptr) return -1;
+        }
+
+        // Leaves are rarely adjacent on disk, hint the kernel about the next one in the chain
+        if (ix->getIsLeaf(currPageBuffer)) {
+            int nextPageNum = ix->getNextPageNum(currPageBuffer);
+            if (nextPageNum != -1) fileHandle.adviseWillNeed(nextPageNum, 1);
+        }
         return 0;
     }
 
@@ -1127,17 +1152,17 @@ namespace PeterDB {
         int nextPageNum = ix->getNextPageNum(currPageBuffer);
         if (nextPageNum == -1) return IX_EOF;
 
-        RC errCode = ixFileHandle->fileHandle.readPage(nextPageNum, currPageBuffer);
+        RC errCode = loadPage(nextPageNum);
         if (errCode != 0) return errCode;
 
-        unsigned short numKeys = ix->getNumKeys(currPageBuffer);
+        PageCount numKeys = ix->getNumKeys(currPageBuffer);
 
         // find the next first leaf node that is not empty
         while (numKeys == 0){
             nextPageNum = ix->getNextPageNum(currPageBuffer);
             if (nextPageNum == -1)  return IX_EOF;
 
-            RC errCode = ixFileHandle->fileHandle.readPage(nextPageNum, currPageBuffer);
+            RC errCode = loadPage(nextPageNum);
             if (errCode != 0) return errCode;
 
             numKeys = ix->getNumKeys(currPageBuffer);
@@ -1147,11 +1172,11 @@ namespace PeterDB {
         return 0;
     }
 
-    RC IX_ScanIterator::findEntryToOutput(int& keyIdx, unsigned short numKeys, bool isLeaf) {
+    RC IX_ScanIterator::findEntryToOutput(int& keyIdx, PageCount numKeys, bool isLeaf) {
         // attribute type is varChar
         if (attrType == TypeVarChar) {
             // generate low key varChar
-            unsigned short lowKeyLength = ix->getKeyLength(lowKey, attrType);
+            PageCount lowKeyLength = ix->getKeyLength(lowKey, attrType);
             std::string lowKeyVarChar = std::string((char*) lowKey+VC_LEN_SIZE, lowKeyLength-VC_LEN_SIZE);
 
             unsigned currVarCharLen;
@@ -1169,7 +1194,7 @@ namespace PeterDB {
                 }
 
                 // not found, go to next varChar
-                unsigned short sizePassed;
+                PageCount sizePassed;
                 if (isLeaf) sizePassed = VC_LEN_SIZE+currVarCharLen+PTR_PN_SIZE+PTR_SN_SIZE;
                 else sizePassed = VC_LEN_SIZE+currVarCharLen+PTR_PN_SIZE+PTR_SN_SIZE+PTR_PN_SIZE;
                 ixCurrKeyPtr += sizePassed;
@@ -1194,7 +1219,7 @@ namespace PeterDB {
                 }
 
                 // not found, go to next int
-                unsigned short sizePassed;
+                PageCount sizePassed;
                 if (isLeaf) sizePassed = INT_SIZE+PTR_PN_SIZE+PTR_SN_SIZE;
                 else sizePassed = INT_SIZE+PTR_PN_SIZE+PTR_SN_SIZE+PTR_PN_SIZE;
                 ixCurrKeyPtr += sizePassed;
@@ -1219,7 +1244,7 @@ namespace PeterDB {
                 }
 
                 // not found, go to next float
-                unsigned short sizePassed;
+                PageCount sizePassed;
                 if (isLeaf) sizePassed = FLT_SIZE+PTR_PN_SIZE+PTR_SN_SIZE;
                 else sizePassed = FLT_SIZE+PTR_PN_SIZE+PTR_SN_SIZE+PTR_PN_SIZE;
                 ixCurrKeyPtr += sizePassed;
@@ -1246,4 +1271,16 @@ namespace PeterDB {
         return 0;
     }
 
+    RC IXFileHandle::collectCounterValues(unsigned &readPageCount, unsigned &writePageCount, unsigned &appendPageCount,
+                                          unsigned &hitCount, unsigned &missCount) {
+        RC errCode = fileHandle.collectCounterValues(readPageCount, writePageCount, appendPageCount, hitCount,
+                                                     missCount);
+        if (errCode != 0) return errCode;
+
+        ixReadPageCounter = readPageCount;
+        ixWritePageCounter = writePageCount;
+        ixAppendPageCounter = appendPageCount;
+        return 0;
+    }
+
 } // namespace PeterDB
\ No newline at end of file
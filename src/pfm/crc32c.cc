@@ -0,0 +1,114 @@
+#include "src/include/crc32c.h"
+#include <cstring>
+#include <cstdint>
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#endif
+
+namespace PeterDB {
+    // table[k][b] is the CRC of byte b followed by k zero bytes
+    typedef struct {
+        uint32_t table[8][256];
+    } CRC32CTables;
+
+    static CRC32CTables buildTables() {
+        CRC32CTables tables;
+        for (unsigned b = 0; b < 256; b++) {
+            uint32_t crc = b;
+            for (int bit = 0; bit < 8; bit++) crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+            tables.table[0][b] = crc;
+        }
+        for (unsigned b = 0; b < 256; b++) {
+            for (int k = 1; k < 8; k++) {
+                uint32_t crc = tables.table[k - 1][b];
+                tables.table[k][b] = (crc >> 8) ^ tables.table[0][crc & 0xff];
+            }
+        }
+        return tables;
+    }
+
+    static const CRC32CTables &getTables() {
+        static const CRC32CTables tables = buildTables();
+        return tables;
+    }
+
+    unsigned CRC32C::compute(const void* data, size_t size) {
+        static const bool hasHardware = isHardwareAccelerated();
+        return hasHardware ? computeHardware(data, size) : computeTable(data, size);
+    }
+
+    bool CRC32C::isHardwareAccelerated() {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+        return __builtin_cpu_supports("sse4.2");
+#else
+        return false;
+#endif
+    }
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    __attribute__((target("sse4.2")))
+    unsigned CRC32C::computeHardware(const void* data, size_t size) {
+        const unsigned char* bytes = (const unsigned char*) data;
+        uint32_t crc = 0xffffffff;
+
+        // Byte by byte up to an 8 byte boundary, then a word per instruction
+        while (size > 0 && (uintptr_t) bytes % 8 != 0) {
+            crc = _mm_crc32_u8(crc, *bytes++);
+            size--;
+        }
+#if defined(__x86_64__)
+        uint64_t crc64 = crc;
+        while (size >= 8) {
+            uint64_t word;
+            memcpy(&word, bytes, sizeof(word));
+            crc64 = _mm_crc32_u64(crc64, word);
+            bytes += 8;
+            size -= 8;
+        }
+        crc = (uint32_t) crc64;
+#endif
+        while (size >= 4) {
+            uint32_t word;
+            memcpy(&word, bytes, sizeof(word));
+            crc = _mm_crc32_u32(crc, word);
+            bytes += 4;
+            size -= 4;
+        }
+        while (size > 0) {
+            crc = _mm_crc32_u8(crc, *bytes++);
+            size--;
+        }
+        return ~crc;
+    }
+#else
+    unsigned CRC32C::computeHardware(const void* data, size_t size) {
+        return computeTable(data, size);
+    }
+#endif
+
+    unsigned CRC32C::computeTable(const void* data, size_t size) {
+        const CRC32CTables &tables = getTables();
+        const unsigned char* bytes = (const unsigned char*) data;
+        uint32_t crc = 0xffffffff;
+
+        // Eight bytes per round, little-endian words
+        while (size >= 8) {
+            uint32_t low;
+            uint32_t high;
+            memcpy(&low, bytes, sizeof(low));
+            memcpy(&high, bytes + 4, sizeof(high));
+            low ^= crc;
+            crc = tables.table[7][low & 0xff] ^ tables.table[6][(low >> 8) & 0xff] ^
+                  tables.table[5][(low >> 16) & 0xff] ^ tables.table[4][low >> 24] ^
+                  tables.table[3][high & 0xff] ^ tables.table[2][(high >> 8) & 0xff] ^
+                  tables.table[1][(high >> 16) & 0xff] ^ tables.table[0][high >> 24];
+            bytes += 8;
+            size -= 8;
+        }
+        while (size > 0) {
+            crc = (crc >> 8) ^ tables.table[0][(crc ^ *bytes++) & 0xff];
+            size--;
+        }
+        return ~crc;
+    }
+} // namespace PeterDB
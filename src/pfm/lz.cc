@@ -0,0 +1,135 @@
+#include "src/include/lz.h"
+#include <cstring>
+#include <cstdint>
+
+namespace PeterDB {
+    static inline uint32_t read32(const unsigned char* p) {
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    static inline unsigned hash32(uint32_t sequence) {
+        // Knuth's multiplicative hash, the top bits are the best mixed
+        return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+    }
+
+    size_t LZ::compress(const void* src, size_t srcSize, void* dst, size_t dstCapacity) {
+        const unsigned char* in = (const unsigned char*) src;
+        unsigned char* out = (unsigned char*) dst;
+        size_t op = 0;
+        size_t anchor = 0;      // first byte not covered by a token yet
+
+        // Positions + 1 of recently seen 4 byte sequences, 0 is empty
+        uint32_t table[1 << LZ_HASH_BITS];
+        memset(table, 0, sizeof(table));
+
+        size_t matchLimit = srcSize > LZ_LAST_LITERALS ? srcSize - LZ_LAST_LITERALS : 0;
+        size_t ip = 0;
+        while (ip + LZ_MIN_MATCH <= matchLimit) {
+            uint32_t sequence = read32(in + ip);
+            unsigned h = hash32(sequence);
+            size_t ref = table[h];
+            table[h] = ip + 1;
+            if (ref == 0 || ip - (ref - 1) > LZ_MAX_OFFSET || read32(in + ref - 1) != sequence) {
+                ip++;
+                continue;
+            }
+            ref--;
+
+            size_t matchLength = LZ_MIN_MATCH;
+            while (ip + matchLength < matchLimit && in[ref + matchLength] == in[ip + matchLength]) matchLength++;
+
+            // Token, literal length, literals, offset, match length
+            size_t literalLength = ip - anchor;
+            if (op + 1 + literalLength / 255 + 1 + literalLength + 2 + matchLength / 255 + 1 > dstCapacity) return 0;
+            unsigned char* token = out + op++;
+            *token = (literalLength >= 15 ? 15 : literalLength) << 4;
+            if (literalLength >= 15) op += writeLength(out + op, literalLength - 15);
+            memcpy(out + op, in + anchor, literalLength);
+            op += literalLength;
+
+            size_t offset = ip - ref;
+            out[op++] = offset & 0xff;
+            out[op++] = offset >> 8;
+            size_t matchCode = matchLength - LZ_MIN_MATCH;
+            *token |= matchCode >= 15 ? 15 : matchCode;
+            if (matchCode >= 15) op += writeLength(out + op, matchCode - 15);
+
+            ip += matchLength;
+            anchor = ip;
+        }
+
+        // Whatever is left goes out as literals
+        size_t literalLength = srcSize - anchor;
+        if (op + 1 + literalLength / 255 + 1 + literalLength > dstCapacity) return 0;
+        unsigned char* token = out + op++;
+        *token = (literalLength >= 15 ? 15 : literalLength) << 4;
+        if (literalLength >= 15) op += writeLength(out + op, literalLength - 15);
+        memcpy(out + op, in + anchor, literalLength);
+        op += literalLength;
+        return op;
+    }
+
+    int LZ::decompress(const void* src, size_t srcSize, void* dst, size_t dstSize) {
+        const unsigned char* in = (const unsigned char*) src;
+        unsigned char* out = (unsigned char*) dst;
+        size_t ip = 0;
+        size_t op = 0;
+
+        while (ip < srcSize) {
+            unsigned token = in[ip++];
+
+            size_t literalLength = token >> 4;
+            if (literalLength == 15) {
+                unsigned char extra;
+                do {
+                    if (ip >= srcSize) return -1;
+                    extra = in[ip++];
+                    literalLength += extra;
+                } while (extra == 255);
+            }
+            if (literalLength > srcSize - ip || literalLength > dstSize - op) return -1;
+            memcpy(out + op, in + ip, literalLength);
+            ip += literalLength;
+            op += literalLength;
+
+            // The last token has no match
+            if (ip == srcSize) break;
+
+            if (srcSize - ip < 2) return -1;
+            size_t offset = in[ip] | (size_t) in[ip + 1] << 8;
+            ip += 2;
+            if (offset == 0 || offset > op) return -1;
+
+            size_t matchLength = token & 15;
+            if (matchLength == 15) {
+                unsigned char extra;
+                do {
+                    if (ip >= srcSize) return -1;
+                    extra = in[ip++];
+                    matchLength += extra;
+                } while (extra == 255);
+            }
+            matchLength += LZ_MIN_MATCH;
+            if (matchLength > dstSize - op) return -1;
+
+            // Byte by byte, a match may overlap the bytes it produces
+            const unsigned char* match = out + op - offset;
+            for (size_t i = 0; i < matchLength; i++) out[op + i] = match[i];
+            op += matchLength;
+        }
+        return op == dstSize ? 0 : -1;
+    }
+
+    size_t LZ::writeLength(unsigned char* dst, size_t length) {
+        size_t n = 0;
+        while (length >= 255) {
+            dst[n++] = 255;
+            length -= 255;
+        }
+        dst[n++] = (unsigned char) length;
+        return n;
+    }
+
+} // namespace PeterDB
@@ -1,5 +1,17 @@
 #include "src/include/pfm.h"
+#include "src/include/lz.h"
+#include "src/include/crc32c.h"
 #include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 namespace PeterDB {
     PagedFileManager &PagedFileManager::instance() {
@@ -7,69 +19,2521 @@ namespace PeterDB {
         return _pf_manager;
     }
 
-    PagedFileManager::PagedFileManager() = default;
+    PagedFileManager::PagedFileManager() {
+        directIO = false;
+        punchHoles = false;
+        walEnabled = false;
+        compressionEnabled = false;
+        checksumsEnabled = false;
+        maxIdleFiles = PFM_MAX_IDLE_FILES;
+        numTempFiles = 0;
 
-    PagedFileManager::~PagedFileManager() = default;
+        // Idle files write their pages back through the pool when we go away, so it has to be destroyed after us
+        BufferPoolManager::instance().setCheckpointHandler([this]() { checkpointOpenFiles(); });
+    }
+
+    PagedFileManager::~PagedFileManager() {
+        // The background writer takes checkpoints through us
+        BufferPoolManager::instance().stopWriter();
+
+        // Handles are gone by now, close the idle files and write their hidden pages.
+        // Files still held by a handle at least get their pages written back.
+        std::unique_lock<std::mutex> lock(tableLatch);
+        for (auto &entry : openFiles) {
+            if (entry.second->refCount == 0) closeOpenFile(entry.second, true);
+            else BufferPoolManager::instance().flushOpenFile(entry.second);
+        }
+        openFiles.clear();
+        idleFiles.clear();
+    }
+
+    RC PagedFileManager::createFile(const std::string &fileName) {
+        // Create exclusively, fails if file already exists
+        int fd = open(fileName.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+        if (fd < 0) {
+            return -1;
+        }
+
+        // An entry for this path belongs to a file that was removed behind our back, and so does a log
+        {
+            std::unique_lock<std::mutex> lock(tableLatch);
+            detachFile(fileName, false);
+        }
+        if (BufferPoolManager::instance().discardFile(fileName) != 0) {
+            close(fd);
+            unlink(fileName.c_str());
+            return -1;
+        }
+        unlink((fileName + PFM_WAL_SUFFIX).c_str());
+        unlink((fileName + PFM_WAL_SUFFIX + PFM_WAL_COPY_SUFFIX).c_str());
+        unlink((fileName + PFM_MAP_SUFFIX).c_str());
+        unlink((fileName + PFM_CRC_SUFFIX).c_str());
+
+        bool isCompressed = getCompressionEnabled();
+        bool hasChecksums = getChecksumsEnabled();
+        RC errCode = initHiddenPage(fd, (isCompressed ? PFM_FILE_COMPRESSED : 0) |
+                                        (hasChecksums ? PFM_FILE_CHECKSUMMED : 0));
+        close(fd);
+        if (errCode == 0 && isCompressed) {
+            // Pages are placed by the map, it starts out empty
+            int mapFd = open((fileName + PFM_MAP_SUFFIX).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            if (mapFd < 0) return -1;
+            close(mapFd);
+        }
+        if (errCode == 0 && hasChecksums) {
+            int crcFd = open((fileName + PFM_CRC_SUFFIX).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            if (crcFd < 0) return -1;
+            close(crcFd);
+        }
+        return errCode;
+    }
+
+    RC PagedFileManager::destroyFile(const std::string &fileName) {
+        // If file doesn't exist, fail
+        if (access(fileName.c_str(), F_OK) != 0) {
+            return -1;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(tableLatch);
+            detachFile(fileName, false);
+        }
+        if (BufferPoolManager::instance().discardFile(fileName) != 0) return -1;
+        unlink((fileName + PFM_WAL_SUFFIX).c_str());
+        unlink((fileName + PFM_WAL_SUFFIX + PFM_WAL_COPY_SUFFIX).c_str());
+        unlink((fileName + PFM_MAP_SUFFIX).c_str());
+        unlink((fileName + PFM_CRC_SUFFIX).c_str());
+        if (unlink(fileName.c_str()) != 0) {
+            return -1;
+        }
+        return 0;
+    }
+
+    RC PagedFileManager::openFile(const std::string &fileName, FileHandle &fileHandle, FileOpenMode mode) {
+        if (mode == MappedReadOnlyMode) {
+            return fileHandle.openFileMapped(fileName);
+        }
+        return fileHandle.openFile(fileName, directIO);
+    }
+
+    RC PagedFileManager::closeFile(FileHandle &fileHandle) {
+        return fileHandle.closeFile();
+    }
+
+    RC PagedFileManager::createTempFile(FileHandle &fileHandle, size_t memoryLimit) {
+        return fileHandle.openTempFile(memoryLimit);
+    }
+
+    void PagedFileManager::setDirectIO(bool directIO) {
+        this->directIO = directIO;
+    }
+
+    bool PagedFileManager::getDirectIO() {
+        return directIO;
+    }
+
+    void PagedFileManager::setMaxIdleFiles(unsigned numFiles) {
+        std::unique_lock<std::mutex> lock(tableLatch);
+        maxIdleFiles = numFiles;
+        evictIdleFiles();
+    }
+
+    unsigned PagedFileManager::getMaxIdleFiles() {
+        std::unique_lock<std::mutex> lock(tableLatch);
+        return maxIdleFiles;
+    }
+
+    void PagedFileManager::setPunchHoles(bool punchHoles) {
+        this->punchHoles = punchHoles;
+    }
+
+    bool PagedFileManager::getPunchHoles() {
+        return punchHoles;
+    }
+
+    void PagedFileManager::setWALEnabled(bool walEnabled) {
+        std::unique_lock<std::mutex> lock(tableLatch);
+        this->walEnabled = walEnabled;
+    }
+
+    bool PagedFileManager::getWALEnabled() {
+        std::unique_lock<std::mutex> lock(tableLatch);
+        return walEnabled;
+    }
+
+    void PagedFileManager::setCompressionEnabled(bool compressionEnabled) {
+        std::unique_lock<std::mutex> lock(tableLatch);
+        this->compressionEnabled = compressionEnabled;
+    }
+
+    bool PagedFileManager::getCompressionEnabled() {
+        std::unique_lock<std::mutex> lock(tableLatch);
+        return compressionEnabled;
+    }
+
+    void PagedFileManager::setChecksumsEnabled(bool checksumsEnabled) {
+        std::unique_lock<std::mutex> lock(tableLatch);
+        this->checksumsEnabled = checksumsEnabled;
+    }
+
+    bool PagedFileManager::getChecksumsEnabled() {
+        std::unique_lock<std::mutex> lock(tableLatch);
+        return checksumsEnabled;
+    }
+
+    RC PagedFileManager::initHiddenPage(int fd, unsigned flags) {
+        unsigned long long readPageCounter = 0;
+        unsigned long long writePageCounter = 0;
+        unsigned long long appendPageCounter = 1;
+        unsigned numPages = 0;
+
+        unsigned* buffer = new unsigned[PAGE_SIZE/sizeof(unsigned)]();
+        buffer[0] = (unsigned) readPageCounter;
+        buffer[1] = (unsigned) writePageCounter;
+        buffer[2] = (unsigned) appendPageCounter;
+        buffer[3] = numPages;
+        buffer[7] = PAGE_SIZE;
+        buffer[8] = flags;
+        buffer[9] = (unsigned) (readPageCounter >> 32);
+        buffer[10] = (unsigned) (writePageCounter >> 32);
+        buffer[11] = (unsigned) (appendPageCounter >> 32);
+        ssize_t bytesWritten = pwrite(fd, buffer, PAGE_SIZE, 0);
+        delete[] buffer;
+        return bytesWritten == PAGE_SIZE ? 0 : -1;
+    }
+
+    RC PagedFileManager::acquireFile(const std::string &fileName, bool directIO, OpenFile* &file) {
+        std::unique_lock<std::mutex> lock(tableLatch);
+
+        auto fileIt = openFiles.find(fileName);
+        if (fileIt != openFiles.end()) {
+            // Share the open file, unless the path now names a different file
+            struct stat pathStat;
+            OpenFile* openFile = fileIt->second;
+            if (stat(fileName.c_str(), &pathStat) == 0 &&
+                pathStat.st_dev == openFile->device && pathStat.st_ino == openFile->inode) {
+                if (openFile->refCount == 0) idleFiles.erase(openFile->idlePos);
+                openFile->refCount++;
+                file = openFile;
+                return 0;
+            }
+            detachFile(fileName, false);
+        }
+
+        // A log left behind means we crashed with pages that never reached the file
+        if (recoverFile(fileName) != 0) {
+            return -1;
+        }
+
+        // An already open file keeps the mode it was opened with
+        int flags = O_RDWR;
+        bool isDirectIO = directIO;
+#ifdef O_DIRECT
+        if (isDirectIO) flags |= O_DIRECT;
+#else
+        isDirectIO = false;
+#endif
+        int fd = open(fileName.c_str(), flags);
+        // Some file systems (e.g. tmpfs) reject O_DIRECT, use buffered I/O there
+        if (fd < 0 && isDirectIO && errno == EINVAL) {
+            fd = open(fileName.c_str(), O_RDWR);
+            isDirectIO = false;
+        }
+        if (fd < 0) {
+            return -2; //file not exists
+        }
+
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) != 0) {
+            close(fd);
+            return -1;
+        }
+
+        OpenFile* openFile = new OpenFile();
+        openFile->fileName = fileName;
+        openFile->fd = fd;
+        openFile->isDirectIO = isDirectIO;
+        openFile->device = fileStat.st_dev;
+        openFile->inode = fileStat.st_ino;
+        openFile->refCount = 1;
+        openFile->isInTable = true;
+        openFile->numPages = 0;
+        openFile->allocatedPages = 0;
+        openFile->headerDirty = false;
+        openFile->headerUpdates = 0;
+        openFile->headerSyncInterval = 0;
+        openFile->wal = nullptr;
+        openFile->checkpointLSN = 0;
+        openFile->isCompressed = false;
+        openFile->hasChecksums = false;
+        openFile->pageMap = nullptr;
+        openFile->checksums = nullptr;
+        openFile->verifyChecksums = true;
+        openFile->memoryPages = nullptr;
+        // A file built with another page size would be misread page by page
+        if (readFileHeader(openFile) != 0) {
+            close(fd);
+            delete openFile;
+            return -1;
+        }
+
+        if (openFile->isCompressed) {
+            // Compressed pages are written in whole sectors, not aligned pages
+            disableDirectIO(openFile);
+            if (openPageMap(openFile) != 0) {
+                close(fd);
+                delete openFile;
+                return -1;
+            }
+        }
+        else if (fileStat.st_size >= PAGE_SIZE) {
+            // The header is written lazily, so the file size is the authority on the number of pages
+            openFile->numPages = fileStat.st_size / PAGE_SIZE - 1;
+            openFile->allocatedPages = fileStat.st_size / PAGE_SIZE;
+        }
+
+        if (openFile->hasChecksums && openChecksums(openFile) != 0) {
+            delete openFile->pageMap;
+            close(fd);
+            delete openFile;
+            return -1;
+        }
+
+        if (walEnabled) {
+            openFile->wal = new WriteAheadLog();
+            if (openFile->wal->open(fileName + PFM_WAL_SUFFIX, openFile->checkpointLSN) != 0) {
+                delete openFile->wal;
+                delete openFile->pageMap;
+                delete openFile->checksums;
+                close(fd);
+                delete openFile;
+                return -1;
+            }
+        }
+
+        openFiles[fileName] = openFile;
+        file = openFile;
+        return 0;
+    }
+
+    void PagedFileManager::retainFile(OpenFile* file) {
+        std::unique_lock<std::mutex> lock(tableLatch);
+        if (file->refCount == 0) idleFiles.erase(file->idlePos);
+        file->refCount++;
+    }
+
+    void PagedFileManager::releaseFile(OpenFile* file) {
+        std::unique_lock<std::mutex> lock(tableLatch);
+        if (--file->refCount > 0) return;
+
+        if (!file->isInTable) {
+            // Nobody can open a temporary file again, its pages are thrown away, also the clean ones in the pool.
+            // Pages somebody still has pinned stay cached, but lose their file below.
+            if (file->memoryPages != nullptr) BufferPoolManager::instance().discardFile(file->fileName);
+            closeOpenFile(file, file->memoryPages == nullptr);
+            return;
+        }
+
+        // The descriptor stays open, but the file on disk is complete once the last handle is gone.
+        // Logged pages are safe in the log already, they are left to the background writer.
+        if (file->wal == nullptr) BufferPoolManager::instance().flushOpenFile(file);
+        {
+            std::lock_guard<std::mutex> guard(file->writeLatch);
+            if (file->headerDirty) writeFileHeader(file);
+        }
+
+        // Keep the descriptor around, the file is likely to be opened again soon
+        idleFiles.push_front(file->fileName);
+        file->idlePos = idleFiles.begin();
+        evictIdleFiles();
+    }
+
+    void PagedFileManager::detachFile(const std::string &fileName, bool writeBack) {
+        auto fileIt = openFiles.find(fileName);
+        if (fileIt == openFiles.end()) return;
+
+        OpenFile* file = fileIt->second;
+        openFiles.erase(fileIt);
+        file->isInTable = false;
+        if (file->refCount == 0) {
+            idleFiles.erase(file->idlePos);
+            closeOpenFile(file, writeBack);
+        }
+        // otherwise the last handle to close it frees the entry
+    }
+
+    void PagedFileManager::evictIdleFiles() {
+        while (idleFiles.size() > maxIdleFiles) {
+            auto fileIt = openFiles.find(idleFiles.back());
+            idleFiles.pop_back();
+            if (fileIt == openFiles.end()) continue;
+
+            OpenFile* file = fileIt->second;
+            openFiles.erase(fileIt);
+            closeOpenFile(file, true);
+        }
+    }
+
+    void PagedFileManager::closeOpenFile(OpenFile* file, bool writeBack) {
+        if (writeBack && file->wal != nullptr) checkpointFile(file);
+
+        // Cached pages must not refer to the entry once it is gone
+        BufferPoolManager::instance().detachOpenFile(file, writeBack);
+        if (writeBack && file->headerDirty) writeFileHeader(file);
+
+        if (file->wal != nullptr) {
+            file->wal->close();
+            // Everything logged is in the file after a checkpoint, a log that is still there is needed by recovery
+            if (writeBack && file->wal->getLogSize() == 0) unlink((file->fileName + PFM_WAL_SUFFIX).c_str());
+            delete file->wal;
+        }
+        if (file->pageMap != nullptr) {
+            file->pageMap->close();
+            delete file->pageMap;
+        }
+        if (file->checksums != nullptr) {
+            if (writeBack) file->checksums->sync();
+            delete file->checksums;
+        }
+        delete file->memoryPages;
+        close(file->fd);
+        delete file;
+    }
+
+    RC PagedFileManager::checkpointFile(OpenFile* file) {
+        WriteAheadLog* wal = file->wal;
+        if (wal == nullptr) return 0;
+
+        // Pages logged up to here are written back below, later records stay in the log
+        LSN checkpointLSN = wal->getLastLSN();
+        if (wal->flush(checkpointLSN) != 0) return -1;
+        if (BufferPoolManager::instance().flushOpenFile(file) != 0) return -1;
+        if (syncData(file) != 0) return -1;
+
+        // Recovery skips the records the hidden page says are in the file
+        file->checkpointLSN = checkpointLSN;
+        if (writeFileHeader(file) != 0) return -1;
+        if (fdatasync(file->fd) != 0) return -1;
+        return wal->truncate(checkpointLSN);
+    }
+
+    RC PagedFileManager::recoverFile(const std::string &fileName) {
+        std::string logName = fileName + PFM_WAL_SUFFIX;
+        struct stat logStat;
+        if (stat(logName.c_str(), &logStat) != 0) return 0;    // shut down cleanly
+        if (logStat.st_size == 0) return unlink(logName.c_str()) == 0 ? 0 : -1;
+
+        // Buffered I/O on a private entry, the file isn't in the table yet
+        int fd = open(fileName.c_str(), O_RDWR);
+        if (fd < 0) return -2;
+        OpenFile* file = new OpenFile();
+        file->fileName = fileName;
+        file->fd = fd;
+        file->isDirectIO = false;
+        file->wal = nullptr;
+        file->checkpointLSN = 0;
+        file->isCompressed = false;
+        file->hasChecksums = false;
+        file->pageMap = nullptr;
+        file->checksums = nullptr;
+        file->memoryPages = nullptr;
+        RC errCode = readFileHeader(file);
+        if (errCode == 0 && file->isCompressed) errCode = openPageMap(file);
+        // Replayed pages get their checksums back too
+        if (errCode == 0 && file->hasChecksums) errCode = openChecksums(file);
+
+        std::vector<PageNum> replayedPages;
+        LSN lastLSN = file->checkpointLSN;
+        if (errCode == 0) errCode = WriteAheadLog::replay(logName, file, file->checkpointLSN, replayedPages, lastLSN);
+
+        if (errCode == 0) {
+            // A logged page may have been taken off the free list after the hidden page was written.
+            // Keep it in use, at worst a page that was freed after it was logged is lost.
+            for (PageNum pageNum : replayedPages) {
+                if (pageNum >= file->freePageMap.size() || !file->freePageMap[pageNum]) continue;
+                file->freePageMap[pageNum] = false;
+                file->freePages.erase(std::find(file->freePages.begin(), file->freePages.end(), pageNum));
+            }
+
+            // Replayed pages may lie past the old end of the file
+            struct stat fileStat;
+            if (file->isCompressed) {
+                file->numPages = file->pageMap->getNumPages();
+            }
+            else if (fstat(fd, &fileStat) == 0 && fileStat.st_size >= PAGE_SIZE) {
+                file->numPages = fileStat.st_size / PAGE_SIZE - 1;
+            }
+            file->checkpointLSN = lastLSN;
+            if (syncData(file) != 0 || writeFileHeader(file) != 0 || fdatasync(fd) != 0) errCode = -1;
+        }
+        if (file->pageMap != nullptr) {
+            file->pageMap->close();
+            delete file->pageMap;
+        }
+        delete file->checksums;
+        close(fd);
+        delete file;
+
+        if (errCode != 0) return -1;
+        return unlink(logName.c_str()) == 0 ? 0 : -1;
+    }
+
+    RC PagedFileManager::readFileHeader(OpenFile* file) {
+        // Aligned, the descriptor may be opened with O_DIRECT
+        unsigned* buffer;
+        if (posix_memalign((void**) &buffer, PFM_IO_ALIGNMENT, PAGE_SIZE) != 0) return -1;
+        memset(buffer, 0, PAGE_SIZE);
+        RC errCode = pread(file->fd, buffer, PAGE_SIZE, 0) == PAGE_SIZE ? 0 : -1;
+        if (errCode == 0) errCode = loadFileHeader(file, buffer);
+        free(buffer);
+        return errCode;
+    }
+
+    RC PagedFileManager::loadFileHeader(OpenFile* file, const unsigned* header) {
+        // Files written before the page size was recorded use 4 KB pages
+        unsigned pageSize = header[7] != 0 ? header[7] : 4096;
+        if (pageSize != PAGE_SIZE) return -1;
+
+        // The counters are 64 bits, the high halves come after the other fields
+        file->readPageCounter = (unsigned long long) header[9] << 32 | header[0];
+        file->writePageCounter = (unsigned long long) header[10] << 32 | header[1];
+        file->appendPageCounter = (unsigned long long) header[11] << 32 | header[2];
+        file->numPages = header[3];
+        file->checkpointLSN = (LSN) header[6] << 32 | header[5];
+        file->isCompressed = (header[8] & PFM_FILE_COMPRESSED) != 0;
+        file->hasChecksums = (header[8] & PFM_FILE_CHECKSUMMED) != 0;
+
+        // Free list follows the counters
+        unsigned numFreePages = header[4];
+        if (numFreePages > PFM_MAX_FREE_PAGES) numFreePages = 0;
+        file->freePages.assign(header + PFM_HEADER_FIELDS, header + PFM_HEADER_FIELDS + numFreePages);
+        file->freePageMap.clear();
+        for (PageNum pageNum : file->freePages) {
+            if (pageNum >= file->freePageMap.size()) file->freePageMap.resize(pageNum + 1, false);
+            file->freePageMap[pageNum] = true;
+        }
+        return 0;
+    }
+
+    RC PagedFileManager::writeFileHeader(OpenFile* file) {
+        // The free list must not get ahead of the logged pages
+        if (file->wal != nullptr && file->wal->flush(file->wal->getLastLSN()) != 0) return -1;
+
+        unsigned* buffer;
+        if (posix_memalign((void**) &buffer, PFM_IO_ALIGNMENT, PAGE_SIZE) != 0) return -1;
+        memset(buffer, 0, PAGE_SIZE);
+        buffer[0] = (unsigned) file->readPageCounter;
+        buffer[1] = (unsigned) file->writePageCounter;
+        buffer[2] = (unsigned) file->appendPageCounter;
+        buffer[3] = file->numPages;
+        buffer[4] = file->freePages.size();
+        buffer[5] = (unsigned) file->checkpointLSN;
+        buffer[6] = (unsigned) (file->checkpointLSN >> 32);
+        buffer[7] = PAGE_SIZE;
+        buffer[8] = (file->isCompressed ? PFM_FILE_COMPRESSED : 0) | (file->hasChecksums ? PFM_FILE_CHECKSUMMED : 0);
+        buffer[9] = (unsigned) (file->readPageCounter >> 32);
+        buffer[10] = (unsigned) (file->writePageCounter >> 32);
+        buffer[11] = (unsigned) (file->appendPageCounter >> 32);
+        if (!file->freePages.empty()) {
+            memcpy(buffer + PFM_HEADER_FIELDS, file->freePages.data(), file->freePages.size() * sizeof(PageNum));
+        }
+        RC errCode = pwrite(file->fd, buffer, PAGE_SIZE, 0) == PAGE_SIZE ? 0 : -1;
+        free(buffer);
+
+        if (errCode == 0) {
+            file->headerDirty = false;
+            file->headerUpdates = 0;
+        }
+        return errCode;
+    }
+
+    RC PagedFileManager::syncFile(const std::string &fileName) {
+        std::unique_lock<std::mutex> lock(tableLatch);
+        auto fileIt = openFiles.find(fileName);
+        if (fileIt == openFiles.end()) return recoverFile(fileName);
+
+        // Written pages may still be dirty in the pool, a mapping only sees what is in the file
+        OpenFile* file = fileIt->second;
+        std::lock_guard<std::mutex> guard(file->writeLatch);
+        if (file->wal != nullptr) return checkpointFile(file);
+        if (BufferPoolManager::instance().flushOpenFile(file) != 0) return -1;
+        if (file->headerDirty) return writeFileHeader(file);
+        return 0;
+    }
+
+    void PagedFileManager::checkpointOpenFiles() {
+        // Hold on to the files, so they are not closed under the checkpoint
+        std::vector<OpenFile*> files;
+        {
+            std::unique_lock<std::mutex> lock(tableLatch);
+            for (auto &entry : openFiles) {
+                OpenFile* file = entry.second;
+                if (file->refCount == 0) idleFiles.erase(file->idlePos);
+                file->refCount++;
+                files.push_back(file);
+            }
+        }
+
+        for (OpenFile* file : files) {
+            fuzzyCheckpoint(file);
+            releaseFile(file);
+        }
+    }
+
+    RC PagedFileManager::fuzzyCheckpoint(OpenFile* file) {
+        WriteAheadLog* wal = file->wal;
+        LSN checkpointLSN;
+        {
+            std::lock_guard<std::mutex> guard(file->writeLatch);
+            if (wal == nullptr) return file->headerDirty ? writeFileHeader(file) : 0;
+
+            // Writers log a page and dirty its frame under the write latch, so no page is in between here.
+            // Everything logged before the oldest dirty page was changed has been written back.
+            LSN minRecLSN = BufferPoolManager::instance().getMinRecLSN(file);
+            checkpointLSN = minRecLSN == 0 ? wal->getLastLSN() : minRecLSN - 1;
+            if (checkpointLSN <= file->checkpointLSN) return 0;
+        }
+
+        // Writers keep going, only the hidden page is written under the latch
+        if (syncData(file) != 0) return -1;
+        {
+            std::lock_guard<std::mutex> guard(file->writeLatch);
+            if (checkpointLSN > file->checkpointLSN) file->checkpointLSN = checkpointLSN;
+            if (writeFileHeader(file) != 0) return -1;
+        }
+        if (fdatasync(file->fd) != 0) return -1;
+
+        // Records of pages that are still dirty stay in the log, the older ones go
+        return wal->truncate(checkpointLSN);
+    }
+
+    void PagedFileManager::collectIOStatistics(IOStatistics &stats) {
+        ioStats.collect(stats);
+    }
+
+    void PagedFileManager::resetIOStatistics() {
+        ioStats.reset();
+    }
+
+    RC PagedFileManager::readBlocks(OpenFile* file, off_t offset, unsigned count, void* data) {
+        auto start = std::chrono::steady_clock::now();
+        size_t numBytes;
+        RC errCode = readStoredBlocks(file, offset, count, data, numBytes);
+        if (errCode != 0) return errCode;
+
+        // Pages of a temporary file that are still in memory are no disk I/O
+        if (file->memoryPages != nullptr && numBytes == 0) return 0;
+
+        unsigned long long nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        PageNum firstPageNum = offset / PAGE_SIZE - 1;
+        file->ioStats.record(IOStatsCollector::ReadIO, firstPageNum, count, numBytes, nanoseconds);
+        instance().ioStats.record(IOStatsCollector::ReadIO, firstPageNum, count, numBytes, nanoseconds);
+        return 0;
+    }
+
+    RC PagedFileManager::writeBlocks(OpenFile* file, off_t offset, unsigned count, const void* data) {
+        // Pages past the end grow the file, appendPage() only publishes the page once it is written
+        PageNum firstPageNum = offset / PAGE_SIZE - 1;
+        IOStatsCollector::IOKind kind = firstPageNum >= file->numPages ? IOStatsCollector::AppendIO
+                                                                       : IOStatsCollector::WriteIO;
+        auto start = std::chrono::steady_clock::now();
+        size_t numBytes;
+        RC errCode = writeStoredBlocks(file, offset, count, data, numBytes);
+        if (errCode != 0) return errCode;
+        if (file->memoryPages != nullptr && numBytes == 0) return 0;
+
+        unsigned long long nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        file->ioStats.record(kind, firstPageNum, count, numBytes, nanoseconds);
+        instance().ioStats.record(kind, firstPageNum, count, numBytes, nanoseconds);
+        return 0;
+    }
+
+    RC PagedFileManager::readStoredBlocks(OpenFile* file, off_t offset, unsigned count, void* data,
+                                          size_t &numBytes) {
+        numBytes = 0;
+        if (file->memoryPages != nullptr) {
+            return file->memoryPages->readPages(file->fd, offset / PAGE_SIZE - 1, count, data, numBytes);
+        }
+        if (file->pageMap != nullptr) {
+            return file->pageMap->readPages(file->fd, offset / PAGE_SIZE - 1, count, data, numBytes);
+        }
+
+        size_t totalBytes = (size_t) count*PAGE_SIZE;
+
+        // O_DIRECT needs an aligned buffer, bounce through one if the caller's isn't
+        char* alignedBuffer = nullptr;
+        char* buffer = (char*) data;
+        if (file->isDirectIO && (uintptr_t) data % PFM_IO_ALIGNMENT != 0) {
+            if (posix_memalign((void**) &alignedBuffer, PFM_IO_ALIGNMENT, totalBytes) != 0) return -1;
+            buffer = alignedBuffer;
+        }
+
+        struct iovec iov[PFM_MAX_IOVECS];
+        size_t bytesDone = 0;
+        while (bytesDone < totalBytes) {
+            int iovCount = fillIovecs(iov, buffer + bytesDone, totalBytes - bytesDone);
+            ssize_t n = preadv(file->fd, iov, iovCount, offset + bytesDone);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && errno == EINVAL && file->isDirectIO) {
+                disableDirectIO(file);
+                continue;
+            }
+            if (n <= 0) {
+                free(alignedBuffer);
+                return -1;
+            }
+            bytesDone += n;
+        }
+
+        if (alignedBuffer != nullptr) {
+            memcpy(data, alignedBuffer, totalBytes);
+            free(alignedBuffer);
+        }
+        numBytes = totalBytes;
+        return 0;
+    }
+
+    RC PagedFileManager::writeStoredBlocks(OpenFile* file, off_t offset, unsigned count, const void* data,
+                                           size_t &numBytes) {
+        numBytes = 0;
+        if (file->checksums == nullptr) return writeDataBlocks(file, offset, count, data, numBytes);
+
+        // The checksums are written after the pages, a page that fails to be written keeps its old checksum
+        std::vector<unsigned> pageChecksums;
+        file->checksums->stage(offset / PAGE_SIZE - 1, count, data, pageChecksums);
+        RC errCode = writeDataBlocks(file, offset, count, data, numBytes);
+        if (file->checksums->commit(offset / PAGE_SIZE - 1, pageChecksums, errCode == 0) != 0) return -1;
+        return errCode;
+    }
+
+    RC PagedFileManager::writeDataBlocks(OpenFile* file, off_t offset, unsigned count, const void* data,
+                                         size_t &numBytes) {
+        if (file->memoryPages != nullptr) {
+            return file->memoryPages->writePages(file->fd, offset / PAGE_SIZE - 1, count, data, numBytes);
+        }
+        if (file->pageMap != nullptr) {
+            return file->pageMap->writePages(file->fd, offset / PAGE_SIZE - 1, count, data, numBytes);
+        }
+
+        size_t totalBytes = (size_t) count*PAGE_SIZE;
+
+        char* alignedBuffer = nullptr;
+        char* buffer = (char*) data;
+        if (file->isDirectIO && (uintptr_t) data % PFM_IO_ALIGNMENT != 0) {
+            if (posix_memalign((void**) &alignedBuffer, PFM_IO_ALIGNMENT, totalBytes) != 0) return -1;
+            memcpy(alignedBuffer, data, totalBytes);
+            buffer = alignedBuffer;
+        }
+
+        struct iovec iov[PFM_MAX_IOVECS];
+        size_t bytesDone = 0;
+        while (bytesDone < totalBytes) {
+            int iovCount = fillIovecs(iov, buffer + bytesDone, totalBytes - bytesDone);
+            ssize_t n = pwritev(file->fd, iov, iovCount, offset + bytesDone);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && errno == EINVAL && file->isDirectIO) {
+                disableDirectIO(file);
+                continue;
+            }
+            if (n <= 0) {
+                free(alignedBuffer);
+                return -1;
+            }
+            bytesDone += n;
+        }
+
+        free(alignedBuffer);
+        numBytes = totalBytes;
+        return 0;
+    }
+
+    int PagedFileManager::fillIovecs(struct iovec* iov, char* buffer, size_t numBytes) {
+        // One vector per page, the first one may be partial after a short transfer
+        int iovCount = 0;
+        size_t firstBytes = numBytes % PAGE_SIZE == 0 ? PAGE_SIZE : numBytes % PAGE_SIZE;
+        while (numBytes > 0 && iovCount < PFM_MAX_IOVECS) {
+            size_t len = iovCount == 0 ? firstBytes : PAGE_SIZE;
+            iov[iovCount].iov_base = buffer;
+            iov[iovCount].iov_len = len;
+            buffer += len;
+            numBytes -= len;
+            iovCount++;
+        }
+        return iovCount;
+    }
+
+    void PagedFileManager::disableDirectIO(OpenFile* file) {
+#ifdef O_DIRECT
+        int flags = fcntl(file->fd, F_GETFL);
+        if (flags >= 0) fcntl(file->fd, F_SETFL, flags & ~O_DIRECT);
+#endif
+        file->isDirectIO = false;
+    }
+
+    RC PagedFileManager::syncData(OpenFile* file) {
+        if (fdatasync(file->fd) != 0) return -1;
+        if (file->checksums != nullptr && file->checksums->sync() != 0) return -1;
+        // The map goes last, it must not point at pages that are not on disk yet
+        if (file->pageMap != nullptr) return file->pageMap->sync();
+        return 0;
+    }
+
+    RC PagedFileManager::openPageMap(OpenFile* file) {
+        file->pageMap = new CompressedPageMap();
+        if (file->pageMap->open(file->fileName + PFM_MAP_SUFFIX) != 0) {
+            delete file->pageMap;
+            file->pageMap = nullptr;
+            return -1;
+        }
+        // The map knows every page that was written
+        file->numPages = file->pageMap->getNumPages();
+        return 0;
+    }
+
+    RC PagedFileManager::openChecksums(OpenFile* file) {
+        file->checksums = new PageChecksums();
+        if (file->checksums->open(file->fileName + PFM_CRC_SUFFIX) != 0) {
+            delete file->checksums;
+            file->checksums = nullptr;
+            return -1;
+        }
+        return 0;
+    }
+
+    WriteAheadLog::WriteAheadLog() {
+        fd = -1;
+        buffer = nullptr;
+        flushBuffer = nullptr;
+        bufferBytes = 0;
+        lastLSN = 0;
+        durableLSN = 0;
+        firstLSN = 1;
+        logSize = 0;
+        isFlushing = false;
+    }
+
+    WriteAheadLog::~WriteAheadLog() {
+        close();
+    }
+
+    RC WriteAheadLog::open(const std::string &logName, LSN lastLSN) {
+        if (fd >= 0) return -1;
+
+        // Recovery has already applied whatever an old log held
+        fd = ::open(logName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0) return -1;
+
+        buffer = (char*) malloc(PFM_WAL_BUFFER_RECORDS * getRecordSize());
+        flushBuffer = (char*) malloc(PFM_WAL_BUFFER_RECORDS * getRecordSize());
+        if (buffer == nullptr || flushBuffer == nullptr) {
+            close();
+            return -1;
+        }
+        bufferBytes = 0;
+        this->logName = logName;
+        this->lastLSN = lastLSN;
+        durableLSN = lastLSN;
+        firstLSN = lastLSN + 1;
+        logSize = 0;
+        return 0;
+    }
+
+    RC WriteAheadLog::close() {
+        RC errCode = 0;
+        if (fd >= 0) {
+            errCode = flush(getLastLSN());
+            ::close(fd);
+            fd = -1;
+        }
+        free(buffer);
+        free(flushBuffer);
+        buffer = nullptr;
+        flushBuffer = nullptr;
+        bufferBytes = 0;
+        return errCode;
+    }
+
+    LSN WriteAheadLog::append(PageNum pageNum, const void* data) {
+        std::unique_lock<std::mutex> lock(latch);
+        if (fd < 0) return 0;
+
+        // Buffer full, write it out before logging more
+        size_t recordSize = getRecordSize();
+        while (bufferBytes + recordSize > PFM_WAL_BUFFER_RECORDS * recordSize) {
+            LSN lsn = lastLSN;
+            lock.unlock();
+            RC errCode = flush(lsn);
+            lock.lock();
+            if (errCode != 0) return 0;
+        }
+
+        LogRecordHeader header;
+        header.lsn = lastLSN + 1;
+        header.pageNum = pageNum;
+        header.checksum = 0;
+        header.checksum = computeChecksum(header, data);
+        memcpy(buffer + bufferBytes, &header, sizeof(LogRecordHeader));
+        memcpy(buffer + bufferBytes + sizeof(LogRecordHeader), data, PAGE_SIZE);
+        bufferBytes += recordSize;
+        lastLSN = header.lsn;
+        return lastLSN;
+    }
+
+    RC WriteAheadLog::flush(LSN lsn) {
+        std::unique_lock<std::mutex> lock(latch);
+        if (lsn > lastLSN) lsn = lastLSN;
+
+        while (durableLSN < lsn) {
+            if (isFlushing) {
+                // Our records may go out with the write in progress, or with the next one
+                flushDone.wait(lock);
+                continue;
+            }
+
+            // Lead the group, everything appended so far goes out with one write and one fdatasync
+            isFlushing = true;
+            std::swap(buffer, flushBuffer);
+            size_t numBytes = bufferBytes;
+            bufferBytes = 0;
+            LSN flushLSN = lastLSN;
+            off_t offset = logSize;
+            lock.unlock();
+
+            RC errCode = 0;
+            size_t bytesDone = 0;
+            while (bytesDone < numBytes) {
+                ssize_t n = pwrite(fd, flushBuffer + bytesDone, numBytes - bytesDone, offset + bytesDone);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) {
+                    errCode = -1;
+                    break;
+                }
+                bytesDone += n;
+            }
+            if (errCode == 0 && fdatasync(fd) != 0) errCode = -1;
+
+            lock.lock();
+            isFlushing = false;
+            if (errCode == 0) {
+                logSize += numBytes;
+                durableLSN = flushLSN;
+            }
+            flushDone.notify_all();
+            // The records are lost, recovery stops at the gap they leave
+            if (errCode != 0) return -1;
+        }
+        return 0;
+    }
+
+    LSN WriteAheadLog::getLastLSN() {
+        std::unique_lock<std::mutex> lock(latch);
+        return lastLSN;
+    }
+
+    LSN WriteAheadLog::getDurableLSN() {
+        std::unique_lock<std::mutex> lock(latch);
+        return durableLSN;
+    }
+
+    off_t WriteAheadLog::getLogSize() {
+        std::unique_lock<std::mutex> lock(latch);
+        return logSize;
+    }
+
+    RC WriteAheadLog::truncate(LSN checkpointLSN) {
+        std::unique_lock<std::mutex> lock(latch);
+        while (isFlushing) flushDone.wait(lock);
+
+        // Records logged after the checkpoint began are not in the file yet, they have to stay
+        if (fd < 0 || checkpointLSN < firstLSN) return 0;
+        if (checkpointLSN > durableLSN) checkpointLSN = durableLSN;
+        off_t dropBytes = (off_t) (checkpointLSN + 1 - firstLSN) * getRecordSize();
+        off_t keepBytes = logSize - dropBytes;
+        if (keepBytes == 0) {
+            if (ftruncate(fd, 0) != 0) return -1;
+            firstLSN = checkpointLSN + 1;
+            logSize = 0;
+            return 0;
+        }
+        // Copying the rest is paid for by the records it drops, a short prefix waits for the next checkpoint
+        if (dropBytes < keepBytes) return 0;
+
+        // The rest goes to a new log that replaces the old one, a crash leaves one of them whole.
+        // Flushes wait for us, appends keep filling the buffer.
+        isFlushing = true;
+        lock.unlock();
+        std::string copyName = logName + PFM_WAL_COPY_SUFFIX;
+        int copyFd = ::open(copyName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+        RC errCode = copyFd < 0 ? -1 : copyRecords(copyFd, dropBytes, keepBytes);
+        if (errCode == 0 && rename(copyName.c_str(), logName.c_str()) != 0) errCode = -1;
+        if (errCode != 0) {
+            if (copyFd >= 0) ::close(copyFd);
+            unlink(copyName.c_str());
+        }
+
+        lock.lock();
+        isFlushing = false;
+        if (errCode == 0) {
+            ::close(fd);
+            fd = copyFd;
+            firstLSN = checkpointLSN + 1;
+            logSize = keepBytes;
+        }
+        flushDone.notify_all();
+        return errCode;
+    }
+
+    RC WriteAheadLog::copyRecords(int copyFd, off_t offset, size_t numBytes) {
+        size_t chunkBytes = PFM_WAL_BUFFER_RECORDS * getRecordSize();
+        std::vector<char> chunk(chunkBytes);
+        size_t bytesDone = 0;
+        while (bytesDone < numBytes) {
+            size_t len = std::min(chunkBytes, numBytes - bytesDone);
+            ssize_t n = pread(fd, chunk.data(), len, offset + bytesDone);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return -1;
+            for (ssize_t written = 0; written < n;) {
+                ssize_t m = pwrite(copyFd, chunk.data() + written, n - written, bytesDone + written);
+                if (m < 0 && errno == EINTR) continue;
+                if (m <= 0) return -1;
+                written += m;
+            }
+            bytesDone += n;
+        }
+        return fdatasync(copyFd) == 0 ? 0 : -1;
+    }
+
+    RC WriteAheadLog::replay(const std::string &logName, OpenFile *file, LSN checkpointLSN,
+                             std::vector<PageNum> &replayedPages, LSN &lastLSN) {
+        int logFd = ::open(logName.c_str(), O_RDONLY);
+        if (logFd < 0) return -1;
+
+        size_t recordSize = getRecordSize();
+        char* record = (char*) malloc(recordSize);
+        if (record == nullptr) {
+            ::close(logFd);
+            return -1;
+        }
+
+        // A record that is cut short, fails its checksum or leaves a gap was being written when we crashed,
+        // nothing after it counts
+        RC errCode = 0;
+        LSN prevLSN = 0;
+        off_t offset = 0;
+        LogRecordHeader header;
+        while (pread(logFd, record, recordSize, offset) == (ssize_t) recordSize) {
+            memcpy(&header, record, sizeof(LogRecordHeader));
+            unsigned checksum = header.checksum;
+            header.checksum = 0;
+            if (computeChecksum(header, record + sizeof(LogRecordHeader)) != checksum) break;
+            if (prevLSN != 0 && header.lsn != prevLSN + 1) break;
+            prevLSN = header.lsn;
+            offset += recordSize;
+
+            if (header.lsn <= checkpointLSN) continue;     // the checkpoint put it in the file already
+            if (PagedFileManager::writeBlocks(file, (off_t) (1+header.pageNum)*PAGE_SIZE, 1,
+                                              record + sizeof(LogRecordHeader)) != 0) {
+                errCode = -1;
+                break;
+            }
+            replayedPages.push_back(header.pageNum);
+            if (header.lsn > lastLSN) lastLSN = header.lsn;
+        }
+
+        free(record);
+        ::close(logFd);
+        return errCode;
+    }
+
+    unsigned WriteAheadLog::computeChecksum(const LogRecordHeader &header, const void* data) {
+        // FNV-1a over the record header and the page image
+        unsigned hash = 2166136261u;
+        const unsigned char* bytes = (const unsigned char*) &header;
+        for (size_t i = 0; i < sizeof(LogRecordHeader); i++) {
+            hash ^= bytes[i];
+            hash *= 16777619u;
+        }
+        bytes = (const unsigned char*) data;
+        for (size_t i = 0; i < PAGE_SIZE; i++) {
+            hash ^= bytes[i];
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    size_t WriteAheadLog::getRecordSize() {
+        return sizeof(LogRecordHeader) + PAGE_SIZE;
+    }
+
+    CompressedPageMap::CompressedPageMap() {
+        fd = -1;
+        numMovedSectors = 0;
+        endSector = 0;
+    }
+
+    CompressedPageMap::~CompressedPageMap() {
+        close();
+    }
+
+    RC CompressedPageMap::open(const std::string &mapName) {
+        fd = ::open(mapName.c_str(), O_RDWR);
+        if (fd < 0) return -1;
+
+        struct stat mapStat;
+        if (fstat(fd, &mapStat) != 0) {
+            close();
+            return -1;
+        }
+        size_t numEntries = mapStat.st_size / sizeof(MapEntry);
+        entries.resize(numEntries);
+        size_t mapBytes = numEntries * sizeof(MapEntry);
+        if (numEntries > 0 && pread(fd, entries.data(), mapBytes, 0) != (ssize_t) mapBytes) {
+            close();
+            return -1;
+        }
+
+        // Sectors no page points at are free
+        std::vector<std::pair<unsigned, unsigned>> usedRuns;
+        for (const MapEntry &entry : entries) {
+            if (entry.length != 0) usedRuns.push_back(std::make_pair(entry.sector, getNumSectors(entry.length)));
+        }
+        std::sort(usedRuns.begin(), usedRuns.end());
+        freeRuns.clear();
+        movedRuns.clear();
+        numMovedSectors = 0;
+        endSector = 0;
+        for (const auto &run : usedRuns) {
+            if (run.first > endSector) freeRuns[endSector] = run.first - endSector;
+            if (run.first + run.second > endSector) endSector = run.first + run.second;
+        }
+        return 0;
+    }
+
+    RC CompressedPageMap::close() {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+        return 0;
+    }
+
+    unsigned CompressedPageMap::getNumPages() {
+        std::lock_guard<std::mutex> guard(latch);
+        return entries.size();
+    }
+
+    RC CompressedPageMap::readPages(int dataFd, PageNum firstPageNum, unsigned count, void* data, size_t &numBytes) {
+        numBytes = 0;
+        char* buffer = (char*) malloc((size_t) count*PAGE_SIZE);
+        if (buffer == nullptr) return -1;
+
+        // Pages that lie next to each other on disk are read with one call
+        std::vector<MapEntry> pageEntries(count);
+        {
+            std::lock_guard<std::mutex> guard(latch);
+            if (firstPageNum > entries.size() || count > entries.size() - firstPageNum) {
+                free(buffer);
+                return -1;
+            }
+            std::copy(entries.begin() + firstPageNum, entries.begin() + firstPageNum + count, pageEntries.begin());
+
+            size_t bufferOffset = 0;
+            unsigned i = 0;
+            while (i < count) {
+                if (pageEntries[i].length == 0) {
+                    i++;
+                    continue;
+                }
+                unsigned firstSector = pageEntries[i].sector;
+                unsigned numSectors = 0;
+                do {
+                    numSectors += getNumSectors(pageEntries[i].length);
+                    i++;
+                } while (i < count && pageEntries[i].length != 0 && pageEntries[i].sector == firstSector + numSectors);
+
+                size_t runBytes = (size_t) numSectors*PFM_COMPRESS_SECTOR;
+                if (pread(dataFd, buffer + bufferOffset, runBytes,
+                          PAGE_SIZE + (off_t) firstSector*PFM_COMPRESS_SECTOR) != (ssize_t) runBytes) {
+                    free(buffer);
+                    return -1;
+                }
+                bufferOffset += runBytes;
+                numBytes += runBytes;
+            }
+        }
+
+        // The sectors are ours now, decompress without holding up writers
+        RC errCode = 0;
+        size_t bufferOffset = 0;
+        for (unsigned i = 0; i < count && errCode == 0; i++) {
+            char* page = (char*) data + (size_t) i*PAGE_SIZE;
+            unsigned length = pageEntries[i].length;
+            if (length == 0) memset(page, 0, PAGE_SIZE);
+            else if (length == PAGE_SIZE) memcpy(page, buffer + bufferOffset, PAGE_SIZE);
+            else errCode = LZ::decompress(buffer + bufferOffset, length, page, PAGE_SIZE) == 0 ? 0 : -1;
+            bufferOffset += (size_t) getNumSectors(length)*PFM_COMPRESS_SECTOR;
+        }
+        free(buffer);
+        return errCode;
+    }
+
+    RC CompressedPageMap::writePages(int dataFd, PageNum firstPageNum, unsigned count, const void* data,
+                                     size_t &numBytes) {
+        numBytes = 0;
+        char* buffer = (char*) malloc(PAGE_SIZE);
+        if (buffer == nullptr) return -1;
+
+        std::lock_guard<std::mutex> guard(latch);
+        RC errCode = 0;
+        for (unsigned i = 0; i < count && errCode == 0; i++) {
+            errCode = writePage(dataFd, firstPageNum + i, (const char*) data + (size_t) i*PAGE_SIZE, buffer,
+                                numBytes);
+        }
+
+        // Get the sectors pages moved away from back before the file grows too much
+        if (errCode == 0 && numMovedSectors >= PFM_RECLAIM_SECTORS) {
+            if (fdatasync(dataFd) != 0 || syncMap() != 0) errCode = -1;
+        }
+        free(buffer);
+        return errCode;
+    }
+
+    RC CompressedPageMap::discardPage(PageNum pageNum) {
+        std::lock_guard<std::mutex> guard(latch);
+        if (pageNum >= entries.size()) return -1;
+
+        MapEntry &entry = entries[pageNum];
+        if (entry.length == 0) return 0;
+        releaseSectors(entry.sector, getNumSectors(entry.length));
+        entry.sector = 0;
+        entry.length = 0;
+        return storeEntry(pageNum);
+    }
+
+    RC CompressedPageMap::sync() {
+        std::lock_guard<std::mutex> guard(latch);
+        return syncMap();
+    }
+
+    unsigned CompressedPageMap::getNumSectors(unsigned length) {
+        return (length + PFM_COMPRESS_SECTOR - 1) / PFM_COMPRESS_SECTOR;
+    }
+
+    unsigned CompressedPageMap::allocateSectors(unsigned numSectors) {
+        // First fit, otherwise the file grows
+        for (auto runIt = freeRuns.begin(); runIt != freeRuns.end(); ++runIt) {
+            if (runIt->second < numSectors) continue;
+            unsigned sector = runIt->first;
+            unsigned remaining = runIt->second - numSectors;
+            freeRuns.erase(runIt);
+            if (remaining > 0) freeRuns[sector + numSectors] = remaining;
+            return sector;
+        }
+        unsigned sector = endSector;
+        endSector += numSectors;
+        return sector;
+    }
+
+    void CompressedPageMap::releaseSectors(unsigned sector, unsigned numSectors) {
+        movedRuns.push_back(std::make_pair(sector, numSectors));
+        numMovedSectors += numSectors;
+    }
+
+    RC CompressedPageMap::storeEntry(PageNum pageNum) {
+        ssize_t bytesWritten = pwrite(fd, &entries[pageNum], sizeof(MapEntry), (off_t) pageNum*sizeof(MapEntry));
+        return bytesWritten == sizeof(MapEntry) ? 0 : -1;
+    }
+
+    RC CompressedPageMap::syncMap() {
+        if (fdatasync(fd) != 0) return -1;
+
+        // Nothing on disk points at the moved sectors any more, merge them with their free neighbours
+        for (const auto &run : movedRuns) {
+            unsigned sector = run.first;
+            unsigned numSectors = run.second;
+            auto nextIt = freeRuns.lower_bound(sector);
+            if (nextIt != freeRuns.end() && sector + numSectors == nextIt->first) {
+                numSectors += nextIt->second;
+                nextIt = freeRuns.erase(nextIt);
+            }
+            if (nextIt != freeRuns.begin()) {
+                auto prevIt = std::prev(nextIt);
+                if (prevIt->first + prevIt->second == sector) {
+                    prevIt->second += numSectors;
+                    continue;
+                }
+            }
+            freeRuns[sector] = numSectors;
+        }
+        movedRuns.clear();
+        numMovedSectors = 0;
+
+        // A free run at the end is just unused
+        if (!freeRuns.empty()) {
+            auto lastIt = std::prev(freeRuns.end());
+            if (lastIt->first + lastIt->second == endSector) {
+                endSector = lastIt->first;
+                freeRuns.erase(lastIt);
+            }
+        }
+        return 0;
+    }
+
+    RC CompressedPageMap::writePage(int dataFd, PageNum pageNum, const char* data, char* buffer, size_t &numBytes) {
+        // A page has to save at least a sector to be worth compressing
+        const char* storedData = buffer;
+        unsigned length = LZ::compress(data, PAGE_SIZE, buffer, PAGE_SIZE - PFM_COMPRESS_SECTOR);
+        if (length == 0) {
+            storedData = data;
+            length = PAGE_SIZE;
+        }
+        unsigned numSectors = getNumSectors(length);
+        if (storedData == buffer) memset(buffer + length, 0, (size_t) numSectors*PFM_COMPRESS_SECTOR - length);
+
+        if (pageNum >= entries.size()) {
+            MapEntry emptyEntry = {0, 0};
+            entries.resize(pageNum + 1, emptyEntry);
+        }
+        MapEntry &entry = entries[pageNum];
+        unsigned oldSectors = entry.length == 0 ? 0 : getNumSectors(entry.length);
+
+        // Rewrite in place if the page still fits, otherwise move it
+        bool isMoved = numSectors > oldSectors;
+        unsigned sector = isMoved ? allocateSectors(numSectors) : entry.sector;
+        size_t storedBytes = (size_t) numSectors*PFM_COMPRESS_SECTOR;
+        if (pwrite(dataFd, storedData, storedBytes, PAGE_SIZE + (off_t) sector*PFM_COMPRESS_SECTOR)
+            != (ssize_t) storedBytes) {
+            if (isMoved) releaseSectors(sector, numSectors);
+            return -1;
+        }
+        numBytes += storedBytes;
+
+        unsigned oldSector = entry.sector;
+        entry.sector = sector;
+        entry.length = length;
+        if (storeEntry(pageNum) != 0) return -1;
+
+        if (isMoved && oldSectors > 0) releaseSectors(oldSector, oldSectors);
+        else if (!isMoved && numSectors < oldSectors) releaseSectors(sector + numSectors, oldSectors - numSectors);
+        return 0;
+    }
+
+    IOStatsCollector::IOStatsCollector() {
+        reset();
+    }
+
+    void IOStatsCollector::record(IOKind kind, PageNum firstPageNum, unsigned count, size_t numBytes,
+                                  unsigned long long nanoseconds) {
+        numPages[kind] += count;
+        this->numBytes[kind] += numBytes;
+        PageNum expectedPageNum = nextPageNum[kind].exchange(firstPageNum + count);
+        if (firstPageNum == expectedPageNum) numSequential[kind]++;
+        else numRandom[kind]++;
+
+        unsigned long long micros = nanoseconds / 1000;
+        unsigned bucket = 0;
+        while (bucket < PFM_LATENCY_BUCKETS - 1 && micros >> bucket != 0) bucket++;
+        AtomicHistogram &histogram = latency[kind];
+        histogram.buckets[bucket]++;
+        histogram.count++;
+        histogram.totalMicros += micros;
+        unsigned long long maxMicros = histogram.maxMicros;
+        while (micros > maxMicros && !histogram.maxMicros.compare_exchange_weak(maxMicros, micros));
+    }
+
+    void IOStatsCollector::collect(IOStatistics &stats) {
+        stats.pagesRead = numPages[ReadIO];
+        stats.pagesWritten = numPages[WriteIO];
+        stats.pagesAppended = numPages[AppendIO];
+        stats.bytesRead = numBytes[ReadIO];
+        stats.bytesWritten = numBytes[WriteIO] + numBytes[AppendIO];
+        stats.sequentialReads = numSequential[ReadIO];
+        stats.randomReads = numRandom[ReadIO];
+        stats.sequentialWrites = numSequential[WriteIO] + numSequential[AppendIO];
+        stats.randomWrites = numRandom[WriteIO] + numRandom[AppendIO];
+        collectHistogram(latency[ReadIO], stats.readLatency);
+        collectHistogram(latency[WriteIO], stats.writeLatency);
+        collectHistogram(latency[AppendIO], stats.appendLatency);
+    }
+
+    void IOStatsCollector::reset() {
+        for (unsigned kind = ReadIO; kind <= AppendIO; kind++) {
+            numPages[kind] = 0;
+            numBytes[kind] = 0;
+            numSequential[kind] = 0;
+            numRandom[kind] = 0;
+            nextPageNum[kind] = 0;
+            for (auto &bucket : latency[kind].buckets) bucket = 0;
+            latency[kind].count = 0;
+            latency[kind].totalMicros = 0;
+            latency[kind].maxMicros = 0;
+        }
+    }
+
+    unsigned long long IOStatsCollector::getLatencyPercentile(const LatencyHistogram &histogram, double percentile) {
+        if (histogram.count == 0) return 0;
+        unsigned long long rank = (unsigned long long) (percentile / 100 * histogram.count);
+        if (rank >= histogram.count) rank = histogram.count - 1;
+        unsigned long long numBelow = 0;
+        for (unsigned bucket = 0; bucket < PFM_LATENCY_BUCKETS; bucket++) {
+            numBelow += histogram.buckets[bucket];
+            if (numBelow > rank) return bucket == PFM_LATENCY_BUCKETS - 1 ? histogram.maxMicros : 1ULL << bucket;
+        }
+        return histogram.maxMicros;
+    }
+
+    void IOStatsCollector::collectHistogram(AtomicHistogram &histogram, LatencyHistogram &result) {
+        for (unsigned bucket = 0; bucket < PFM_LATENCY_BUCKETS; bucket++) {
+            result.buckets[bucket] = histogram.buckets[bucket];
+        }
+        result.count = histogram.count;
+        result.totalMicros = histogram.totalMicros;
+        result.maxMicros = histogram.maxMicros;
+    }
+
+    PageChecksums::PageChecksums() {
+        fd = -1;
+    }
+
+    PageChecksums::~PageChecksums() {
+        close();
+    }
+
+    RC PageChecksums::open(const std::string &crcName) {
+        fd = ::open(crcName.c_str(), O_RDWR);
+        if (fd < 0) return -1;
+
+        struct stat crcStat;
+        if (fstat(fd, &crcStat) != 0) {
+            close();
+            return -1;
+        }
+        size_t numPages = crcStat.st_size / sizeof(unsigned);
+        checksums.resize(numPages);
+        size_t crcBytes = numPages * sizeof(unsigned);
+        if (numPages > 0 && pread(fd, checksums.data(), crcBytes, 0) != (ssize_t) crcBytes) {
+            close();
+            return -1;
+        }
+        isKnown.assign(numPages, true);
+        return 0;
+    }
+
+    RC PageChecksums::close() {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+        return 0;
+    }
+
+    RC PageChecksums::update(PageNum firstPageNum, unsigned count, const void* data) {
+        std::vector<unsigned> pageChecksums;
+        stage(firstPageNum, count, data, pageChecksums);
+        return commit(firstPageNum, pageChecksums, true);
+    }
+
+    void PageChecksums::stage(PageNum firstPageNum, unsigned count, const void* data,
+                              std::vector<unsigned> &pageChecksums) {
+        pageChecksums.resize(count);
+        for (unsigned i = 0; i < count; i++) {
+            pageChecksums[i] = CRC32C::compute((const char*) data + (size_t) i*PAGE_SIZE, PAGE_SIZE);
+        }
+
+        std::lock_guard<std::mutex> guard(latch);
+        for (unsigned i = 0; i < count; i++) stagedChecksums[firstPageNum + i] = pageChecksums[i];
+    }
+
+    RC PageChecksums::commit(PageNum firstPageNum, const std::vector<unsigned> &pageChecksums, bool isWritten) {
+        unsigned count = pageChecksums.size();
+        std::lock_guard<std::mutex> guard(latch);
+        // A later write of the same page may have staged its checksum meanwhile, that one stays
+        for (unsigned i = 0; i < count; i++) {
+            auto stagedIt = stagedChecksums.find(firstPageNum + i);
+            if (stagedIt != stagedChecksums.end() && stagedIt->second == pageChecksums[i]) {
+                stagedChecksums.erase(stagedIt);
+            }
+        }
+        if (!isWritten) return 0;
+
+        if (firstPageNum + count > checksums.size()) {
+            checksums.resize(firstPageNum + count, 0);
+            isKnown.resize(firstPageNum + count, false);
+        }
+        std::copy(pageChecksums.begin(), pageChecksums.end(), checksums.begin() + firstPageNum);
+        std::fill(isKnown.begin() + firstPageNum, isKnown.begin() + firstPageNum + count, true);
+
+        size_t numBytes = (size_t) count*sizeof(unsigned);
+        ssize_t bytesWritten = pwrite(fd, pageChecksums.data(), numBytes, (off_t) firstPageNum*sizeof(unsigned));
+        return bytesWritten == (ssize_t) numBytes ? 0 : -1;
+    }
+
+    unsigned PageChecksums::verify(PageNum firstPageNum, unsigned count, const void* data, PageNum &badPageNum) {
+        unsigned numBadPages = 0;
+        for (unsigned i = 0; i < count; i++) {
+            unsigned checksum = CRC32C::compute((const char*) data + (size_t) i*PAGE_SIZE, PAGE_SIZE);
+            std::lock_guard<std::mutex> guard(latch);
+            PageNum pageNum = firstPageNum + i;
+            if (pageNum >= checksums.size() || !isKnown[pageNum] || checksums[pageNum] == checksum) continue;
+            auto stagedIt = stagedChecksums.find(pageNum);
+            if (stagedIt != stagedChecksums.end() && stagedIt->second == checksum) continue;
+            if (numBadPages++ == 0) badPageNum = pageNum;
+        }
+        return numBadPages;
+    }
+
+    RC PageChecksums::sync() {
+        std::lock_guard<std::mutex> guard(latch);
+        if (fd < 0) return 0;
+        return fdatasync(fd) == 0 ? 0 : -1;
+    }
+
+    MemoryPageStore::MemoryPageStore(size_t memoryLimit) {
+        maxPages = memoryLimit / PAGE_SIZE;
+        spilled = false;
+    }
+
+    MemoryPageStore::~MemoryPageStore() {
+        for (char* page : pages) free(page);
+    }
+
+    RC MemoryPageStore::readPages(int spillFd, PageNum firstPageNum, unsigned count, void* data, size_t &numBytes) {
+        numBytes = 0;
+        {
+            std::lock_guard<std::mutex> guard(latch);
+            if (!spilled) {
+                if (firstPageNum > pages.size() || count > pages.size() - firstPageNum) return -1;
+                for (unsigned i = 0; i < count; i++) {
+                    memcpy((char*) data + (size_t) i*PAGE_SIZE, pages[firstPageNum + i], PAGE_SIZE);
+                }
+                return 0;
+            }
+        }
+
+        // Pages of the spill file are where they would be in a regular file
+        size_t totalBytes = (size_t) count*PAGE_SIZE;
+        size_t bytesDone = 0;
+        while (bytesDone < totalBytes) {
+            ssize_t n = pread(spillFd, (char*) data + bytesDone, totalBytes - bytesDone,
+                              (off_t) (1+firstPageNum)*PAGE_SIZE + bytesDone);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return -1;
+            bytesDone += n;
+        }
+        numBytes = totalBytes;
+        return 0;
+    }
+
+    RC MemoryPageStore::writePages(int spillFd, PageNum firstPageNum, unsigned count, const void* data,
+                                   size_t &numBytes) {
+        numBytes = 0;
+        {
+            std::lock_guard<std::mutex> guard(latch);
+            if (!spilled && firstPageNum + count > maxPages) {
+                // The pages moved out of memory are written along with these
+                numBytes = pages.size()*PAGE_SIZE;
+                if (spill(spillFd) != 0) return -1;
+            }
+            if (!spilled) {
+                if (firstPageNum > pages.size()) return -1;
+                for (unsigned i = 0; i < count; i++) {
+                    if (firstPageNum + i == pages.size()) {
+                        char* page = (char*) malloc(PAGE_SIZE);
+                        if (page == nullptr) return -1;
+                        pages.push_back(page);
+                    }
+                    memcpy(pages[firstPageNum + i], (const char*) data + (size_t) i*PAGE_SIZE, PAGE_SIZE);
+                }
+                return 0;
+            }
+        }
+
+        size_t totalBytes = (size_t) count*PAGE_SIZE;
+        size_t bytesDone = 0;
+        while (bytesDone < totalBytes) {
+            ssize_t n = pwrite(spillFd, (const char*) data + bytesDone, totalBytes - bytesDone,
+                               (off_t) (1+firstPageNum)*PAGE_SIZE + bytesDone);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return -1;
+            bytesDone += n;
+        }
+        numBytes += totalBytes;
+        return 0;
+    }
+
+    bool MemoryPageStore::isSpilled() {
+        std::lock_guard<std::mutex> guard(latch);
+        return spilled;
+    }
+
+    RC MemoryPageStore::spill(int spillFd) {
+        // One write for all pages, the spill file has no hidden page but keeps its place
+        std::vector<struct iovec> iov(pages.size());
+        for (size_t i = 0; i < pages.size(); i++) {
+            iov[i].iov_base = pages[i];
+            iov[i].iov_len = PAGE_SIZE;
+        }
+        size_t iovDone = 0;
+        while (iovDone < iov.size()) {
+            int iovCount = std::min(iov.size() - iovDone, (size_t) PFM_MAX_IOVECS);
+            size_t numBytes = (size_t) iovCount*PAGE_SIZE;
+            ssize_t n = pwritev(spillFd, iov.data() + iovDone, iovCount, (off_t) (1+iovDone)*PAGE_SIZE);
+            if (n < 0 && errno == EINTR) continue;
+            if (n != (ssize_t) numBytes) return -1;
+            iovDone += iovCount;
+        }
+
+        for (char* page : pages) free(page);
+        pages.clear();
+        pages.shrink_to_fit();
+        spilled = true;
+        return 0;
+    }
+
+    BufferPoolManager &BufferPoolManager::instance() {
+        static BufferPoolManager _bp_manager;
+        return _bp_manager;
+    }
+
+    BufferPoolManager::BufferPoolManager() {
+        frameData = nullptr;
+        clockHand = 0;
+        numWriteBacks = 0;
+        numDirtyFrames = 0;
+        numDirtyings = 0;
+        targetDirtyPercent = PFM_DEFAULT_DIRTY_PERCENT;
+        checkpointInterval = PFM_DEFAULT_CHECKPOINT_INTERVAL_MS;
+        numBusyWriters = 0;
+        setNumFrames(PFM_DEFAULT_NUM_FRAMES);
+
+        isWriterStopping = false;
+        if (posix_memalign((void**) &writerBuffer, PFM_IO_ALIGNMENT, (size_t) PFM_WRITER_BATCH_PAGES*PAGE_SIZE) != 0) {
+            writerBuffer = nullptr;
+        }
+        writer = std::thread(&BufferPoolManager::runWriter, this);
+    }
+
+    BufferPoolManager::~BufferPoolManager() {
+        stopWriter();
+        free(writerBuffer);
+        free(frameData);
+    }
+
+    RC BufferPoolManager::setNumFrames(unsigned numFrames) {
+        std::unique_lock<std::mutex> lock(poolLatch);
+        waitForWriter(lock);
+
+        // Can not resize while some page is pinned
+        for (unsigned i = 0; i < frames.size(); i++) {
+            if (frames[i].isValid && frames[i].pinCount > 0) return -1;
+        }
+        for (unsigned i = 0; i < frames.size(); i++) {
+            if (frames[i].isValid && frames[i].isDirty) {
+                if (writeBackFrame(i) != 0) return -1;
+            }
+        }
+
+        free(frameData);
+        frameData = nullptr;
+        if (numFrames > 0) {
+            // Aligned so frames can be handed to O_DIRECT reads directly
+            if (posix_memalign((void**) &frameData, PFM_IO_ALIGNMENT, (size_t) numFrames * PAGE_SIZE) != 0) {
+                frameData = nullptr;
+                frames.clear();
+                pageTable.clear();
+                return -1;
+            }
+        }
+
+        BufferFrame emptyFrame;
+        emptyFrame.pageNum = 0;
+        emptyFrame.file = nullptr;
+        emptyFrame.pinCount = 0;
+        emptyFrame.isDirty = false;
+        emptyFrame.refBit = false;
+        emptyFrame.isValid = false;
+        emptyFrame.isLoading = false;
+        emptyFrame.pageLSN = 0;
+        emptyFrame.recLSN = 0;
+        emptyFrame.dirtySeq = 0;
+        emptyFrame.isWriting = false;
+        frames.assign(numFrames, emptyFrame);
+        pageTable.clear();
+        clockHand = 0;
+        numDirtyFrames = 0;
+        return 0;
+    }
+
+    unsigned BufferPoolManager::getNumFrames() {
+        std::unique_lock<std::mutex> lock(poolLatch);
+        return frames.size();
+    }
+
+    void BufferPoolManager::setTargetDirtyPercent(unsigned percent) {
+        std::unique_lock<std::mutex> lock(poolLatch);
+        targetDirtyPercent = percent > 100 ? 100 : percent;
+        writerWakeup.notify_one();
+    }
+
+    unsigned BufferPoolManager::getTargetDirtyPercent() {
+        std::unique_lock<std::mutex> lock(poolLatch);
+        return targetDirtyPercent;
+    }
+
+    void BufferPoolManager::setCheckpointInterval(unsigned milliseconds) {
+        std::unique_lock<std::mutex> lock(poolLatch);
+        checkpointInterval = milliseconds;
+    }
+
+    unsigned BufferPoolManager::getCheckpointInterval() {
+        std::unique_lock<std::mutex> lock(poolLatch);
+        return checkpointInterval;
+    }
+
+    unsigned BufferPoolManager::getNumDirtyFrames() {
+        std::unique_lock<std::mutex> lock(poolLatch);
+        return numDirtyFrames;
+    }
+
+    RC BufferPoolManager::fetchPage(FileHandle &fileHandle, PageNum pageNum, void* &pageData) {
+        std::unique_lock<std::mutex> lock(poolLatch);
+        if (pageNum >= fileHandle.getNumberOfPages()) return -1;
+        if (frames.empty()) return -1;
+
+        unsigned numReadAhead = fileHandle.trackRead(pageNum);
+        unsigned numAdvised = 0;
+
+        unsigned frameIdx;
+        bool isCached = lookupFrame(lock, fileHandle, pageNum, frameIdx);
+        while (!isCached) {
+            bool isReleased;
+            if (evictFrame(lock, frameIdx, isReleased) != 0) return -1;
+
+            // Another thread may have brought the page in while a victim was written back
+            unsigned cachedIdx;
+            if (!isReleased || findFrame(fileHandle, pageNum, cachedIdx) != 0) break;
+            isCached = lookupFrame(lock, fileHandle, pageNum, frameIdx);
+        }
+
+        if (isCached) {
+            fileHandle.hitCounter++;
+            frames[frameIdx].pinCount++;
+        }
+        else {
+            // Page not cached, claim the frame so other threads wait for it instead of reading it again
+            BufferFrame& frame = frames[frameIdx];
+            frame.fileName = fileHandle.fileName;
+            frame.pageNum = pageNum;
+            frame.file = fileHandle.file;
+            frame.pageLSN = 0;
+            frame.pinCount = 1;
+            markClean(frameIdx);
+            frame.isValid = true;
+            frame.isLoading = true;
+            pageTable[fileHandle.fileName][pageNum] = frameIdx;
+
+            // Bring it in from disk without holding the latch
+            RC errCode;
+            if (numReadAhead > 1) {
+                errCode = readAhead(lock, fileHandle, pageNum, numReadAhead, frameIdx);
+                numAdvised = numReadAhead;
+            }
+            else {
+                lock.unlock();
+                errCode = fileHandle.readPhysicalPage(pageNum, getFrameData(frameIdx));
+                lock.lock();
+                fileHandle.missCounter++;
+            }
+
+            frame.isLoading = false;
+            frameLoaded.notify_all();
+            if (errCode != 0) {
+                removeFrame(frameIdx);
+                return -1;
+            }
+        }
+
+        frames[frameIdx].refBit = true;
+        fileHandle.readPageCounter++;
+        pageData = getFrameData(frameIdx);
+
+        // Let the kernel fetch the following window in the background, the pool does not wait for the hint
+        if (numAdvised > 0) {
+            lock.unlock();
+            fileHandle.adviseWillNeed(pageNum + numAdvised, numAdvised);
+        }
+        return 0;
+    }
+
+    RC BufferPoolManager::unpinPage(FileHandle &fileHandle, PageNum pageNum, bool isDirty) {
+        std::unique_lock<std::mutex> lock(poolLatch);
+        unsigned frameIdx;
+        if (findFrame(fileHandle, pageNum, frameIdx) != 0) return -1;
+
+        BufferFrame& frame = frames[frameIdx];
+        if (frame.pinCount == 0) return -1;
+        if (isDirty) {
+            // The change is logged before the frame can be written back
+            WriteAheadLog* wal = fileHandle.file->wal;
+            LSN lsn = 0;
+            if (wal != nullptr) {
+                lsn = wal->append(pageNum, getFrameData(frameIdx));
+                if (lsn == 0) return -1;
+            }
+            frame.file = fileHandle.file;
+            markDirty(frameIdx, lsn);
+            fileHandle.writePageCounter++;
+        }
+        frame.pinCount--;
+        return 0;
+    }
+
+    RC BufferPoolManager::flushPage(FileHandle &fileHandle, PageNum pageNum) {
+        std::unique_lock<std::mutex> lock(poolLatch);
+        waitForWriter(lock);
+        unsigned frameIdx;
+        if (findFrame(fileHandle, pageNum, frameIdx) != 0) return 0;   // nothing cached, nothing to flush
+
+        if (frames[frameIdx].isDirty) {
+            frames[frameIdx].file = fileHandle.file;
+            return writeBackFrame(frameIdx);
+        }
+        return 0;
+    }
+
+    RC BufferPoolManager::flushFile(FileHandle &fileHandle) {
+        std::unique_lock<std::mutex> lock(poolLatch);
+        waitForWriter(lock);
+        auto fileIt = pageTable.find(fileHandle.fileName);
+        if (fileIt == pageTable.end()) return 0;
+
+        for (auto &entry : fileIt->second) {
+            BufferFrame& frame = frames[entry.second];
+            if (frame.isDirty) {
+                frame.file = fileHandle.file;
+                if (writeBackFrame(entry.second) != 0) return -1;
+            }
+        }
+        return 0;
+    }
+
+    RC BufferPoolManager::discardFile(const std::string &fileName) {
+        std::unique_lock<std::mutex> lock(poolLatch);
+        auto fileIt = pageTable.end();
+        while (true) {
+            waitForWriter(lock);
+            fileIt = pageTable.find(fileName);
+            if (fileIt == pageTable.end()) return 0;
+
+            // Let pages being read in finish first, a page still pinned after that is in use and cannot go
+            bool isLoading = false;
+            for (auto &entry : fileIt->second) {
+                const BufferFrame& frame = frames[entry.second];
+                if (frame.isLoading) isLoading = true;
+                else if (frame.pinCount > 0) return -1;
+            }
+            if (!isLoading) break;
+            frameLoaded.wait(lock);
+        }
+
+        for (auto &entry : fileIt->second) {
+            BufferFrame& frame = frames[entry.second];
+            markClean(entry.second);
+            frame.fileName.clear();
+            frame.file = nullptr;
+            frame.pageLSN = 0;
+            frame.pinCount = 0;
+            frame.refBit = false;
+            frame.isValid = false;
+        }
+        pageTable.erase(fileIt);
+        return 0;
+    }
+
+    RC BufferPoolManager::discardPage(FileHandle &fileHandle, PageNum pageNum) {
+        std::unique_lock<std::mutex> lock(poolLatch);
+        waitForWriter(lock);
+        unsigned frameIdx;
+        if (!lookupFrame(lock, fileHandle, pageNum, frameIdx)) return 0;
+        if (frames[frameIdx].pinCount > 0) return -1;
+
+        removeFrame(frameIdx);
+        return 0;
+    }
+
+    RC BufferPoolManager::readPage(FileHandle &fileHandle, PageNum pageNum, void *data) {
+        // Caching disabled, go straight to disk
+        if (getNumFrames() == 0) {
+            if (pageNum >= fileHandle.getNumberOfPages()) return -1;
+            if (fileHandle.readPhysicalPage(pageNum, data) != 0) return -1;
+            std::unique_lock<std::mutex> lock(poolLatch);
+            fileHandle.missCounter++;
+            fileHandle.readPageCounter++;
+            return 0;
+        }
+
+        void* pageData;
+        if (fetchPage(fileHandle, pageNum, pageData) != 0) return -1;
+        {
+            // writePage() overwrites cached frames under the latch, so the copy can not see half a write
+            std::unique_lock<std::mutex> lock(poolLatch);
+            memcpy(data, pageData, PAGE_SIZE);
+        }
+        return unpinPage(fileHandle, pageNum, false);
+    }
+
+    RC BufferPoolManager::writePage(FileHandle &fileHandle, PageNum pageNum, const void *data) {
+        if (pageNum >= fileHandle.getNumberOfPages()) return -1;
+
+        // With a log the page only has to be logged, the cached copy is written back later
+        WriteAheadLog* wal = fileHandle.file->wal;
+        LSN lsn = 0;
+        if (wal != nullptr) {
+            lsn = wal->append(pageNum, data);
+            if (lsn == 0) return -1;
+        }
+
+        std::unique_lock<std::mutex> lock(poolLatch);
+
+        // Keep the written page in the pool, the background writer writes it back later
+        unsigned frameIdx;
+        bool isCached = lookupFrame(lock, fileHandle, pageNum, frameIdx);
+        while (!isCached && !frames.empty()) {
+            bool isReleased;
+            if (evictFrame(lock, frameIdx, isReleased) != 0) break;
+
+            unsigned cachedIdx;
+            if (isReleased && findFrame(fileHandle, pageNum, cachedIdx) == 0) {
+                isCached = lookupFrame(lock, fileHandle, pageNum, frameIdx);
+                continue;
+            }
+
+            BufferFrame& frame = frames[frameIdx];
+            frame.fileName = fileHandle.fileName;
+            frame.pageNum = pageNum;
+            frame.pageLSN = 0;
+            frame.pinCount = 0;
+            frame.isValid = true;
+            frame.isLoading = false;
+            pageTable[fileHandle.fileName][pageNum] = frameIdx;
+            isCached = true;
+        }
+        if (isCached) {
+            BufferFrame& frame = frames[frameIdx];
+            memcpy(getFrameData(frameIdx), data, PAGE_SIZE);
+            frame.file = fileHandle.file;
+            frame.refBit = true;
+            markDirty(frameIdx, lsn);
+            fileHandle.writePageCounter++;
+            return 0;
+        }
+
+        // No frame to keep it in, write through
+        lock.unlock();
+        if (wal != nullptr && wal->flush(lsn) != 0) return -1;
+        if (fileHandle.writePhysicalPage(pageNum, data) != 0) return -1;
+        fileHandle.writePageCounter++;
+        return 0;
+    }
+
+    RC BufferPoolManager::prefetchPage(FileHandle &fileHandle, PageNum pageNum) {
+        void* pageData;
+        if (fetchPage(fileHandle, pageNum, pageData) != 0) return -1;
+        return unpinPage(fileHandle, pageNum, false);
+    }
+
+    RC BufferPoolManager::prefetchPages(FileHandle &fileHandle, const std::vector<PageNum> &pageNums) {
+        if (fileHandle.fd < 0) return -1;
+
+        // Every distinct page is read once
+        std::vector<PageNum> distinctPageNums;
+        for (PageNum pageNum : pageNums) {
+            if (std::find(distinctPageNums.begin(), distinctPageNums.end(), pageNum) == distinctPageNums.end()) {
+                distinctPageNums.push_back(pageNum);
+            }
+        }
+
+        if (fileHandle.isMapped() || getNumFrames() == 0) {
+            for (PageNum pageNum : distinctPageNums) fileHandle.adviseWillNeed(pageNum, 1);
+            return 0;
+        }
+
+        // The reads run in parallel, each page is pinned and unpinned by an I/O thread
+        RC errCode = 0;
+        std::vector<std::future<RC>> completions;
+        for (PageNum pageNum : distinctPageNums) {
+            completions.push_back(AsyncIOManager::instance().submitPrefetch(fileHandle, pageNum));
+        }
+        for (auto &completion : completions) {
+            if (completion.get() != 0) errCode = -1;
+        }
+        return errCode;
+    }
+
+    RC BufferPoolManager::readAhead(std::unique_lock<std::mutex> &lock, FileHandle &fileHandle, PageNum pageNum,
+                                    unsigned &count, unsigned frameIdx) {
+        if (count > fileHandle.getNumberOfPages() - pageNum) count = fileHandle.getNumberOfPages() - pageNum;
+
+        // Read the whole window with one call, the requested frame is already claimed
+        unsigned long long writeBackCount = numWriteBacks;
+        lock.unlock();
+        char* windowBuffer;
+        if (posix_memalign((void**) &windowBuffer, PFM_IO_ALIGNMENT, (size_t) count*PAGE_SIZE) != 0) {
+            lock.lock();
+            return -1;
+        }
+        RC errCode = fileHandle.readBlocks((off_t) (1+pageNum)*PAGE_SIZE, count, windowBuffer);
+        if (errCode == 0) memcpy(getFrameData(frameIdx), windowBuffer, PAGE_SIZE);
+        lock.lock();
+        if (errCode != 0) {
+            free(windowBuffer);
+            return -1;
+        }
+        fileHandle.missCounter += count;
+
+        // A page written back while we were reading may be older in the window than on disk
+        if (numWriteBacks != writeBackCount) count = 1;
+
+        // Dirty pages of the window may be evicted below to make room, the window has to hold their data then
+        for (unsigned i = 1; i < count; i++) {
+            unsigned currIdx;
+            if (findFrame(fileHandle, pageNum + i, currIdx) == 0 && frames[currIdx].isDirty) {
+                memcpy(windowBuffer + (size_t) i*PAGE_SIZE, getFrameData(currIdx), PAGE_SIZE);
+            }
+        }
+
+        for (unsigned i = 1; i < count; i++) {
+            unsigned currIdx;
+            if (findFrame(fileHandle, pageNum + i, currIdx) == 0) continue;    // cached copy may be newer
+
+            // The window is only known to be current while the latch is held
+            bool isReleased;
+            if (evictFrame(lock, currIdx, isReleased) != 0 || isReleased) break;
+
+            BufferFrame& frame = frames[currIdx];
+            memcpy(getFrameData(currIdx), windowBuffer + (size_t) i*PAGE_SIZE, PAGE_SIZE);
+            frame.fileName = fileHandle.fileName;
+            frame.pageNum = pageNum + i;
+            frame.file = fileHandle.file;
+            frame.pageLSN = 0;
+            frame.pinCount = 0;
+            markClean(currIdx);
+            frame.refBit = true;
+            frame.isValid = true;
+            frame.isLoading = false;
+            pageTable[fileHandle.fileName][pageNum + i] = currIdx;
+        }
+        free(windowBuffer);
+        fileHandle.growReadAhead(count);
+        return 0;
+    }
+
+    unsigned long long BufferPoolManager::getNumWriteBacks() {
+        std::unique_lock<std::mutex> lock(poolLatch);
+        return numWriteBacks;
+    }
+
+    unsigned BufferPoolManager::overlayPages(FileHandle &fileHandle, PageNum firstPageNum, unsigned count, void *data) {
+        std::unique_lock<std::mutex> lock(poolLatch);
+        auto fileIt = pageTable.find(fileHandle.fileName);
+        if (fileIt == pageTable.end()) return 0;
+
+        unsigned numCached = 0;
+        for (unsigned i = 0; i < count; i++) {
+            auto pageIt = fileIt->second.find(firstPageNum + i);
+            if (pageIt == fileIt->second.end()) continue;
+
+            unsigned frameIdx = pageIt->second;
+            if (frames[frameIdx].isLoading) continue;
+            if (frames[frameIdx].isDirty) {
+                memcpy((char*) data + (size_t) i*PAGE_SIZE, getFrameData(frameIdx), PAGE_SIZE);
+            }
+            frames[frameIdx].refBit = true;
+            numCached++;
+        }
+        return numCached;
+    }
+
+    void BufferPoolManager::updateCachedPages(FileHandle &fileHandle, PageNum firstPageNum, unsigned count,
+                                              const void *data, LSN lsn) {
+        std::unique_lock<std::mutex> lock(poolLatch);
+        auto fileIt = pageTable.find(fileHandle.fileName);
+        if (fileIt == pageTable.end()) return;
+
+        for (unsigned i = 0; i < count; i++) {
+            auto pageIt = fileIt->second.find(firstPageNum + i);
+            if (pageIt == fileIt->second.end()) continue;
+
+            unsigned frameIdx = pageIt->second;
+            memcpy(getFrameData(frameIdx), (const char*) data + (size_t) i*PAGE_SIZE, PAGE_SIZE);
+            // An older copy being written by the background writer may land after the range, write it again
+            if (frames[frameIdx].isWriting) markDirty(frameIdx, lsn);
+            else markClean(frameIdx);
+        }
+    }
+
+    RC BufferPoolManager::flushOpenFile(OpenFile* file) {
+        std::unique_lock<std::mutex> lock(poolLatch);
+        waitForWriter(lock);
+        for (unsigned i = 0; i < frames.size(); i++) {
+            if (frames[i].isValid && frames[i].isDirty && frames[i].file == file) {
+                if (writeBackFrame(i) != 0) return -1;
+            }
+        }
+        return 0;
+    }
+
+    void BufferPoolManager::detachOpenFile(OpenFile* file, bool writeBack) {
+        std::unique_lock<std::mutex> lock(poolLatch);
+        waitForWriter(lock);
+        for (unsigned i = 0; i < frames.size(); i++) {
+            BufferFrame& frame = frames[i];
+            if (!frame.isValid || frame.file != file) continue;
+
+            // Clean pages stay cached for the next open, a dirty page is written back or dropped with the file
+            if (frame.isDirty && (!writeBack || writeBackFrame(i) != 0)) {
+                removeFrame(i);
+                continue;
+            }
+            frame.file = nullptr;
+        }
+    }
+
+    RC BufferPoolManager::findFrame(FileHandle &fileHandle, PageNum pageNum, unsigned &frameIdx) {
+        auto fileIt = pageTable.find(fileHandle.fileName);
+        if (fileIt == pageTable.end()) return -1;
+
+        auto pageIt = fileIt->second.find(pageNum);
+        if (pageIt == fileIt->second.end()) return -1;
+
+        frameIdx = pageIt->second;
+        return 0;
+    }
+
+    bool BufferPoolManager::lookupFrame(std::unique_lock<std::mutex> &lock, FileHandle &fileHandle, PageNum pageNum,
+                                        unsigned &frameIdx) {
+        while (findFrame(fileHandle, pageNum, frameIdx) == 0) {
+            if (!frames[frameIdx].isLoading) return true;
+            // Another thread is reading the page in, the frame may be dropped if its read fails
+            frameLoaded.wait(lock);
+        }
+        return false;
+    }
+
+    RC BufferPoolManager::evictFrame(std::unique_lock<std::mutex> &lock, unsigned &frameIdx, bool &isReleased) {
+        unsigned numFrames = frames.size();
+        isReleased = false;
+
+        // Clock replacement: give every referenced frame a second chance, two sweeps are enough
+        for (unsigned i = 0; i < 2 * numFrames; i++) {
+            unsigned currIdx = clockHand;
+            BufferFrame& frame = frames[currIdx];
+            clockHand = (clockHand + 1) % numFrames;
+
+            if (!frame.isValid) {
+                frameIdx = currIdx;
+                return 0;
+            }
+            if (frame.pinCount > 0) continue;
+            if (frame.refBit) {
+                frame.refBit = false;
+                continue;
+            }
+
+            // Prefer a clean victim on the first sweep, dirty pages are the background writer's job
+            if (frame.isDirty && i < numFrames) {
+                writerWakeup.notify_one();
+                continue;
+            }
+
+            // No clean victim, write this one back without holding up the pool. It may be taken meanwhile.
+            if (frame.isDirty) {
+                isReleased = true;
+                if (writeBackVictim(lock, currIdx) != 0) return -1;
+                if (!frame.isValid || frame.isDirty || frame.isLoading || frame.pinCount > 0) continue;
+            }
+
+            removeFrame(currIdx);
+            frameIdx = currIdx;
+            return 0;
+        }
+        return -1;  // all frames are pinned
+    }
+
+    void BufferPoolManager::removeFrame(unsigned frameIdx) {
+        BufferFrame& frame = frames[frameIdx];
+        auto fileIt = pageTable.find(frame.fileName);
+        if (fileIt != pageTable.end()) {
+            auto pageIt = fileIt->second.find(frame.pageNum);
+            if (pageIt != fileIt->second.end() && pageIt->second == frameIdx) fileIt->second.erase(pageIt);
+            if (fileIt->second.empty()) pageTable.erase(fileIt);
+        }
+        markClean(frameIdx);
+        frame.isValid = false;
+        frame.isLoading = false;
+        frame.pinCount = 0;
+        frame.file = nullptr;
+        frame.pageLSN = 0;
+    }
+
+    RC BufferPoolManager::writeBackFrame(unsigned frameIdx) {
+        BufferFrame& frame = frames[frameIdx];
+        OpenFile* file = frame.file;
+        if (file == nullptr || frame.pageNum >= file->numPages) return -1;
+
+        // The log has to be on disk before the page it describes (the write-ahead rule)
+        if (file->wal != nullptr && file->wal->flush(frame.pageLSN) != 0) return -1;
+        if (PagedFileManager::writeBlocks(file, (off_t) (1+frame.pageNum)*PAGE_SIZE, 1,
+                                          getFrameData(frameIdx)) != 0) return -1;
+        markClean(frameIdx);
+        numWriteBacks++;
+        return 0;
+    }
+
+    RC BufferPoolManager::writeBackVictim(std::unique_lock<std::mutex> &lock, unsigned frameIdx) {
+        BufferFrame& frame = frames[frameIdx];
+        OpenFile* file = frame.file;
+        if (file == nullptr || frame.pageNum >= file->numPages) return -1;
+
+        // Write a copy of the pinned frame, like the background writer, so the page stays usable meanwhile
+        char* buffer;
+        if (posix_memalign((void**) &buffer, PFM_IO_ALIGNMENT, PAGE_SIZE) != 0) return -1;
+        memcpy(buffer, getFrameData(frameIdx), PAGE_SIZE);
+        PageNum pageNum = frame.pageNum;
+        LSN pageLSN = frame.pageLSN;
+        unsigned long long dirtySeq = frame.dirtySeq;
+        frame.pinCount++;
+        frame.isWriting = true;
+        numBusyWriters++;
+        lock.unlock();
+
+        RC errCode = -1;
+        if ((file->wal == nullptr || file->wal->flush(pageLSN) == 0) &&
+            PagedFileManager::writeBlocks(file, (off_t) (1+pageNum)*PAGE_SIZE, 1, buffer) == 0) {
+            errCode = 0;
+        }
+        free(buffer);
+
+        lock.lock();
+        frame.pinCount--;
+        frame.isWriting = false;
+        if (errCode == 0) {
+            if (frame.dirtySeq == dirtySeq) markClean(frameIdx);
+            numWriteBacks++;
+        }
+        if (--numBusyWriters == 0) writerDone.notify_all();
+        return errCode;
+    }
+
+    void* BufferPoolManager::getFrameData(unsigned frameIdx) {
+        return frameData + (size_t) frameIdx * PAGE_SIZE;
+    }
+
+    void BufferPoolManager::markDirty(unsigned frameIdx, LSN lsn) {
+        BufferFrame& frame = frames[frameIdx];
+        if (!frame.isDirty) {
+            frame.isDirty = true;
+            frame.recLSN = lsn;
+            frame.dirtyTime = std::chrono::steady_clock::now();
+            numDirtyFrames++;
+        }
+        if (lsn > frame.pageLSN) frame.pageLSN = lsn;
+        frame.dirtySeq = ++numDirtyings;
+
+        // Past the target, get the writer going instead of waiting for its next round
+        if ((unsigned long long) numDirtyFrames * 100 > (unsigned long long) frames.size() * targetDirtyPercent) {
+            writerWakeup.notify_one();
+        }
+    }
 
-    PagedFileManager::PagedFileManager(const PagedFileManager &) = default;
+    void BufferPoolManager::markClean(unsigned frameIdx) {
+        BufferFrame& frame = frames[frameIdx];
+        if (frame.isDirty) {
+            frame.isDirty = false;
+            numDirtyFrames--;
+        }
+        frame.recLSN = 0;
+    }
 
-    PagedFileManager &PagedFileManager::operator=(const PagedFileManager &) = default;
+    void BufferPoolManager::runWriter() {
+        std::unique_lock<std::mutex> lock(poolLatch);
+        std::chrono::steady_clock::time_point lastCheckpoint = std::chrono::steady_clock::now();
+        while (!isWriterStopping) {
+            writerWakeup.wait_for(lock, std::chrono::milliseconds(PFM_WRITER_INTERVAL_MS));
 
-    RC PagedFileManager::createFile(const std::string &fileName) {
-        std::fstream file;
+            // Clean pages until the pool is back under the target and nothing is too old
+            while (!isWriterStopping && writeBackBatch(lock) > 0) {}
 
-        // Try open at input mode. If successful, file already exists
-        file.open(fileName, std::ios::in | std::ios::binary);
-        if (file.is_open()) {
-            return -1;
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if (!isWriterStopping && checkpointInterval != 0 && checkpointHandler &&
+                now - lastCheckpoint >= std::chrono::milliseconds(checkpointInterval)) {
+                lastCheckpoint = now;
+                std::function<void()> handler = checkpointHandler;
+                lock.unlock();
+                handler();
+                lock.lock();
+            }
         }
-        // If unsuccessful, create empty file at output mode
-        else {
-            file.open(fileName, std::ios::out | std::ios::binary);
-            initHiddenPage(file);
-            file.close();
-            return 0;
+    }
+
+    unsigned BufferPoolManager::writeBackBatch(std::unique_lock<std::mutex> &lock) {
+        if (writerBuffer == nullptr || numDirtyFrames == 0) return 0;
+
+        std::vector<unsigned> candidates;
+        for (unsigned i = 0; i < frames.size(); i++) {
+            const BufferFrame& frame = frames[i];
+            if (frame.isValid && frame.isDirty && !frame.isLoading && frame.pinCount == 0 && frame.file != nullptr) {
+                candidates.push_back(i);
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(), [this](unsigned a, unsigned b) {
+            return frames[a].dirtyTime < frames[b].dirtyTime;
+        });
+
+        // Oldest first: everything past the age limit, then whatever keeps the pool above the target
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        unsigned targetDirtyFrames = (unsigned long long) frames.size() * targetDirtyPercent / 100;
+        unsigned numPages = 0;
+        while (numPages < candidates.size() && numPages < PFM_WRITER_BATCH_PAGES) {
+            bool isOld = now - frames[candidates[numPages]].dirtyTime >= std::chrono::milliseconds(PFM_MAX_DIRTY_AGE_MS);
+            if (!isOld && numDirtyFrames - numPages <= targetDirtyFrames) break;
+            numPages++;
         }
+        if (numPages == 0) return 0;
+        candidates.resize(numPages);
+
+        // In file order, so neighbouring pages go out with one call
+        std::sort(candidates.begin(), candidates.end(), [this](unsigned a, unsigned b) {
+            if (frames[a].file != frames[b].file) return frames[a].file < frames[b].file;
+            return frames[a].pageNum < frames[b].pageNum;
+        });
+
+        // Write copies, the frames stay usable meanwhile. Pinned, they can not be evicted and written
+        // back by someone else, and a page dirtied again keeps its frame dirty.
+        std::vector<unsigned long long> dirtySeqs(numPages);
+        for (unsigned i = 0; i < numPages; i++) {
+            BufferFrame& frame = frames[candidates[i]];
+            memcpy(writerBuffer + (size_t) i*PAGE_SIZE, getFrameData(candidates[i]), PAGE_SIZE);
+            dirtySeqs[i] = frame.dirtySeq;
+            frame.pinCount++;
+            frame.isWriting = true;
+        }
+        std::vector<OpenFile*> files(numPages);
+        std::vector<PageNum> pageNums(numPages);
+        std::vector<LSN> pageLSNs(numPages);
+        for (unsigned i = 0; i < numPages; i++) {
+            files[i] = frames[candidates[i]].file;
+            pageNums[i] = frames[candidates[i]].pageNum;
+            pageLSNs[i] = frames[candidates[i]].pageLSN;
+        }
+        numBusyWriters++;
+        lock.unlock();
+
+        std::vector<bool> isWritten(numPages, false);
+        unsigned first = 0;
+        while (first < numPages) {
+            unsigned last = first;
+            LSN maxLSN = pageLSNs[first];
+            while (last + 1 < numPages && files[last + 1] == files[first] && pageNums[last + 1] == pageNums[last] + 1) {
+                last++;
+                if (pageLSNs[last] > maxLSN) maxLSN = pageLSNs[last];
+            }
+
+            OpenFile* file = files[first];
+            unsigned count = last - first + 1;
+            if (pageNums[last] < file->numPages &&
+                (file->wal == nullptr || file->wal->flush(maxLSN) == 0) &&
+                PagedFileManager::writeBlocks(file, (off_t) (1+pageNums[first])*PAGE_SIZE, count,
+                                              writerBuffer + (size_t) first*PAGE_SIZE) == 0) {
+                for (unsigned i = first; i <= last; i++) isWritten[i] = true;
+            }
+            first = last + 1;
+        }
+
+        lock.lock();
+        unsigned numWritten = 0;
+        for (unsigned i = 0; i < numPages; i++) {
+            BufferFrame& frame = frames[candidates[i]];
+            frame.pinCount--;
+            frame.isWriting = false;
+            if (!isWritten[i]) continue;
+            if (frame.dirtySeq == dirtySeqs[i]) markClean(candidates[i]);
+            numWriteBacks++;
+            numWritten++;
+        }
+        if (--numBusyWriters == 0) writerDone.notify_all();
+        return numWritten;
     }
 
-    RC PagedFileManager::destroyFile(const std::string &fileName) {
-        std::fstream file;
+    void BufferPoolManager::waitForWriter(std::unique_lock<std::mutex> &lock) {
+        while (numBusyWriters > 0) writerDone.wait(lock);
+    }
 
-        // Try open at input mode. If unsuccessful, file doesn't exist
-        file.open(fileName, std::ios::in | std::ios::binary);
-        if (!file.is_open()) {
-            return -1;
+    void BufferPoolManager::stopWriter() {
+        {
+            std::unique_lock<std::mutex> lock(poolLatch);
+            isWriterStopping = true;
+            writerWakeup.notify_all();
         }
-        // If successful, delete the file
-        else {
-            file.close();
-            remove(fileName.c_str());
-            return 0;
+        if (writer.joinable()) writer.join();
+    }
+
+    void BufferPoolManager::setCheckpointHandler(std::function<void()> handler) {
+        std::unique_lock<std::mutex> lock(poolLatch);
+        checkpointHandler = handler;
+    }
+
+    LSN BufferPoolManager::getMinRecLSN(OpenFile* file) {
+        std::unique_lock<std::mutex> lock(poolLatch);
+        LSN minRecLSN = 0;
+        for (const BufferFrame& frame : frames) {
+            if (!frame.isValid || !frame.isDirty || frame.file != file || frame.recLSN == 0) continue;
+            if (minRecLSN == 0 || frame.recLSN < minRecLSN) minRecLSN = frame.recLSN;
         }
+        return minRecLSN;
     }
 
-    RC PagedFileManager::openFile(const std::string &fileName, FileHandle &fileHandle) {
-        return fileHandle.openFile(fileName);
+    AsyncIOManager &AsyncIOManager::instance() {
+        static AsyncIOManager _aio_manager;
+        return _aio_manager;
     }
 
-    RC PagedFileManager::closeFile(FileHandle &fileHandle) {
-        return fileHandle.closeFile();
+    AsyncIOManager::AsyncIOManager() {
+        numThreads = PFM_DEFAULT_IO_THREADS;
+        nextWorker = 0;
     }
 
-    void PagedFileManager::initHiddenPage(std::fstream& file) {
-        unsigned readPageCounter = 0;
-        unsigned writePageCounter = 0;
-        unsigned appendPageCounter = 1;
-        unsigned numPages = 0;
+    AsyncIOManager::~AsyncIOManager() {
+        stopWorkers();
+    }
 
-        unsigned* buffer = new unsigned[PAGE_SIZE/sizeof(unsigned)];
-        buffer[0] = readPageCounter;
-        buffer[1] = writePageCounter;
-        buffer[2] = appendPageCounter;
-        buffer[3] = numPages;
-        file.seekp(0, std::ios::beg);
-        file.write((char*) buffer, PAGE_SIZE);
-        delete[] buffer;
+    RC AsyncIOManager::setNumThreads(unsigned numThreads) {
+        if (numThreads == 0) return -1;
+        stopWorkers();
+        std::unique_lock<std::mutex> lock(stateLatch);
+        this->numThreads = numThreads;
+        return 0;
+    }
+
+    unsigned AsyncIOManager::getNumThreads() {
+        std::unique_lock<std::mutex> lock(stateLatch);
+        return numThreads;
+    }
+
+    std::future<RC> AsyncIOManager::submitRead(FileHandle &fileHandle, PageNum pageNum, void *data) {
+        FileHandle* handle = &fileHandle;
+        return submit(fileHandle.fileName, false, [handle, pageNum, data]() {
+            return handle->readPage(pageNum, data);
+        });
+    }
+
+    std::future<RC> AsyncIOManager::submitWrite(FileHandle &fileHandle, PageNum pageNum, const void *data) {
+        // Copy the page so the caller can reuse its buffer right away
+        std::shared_ptr<std::vector<char>> pageCopy(new std::vector<char>((const char*) data,
+                                                                          (const char*) data + PAGE_SIZE));
+        FileHandle* handle = &fileHandle;
+        return submit(fileHandle.fileName, true, [handle, pageNum, pageCopy]() {
+            return handle->writePage(pageNum, pageCopy->data());
+        });
+    }
+
+    std::future<RC> AsyncIOManager::submitPrefetch(FileHandle &fileHandle, PageNum pageNum) {
+        FileHandle* handle = &fileHandle;
+        return submit(fileHandle.fileName, false, [handle, pageNum]() {
+            return BufferPoolManager::instance().prefetchPage(*handle, pageNum);
+        });
+    }
+
+    void AsyncIOManager::waitForFile(const std::string &fileName) {
+        std::unique_lock<std::mutex> lock(stateLatch);
+        while (pendingIOs.find(fileName) != pendingIOs.end()) {
+            ioDone.wait(lock);
+        }
+    }
+
+    std::future<RC> AsyncIOManager::submit(const std::string &fileName, bool isWrite, std::function<RC()> request) {
+        std::shared_ptr<std::packaged_task<RC()>> task(new std::packaged_task<RC()>(request));
+        std::future<RC> completion = task->get_future();
+
+        IOWorker* worker;
+        {
+            std::unique_lock<std::mutex> lock(stateLatch);
+            if (workers.empty()) startWorkers();
+
+            // Writes of a file share one thread to keep their order, reads follow them while any are queued
+            unsigned fileWorker = std::hash<std::string>()(fileName) % workers.size();
+            if (isWrite || pendingWrites.find(fileName) != pendingWrites.end()) {
+                worker = workers[fileWorker].get();
+            }
+            else {
+                worker = workers[nextWorker].get();
+                nextWorker = (nextWorker + 1) % workers.size();
+            }
+            pendingIOs[fileName]++;
+            if (isWrite) pendingWrites[fileName]++;
+        }
+
+        std::function<void()> job = [this, task, fileName, isWrite]() {
+            (*task)();
+
+            std::unique_lock<std::mutex> lock(stateLatch);
+            if (--pendingIOs[fileName] == 0) pendingIOs.erase(fileName);
+            if (isWrite && --pendingWrites[fileName] == 0) pendingWrites.erase(fileName);
+            ioDone.notify_all();
+        };
+
+        // Bounded queue, block until the worker catches up
+        std::unique_lock<std::mutex> workerLock(worker->latch);
+        while (worker->queue.size() >= PFM_IO_QUEUE_DEPTH) {
+            worker->notFull.wait(workerLock);
+        }
+        worker->queue.push_back(job);
+        worker->notEmpty.notify_one();
+        return completion;
+    }
+
+    void AsyncIOManager::startWorkers() {
+        for (unsigned i = 0; i < numThreads; i++) {
+            std::unique_ptr<IOWorker> worker(new IOWorker());
+            worker->isStopping = false;
+            worker->thread = std::thread(&AsyncIOManager::runWorker, this, worker.get());
+            workers.push_back(std::move(worker));
+        }
+        nextWorker = 0;
+    }
+
+    void AsyncIOManager::stopWorkers() {
+        std::vector<std::unique_ptr<IOWorker>> stoppedWorkers;
+        {
+            std::unique_lock<std::mutex> lock(stateLatch);
+            stoppedWorkers.swap(workers);
+        }
+
+        // Workers drain their queues before exiting
+        for (auto &worker : stoppedWorkers) {
+            {
+                std::unique_lock<std::mutex> workerLock(worker->latch);
+                worker->isStopping = true;
+                worker->notEmpty.notify_one();
+            }
+            worker->thread.join();
+        }
+    }
+
+    void AsyncIOManager::runWorker(IOWorker* worker) {
+        while (true) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> workerLock(worker->latch);
+                while (worker->queue.empty() && !worker->isStopping) {
+                    worker->notEmpty.wait(workerLock);
+                }
+                if (worker->queue.empty()) return;
+
+                job = worker->queue.front();
+                worker->queue.pop_front();
+                worker->notFull.notify_one();
+            }
+            job();
+        }
     }
 
     FileHandle::FileHandle() {
@@ -77,65 +2541,466 @@ namespace PeterDB {
         writePageCounter = 0;
         appendPageCounter = 0;
 
-        numPages = 0;
-        fileToBeHandled = new std::fstream;
+        hitCounter = 0;
+        missCounter = 0;
+
+        checksumErrorCounter = 0;
+
+        file = nullptr;
+        fd = -1;
+        mappedData = nullptr;
+        mappedLength = 0;
+
+        lastReadPageNum = -1;
+        sequentialRun = 0;
+        readAheadPages = PFM_MIN_READ_AHEAD;
+
+        hasAsyncIO = false;
     }
 
     FileHandle::~FileHandle() {
         closeFile();
     }
 
-    RC FileHandle::openFile(const std::string &fileName) {
-        // Test if fileToBeHandled is already open
-        //std::cout<<"inside fileHandle openFile, before file is open "<<std::endl;
-        if (fileToBeHandled->is_open()) {
-            //std::cout<<"inside fileHandle openFile, inside if file is open "<<std::endl;
+    FileHandle::FileHandle(const FileHandle &fileHandle) {
+        copyState(fileHandle);
+    }
+
+    FileHandle &FileHandle::operator=(const FileHandle &fileHandle) {
+        if (this != &fileHandle) {
+            closeFile();
+            copyState(fileHandle);
+        }
+        return *this;
+    }
+
+    void FileHandle::copyState(const FileHandle &fileHandle) {
+        readPageCounter = fileHandle.readPageCounter.load();
+        writePageCounter = fileHandle.writePageCounter.load();
+        appendPageCounter = fileHandle.appendPageCounter.load();
+
+        hitCounter = fileHandle.hitCounter.load();
+        missCounter = fileHandle.missCounter.load();
+
+        checksumErrorCounter = fileHandle.checksumErrorCounter.load();
+
+        fileName = fileHandle.fileName;
+        file = fileHandle.file;
+        fd = fileHandle.fd;
+        mappedData = fileHandle.mappedData;
+        mappedLength = fileHandle.mappedLength;
+
+        lastReadPageNum = fileHandle.lastReadPageNum;
+        sequentialRun = fileHandle.sequentialRun;
+        readAheadPages = fileHandle.readAheadPages;
+
+        hasAsyncIO = false;
+
+        // The copy is one more user of the open file, a mapping can not be shared that way
+        if (file != nullptr && mappedData == nullptr) {
+            PagedFileManager::instance().retainFile(file);
+        }
+        else if (file != nullptr) {
+            file = nullptr;
+            fd = -1;
+            mappedData = nullptr;
+            mappedLength = 0;
+        }
+    }
+
+    RC FileHandle::openFile(const std::string &fileName, bool directIO) {
+        // Test if file is already open
+        if (fd >= 0) {
             return -1;
         }
-        //std::cout<<"inside fileHandle openFile, before open "<<std::endl;
-        fileToBeHandled->open(fileName, std::ios::in | std::ios::out | std::ios::binary);
-        if (fileToBeHandled->is_open()) {
-            readHiddenPage();
-            return 0;
+
+        RC errCode = PagedFileManager::instance().acquireFile(fileName, directIO, file);
+        if (errCode != 0) {
+            file = nullptr;
+            return errCode;
         }
-        else {
+
+        fd = file->fd;
+        this->fileName = fileName;
+        readHiddenPage();
+        return 0;
+    }
+
+    RC FileHandle::openFileMapped(const std::string &fileName) {
+        // Test if file is already open
+        if (fd >= 0) {
+            return -1;
+        }
+
+        // Handles opened for writing may hold a newer hidden page or logged pages that are not in the file yet
+        PagedFileManager::instance().syncFile(fileName);
+
+        int mappedFd = open(fileName.c_str(), O_RDONLY);
+        if (mappedFd < 0) {
             return -2; //file not exists
         }
+
+        struct stat fileStat;
+        if (fstat(mappedFd, &fileStat) != 0 || fileStat.st_size < PAGE_SIZE) {
+            close(mappedFd);
+            return -1;
+        }
+
+        void* mapping = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_SHARED, mappedFd, 0);
+        if (mapping == MAP_FAILED) {
+            close(mappedFd);
+            return -1;
+        }
+
+        // Compressed pages can't be used in place, such a file has to be opened in ReadWriteMode
+        if (((const unsigned*) mapping)[8] & PFM_FILE_COMPRESSED) {
+            munmap(mapping, fileStat.st_size);
+            close(mappedFd);
+            return -1;
+        }
+
+        mappedLength = fileStat.st_size;
+        mappedData = (char*) mapping;
+        madvise(mappedData, mappedLength, MADV_SEQUENTIAL);
+
+        // A mapping gets a private entry, it is never shared through the open-file table
+        file = new OpenFile();
+        file->fileName = fileName;
+        file->fd = mappedFd;
+        file->isDirectIO = false;
+        file->device = fileStat.st_dev;
+        file->inode = fileStat.st_ino;
+        file->refCount = 1;
+        file->isInTable = false;
+        file->allocatedPages = mappedLength / PAGE_SIZE;
+        file->headerDirty = false;
+        file->headerUpdates = 0;
+        file->headerSyncInterval = 0;
+        file->wal = nullptr;
+        file->pageMap = nullptr;
+        file->checksums = nullptr;      // pages are used in place, there is no read to verify
+        file->verifyChecksums = false;
+        file->memoryPages = nullptr;
+        if (PagedFileManager::instance().loadFileHeader(file, (const unsigned*) mappedData) != 0) {
+            delete file;
+            file = nullptr;
+            munmap(mappedData, mappedLength);
+            mappedData = nullptr;
+            mappedLength = 0;
+            close(mappedFd);
+            return -1;
+        }
+
+        fd = mappedFd;
+        this->fileName = fileName;
+        readHiddenPage();
+
+        // The header is written lazily, so the mapping size is the authority on the number of pages
+        file->numPages = mappedLength / PAGE_SIZE - 1;
+        return 0;
+    }
+
+    RC FileHandle::openTempFile(size_t memoryLimit) {
+        // Test if file is already open
+        if (fd >= 0) {
+            return -1;
+        }
+
+        // The spill file is there from the start, but nothing is written to it before the pages outgrow memory
+        const char* tempDir = getenv("TMPDIR");
+        std::string spillDir = tempDir != nullptr && tempDir[0] != '\0' ? tempDir : PFM_TEMP_DIR;
+        int spillFd = -1;
+#ifdef O_TMPFILE
+        spillFd = open(spillDir.c_str(), O_TMPFILE | O_RDWR, 0600);
+#endif
+        if (spillFd < 0) {
+            std::string templateName = spillDir + "/peterdb-XXXXXX";
+            std::vector<char> spillName(templateName.begin(), templateName.end());
+            spillName.push_back('\0');
+            spillFd = mkstemp(spillName.data());
+            if (spillFd < 0) return -1;
+            unlink(spillName.data());
+        }
+
+        // A temporary file gets a private entry, like a mapping. The name only keys its pages in the buffer pool.
+        PagedFileManager &pfm = PagedFileManager::instance();
+        file = new OpenFile();
+        file->fileName = PFM_TEMP_NAME_PREFIX + std::to_string(++pfm.numTempFiles);
+        file->fd = spillFd;
+        file->isDirectIO = false;
+        file->device = 0;
+        file->inode = 0;
+        file->refCount = 1;
+        file->isInTable = false;
+        file->numPages = 0;
+        file->allocatedPages = 0;
+        file->readPageCounter = 0;
+        file->writePageCounter = 0;
+        file->appendPageCounter = 0;
+        file->headerDirty = false;
+        file->headerUpdates = 0;
+        file->headerSyncInterval = 0;
+        file->wal = nullptr;
+        file->isCompressed = false;
+        file->hasChecksums = false;
+        file->pageMap = nullptr;
+        file->checksums = nullptr;
+        file->verifyChecksums = false;
+        file->memoryPages = new MemoryPageStore(memoryLimit);
+        file->checkpointLSN = 0;
+
+        fd = spillFd;
+        this->fileName = file->fileName;
+        readHiddenPage();
+        return 0;
     }
 
     RC FileHandle::closeFile() {
         // If file is already closed, do nothing
+        if (fd < 0) {
+            return 0;
+        }
+
+        // Outstanding async requests still use this handle
+        if (hasAsyncIO) {
+            AsyncIOManager::instance().waitForFile(fileName);
+            hasAsyncIO = false;
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(file->writeLatch);
+
+            // Mapped files are read only, nothing to write back
+            if (isMapped()) {
+                munmap(mappedData, mappedLength);
+                mappedData = nullptr;
+                mappedLength = 0;
+            }
+            else if (file->wal != nullptr) {
+                // Logged pages may stay dirty in the pool, committing the log is enough
+                writeHiddenPage();
+                file->wal->flush(file->wal->getLastLSN());
+                if (file->wal->getLogSize() >= PFM_WAL_CHECKPOINT_BYTES) {
+                    PagedFileManager::instance().checkpointFile(file);
+                }
+            }
+            else {
+                // The last handle to close writes back the dirty pages and the hidden page
+                writeHiddenPage();
+            }
+        }
+
+        // The descriptor may stay open in the open-file table for the next handle
+        PagedFileManager::instance().releaseFile(file);
+        file = nullptr;
+        fd = -1;
+        return 0;
+    }
+
+    RC FileHandle::sync() {
+        if (fd < 0) return -1;
+        if (isMapped() || isTemporary()) return 0;  // a temporary file doesn't outlive us anyway
+
+        std::lock_guard<std::mutex> guard(file->writeLatch);
+        if (file->wal != nullptr) {
+            if (file->headerDirty) writeHiddenPage();
+            return PagedFileManager::instance().checkpointFile(file);
+        }
+        if (BufferPoolManager::instance().flushFile(*this) != 0) return -1;
+        if (file->headerDirty) {
+            writeHiddenPage();
+            if (PagedFileManager::instance().writeFileHeader(file) != 0) return -1;
+        }
+        return PagedFileManager::syncData(file);
+    }
+
+    RC FileHandle::commit() {
+        if (fd < 0) return -1;
+        if (isMapped() || isTemporary()) return 0;
 
-        //if (fileToBeHandled->is_open()) {
-        writeHiddenPage();
-        fileToBeHandled->close();
+        // Without a log the pages and the header have to be forced out
+        WriteAheadLog* wal = file->wal;
+        if (wal == nullptr) return sync();
+        return wal->flush(wal->getLastLSN());
+    }
+
+    void FileHandle::setHeaderSyncInterval(unsigned numUpdates) {
+        if (file == nullptr) return;
+        std::lock_guard<std::mutex> guard(file->writeLatch);
+        file->headerSyncInterval = numUpdates;
+    }
+
+    void FileHandle::markHeaderDirty() {
+        file->headerDirty = true;
+        file->headerUpdates++;
+        if (file->headerSyncInterval != 0 && file->headerUpdates >= file->headerSyncInterval) {
+            writeHiddenPage();
+            PagedFileManager::instance().writeFileHeader(file);
+        }
+    }
+
+    RC FileHandle::reserveExtent(unsigned numPhysicalPages) {
+        unsigned &allocatedPages = file->allocatedPages;
+        if (file->isCompressed || numPhysicalPages <= allocatedPages) return 0;     // the map places pages
+        if (file->memoryPages != nullptr) return 0;     // space is only taken when the file spills
+
+        unsigned newAllocatedPages = allocatedPages + PFM_EXTENT_PAGES;
+        if (newAllocatedPages < numPhysicalPages) newAllocatedPages = numPhysicalPages;
+#ifdef FALLOC_FL_KEEP_SIZE
+        // Reserve the blocks without changing the file size, appends still grow the file page by page
+        fallocate(fd, FALLOC_FL_KEEP_SIZE, (off_t) allocatedPages*PAGE_SIZE,
+                  (off_t) (newAllocatedPages-allocatedPages)*PAGE_SIZE);
+#endif
+        allocatedPages = newAllocatedPages;
         return 0;
-        //}
-        //else {
-        //    return -1;
-        //}
     }
 
     RC FileHandle::readPage(PageNum pageNum, void* data) {
-        if (pageNum < numPages) {
-            fileToBeHandled->seekg((1+pageNum)*PAGE_SIZE);
-            fileToBeHandled->read((char*) data , PAGE_SIZE);
-            readPageCounter++;
-            //writeHiddenPage();
+        // Mapped files are already in memory, copy straight from the mapping
+        if (isMapped()) {
+            const void* page = pageView(pageNum);
+            if (page == nullptr) return -1;
+            memcpy(data, page, PAGE_SIZE);
+            return 0;
+        }
+        return BufferPoolManager::instance().readPage(*this, pageNum, data);
+    }
+
+    RC FileHandle::writePage(PageNum pageNum, const void* data) {
+        if (fd < 0 || isMapped()) return -1;
+        std::lock_guard<std::mutex> guard(file->writeLatch);
+        return BufferPoolManager::instance().writePage(*this, pageNum, data);
+    }
+
+    RC FileHandle::readPages(PageNum firstPageNum, unsigned count, void* data) {
+        if (count == 0) return 0;
+        unsigned numPages = getNumberOfPages();
+        if (firstPageNum >= numPages || count > numPages - firstPageNum) return -1;
+
+        if (isMapped()) {
+            memcpy(data, mappedData + (size_t) (1+firstPageNum)*PAGE_SIZE, (size_t) count*PAGE_SIZE);
+            readPageCounter += count;
             return 0;
         }
+
+        // Pages dirtied in the buffer pool are newer than what was just read from disk.
+        // If one of them was written back during the read, the data read may predate it, read again.
+        BufferPoolManager &bpm = BufferPoolManager::instance();
+        unsigned numCached;
+        unsigned long long numWriteBacks;
+        do {
+            numWriteBacks = bpm.getNumWriteBacks();
+            if (readBlocks((off_t) (1+firstPageNum)*PAGE_SIZE, count, data) != 0) return -1;
+            numCached = bpm.overlayPages(*this, firstPageNum, count, data);
+        } while (bpm.getNumWriteBacks() != numWriteBacks);
+        readPageCounter += count;
+        hitCounter += numCached;
+        missCounter += count - numCached;
+        return 0;
+    }
+
+    RC FileHandle::writePages(PageNum firstPageNum, unsigned count, const void* data) {
+        if (fd < 0 || isMapped()) return -1;
+        if (count == 0) return 0;
+        std::lock_guard<std::mutex> guard(file->writeLatch);
+        unsigned numPages = getNumberOfPages();
+        if (firstPageNum >= numPages || count > numPages - firstPageNum) return -1;
+
+        // The range is written in place right away, so its images have to be on disk first
+        WriteAheadLog* wal = file->wal;
+        LSN lsn = 0;
+        if (wal != nullptr) {
+            for (unsigned i = 0; i < count; i++) {
+                lsn = wal->append(firstPageNum + i, (const char*) data + (size_t) i*PAGE_SIZE);
+                if (lsn == 0) return -1;
+            }
+            if (wal->flush(lsn) != 0) return -1;
+        }
+
+        if (writeBlocks((off_t) (1+firstPageNum)*PAGE_SIZE, count, data) != 0) return -1;
+
+        // Keep cached copies in step with the file
+        BufferPoolManager::instance().updateCachedPages(*this, firstPageNum, count, data, lsn);
+        writePageCounter += count;
+        return 0;
+    }
+
+    std::future<RC> FileHandle::readPageAsync(PageNum pageNum, void* data) {
+        hasAsyncIO = true;
+        return AsyncIOManager::instance().submitRead(*this, pageNum, data);
+    }
+
+    std::future<RC> FileHandle::writePageAsync(PageNum pageNum, const void* data) {
+        hasAsyncIO = true;
+        return AsyncIOManager::instance().submitWrite(*this, pageNum, data);
+    }
+
+    bool FileHandle::isMapped() {
+        return mappedData != nullptr;
+    }
+
+    bool FileHandle::isTemporary() {
+        return file != nullptr && file->memoryPages != nullptr;
+    }
+
+    bool FileHandle::isSpilled() {
+        return isTemporary() && file->memoryPages->isSpilled();
+    }
+
+    const void* FileHandle::pageView(PageNum pageNum) {
+        if (!isMapped() || pageNum >= getNumberOfPages()) return nullptr;
+        readPageCounter++;
+        return mappedData + (size_t) (1+pageNum)*PAGE_SIZE;
+    }
+
+    RC FileHandle::adviseWillNeed(PageNum pageNum, unsigned count) {
+        unsigned numPages = getNumberOfPages();
+        if (fd < 0 || pageNum >= numPages) return -1;
+        if (count > numPages - pageNum) count = numPages - pageNum;
+        if (isMapped()) {
+            return madvise(mappedData + (size_t) (1+pageNum)*PAGE_SIZE, (size_t) count*PAGE_SIZE, MADV_WILLNEED);
+        }
+        if (file->isCompressed) return 0;   // pages aren't where the offsets say
+        return posix_fadvise(fd, (off_t) (1+pageNum)*PAGE_SIZE, (off_t) count*PAGE_SIZE, POSIX_FADV_WILLNEED);
+    }
+
+    unsigned FileHandle::trackRead(PageNum pageNum) {
+        if (pageNum == lastReadPageNum) {
+            return 1;
+        }
+        if (pageNum == lastReadPageNum + 1) {
+            sequentialRun++;
+        }
+        else {
+            sequentialRun = 0;
+            readAheadPages = PFM_MIN_READ_AHEAD;
+        }
+        lastReadPageNum = pageNum;
+
+        if (sequentialRun < PFM_READ_AHEAD_TRIGGER) return 1;
+        return readAheadPages;
+    }
+
+    void FileHandle::growReadAhead(unsigned numPagesRead) {
+        // The window was used up sequentially, double it for the next miss
+        if (numPagesRead == readAheadPages && readAheadPages < PFM_MAX_READ_AHEAD) {
+            readAheadPages *= 2;
+            if (readAheadPages > PFM_MAX_READ_AHEAD) readAheadPages = PFM_MAX_READ_AHEAD;
+        }
+    }
+
+    RC FileHandle::readPhysicalPage(PageNum pageNum, void* data) {
+        if (pageNum < getNumberOfPages()) {
+            return readBlock((off_t) (1+pageNum)*PAGE_SIZE, data);
+        }
         else {
             return -1;
         }
     }
 
-    RC FileHandle::writePage(PageNum pageNum, const void* data) {
-        if (pageNum < numPages) {
-            fileToBeHandled->seekp((1+pageNum)*PAGE_SIZE);
-            fileToBeHandled->write((char*) data, PAGE_SIZE);
-            writePageCounter++;
-            //writeHiddenPage();
-            return 0;
+    RC FileHandle::writePhysicalPage(PageNum pageNum, const void* data) {
+        if (pageNum < getNumberOfPages()) {
+            return writeBlock((off_t) (1+pageNum)*PAGE_SIZE, data);
         }
         else{
             return -1;
@@ -143,16 +3008,103 @@ namespace PeterDB {
     }
 
     RC FileHandle::appendPage(const void* data) {
-        fileToBeHandled->seekp(0, std::ios::end);
-        fileToBeHandled->write((char*) data, PAGE_SIZE);
+        if (fd < 0 || isMapped()) return -1;
+        std::lock_guard<std::mutex> guard(file->writeLatch);
+        return appendNewPage(data);
+    }
+
+    RC FileHandle::appendNewPage(const void* data) {
+        unsigned numPages = file->numPages;
+
+        // The new page had no previous contents to protect, logging it is enough to redo the append
+        if (file->wal != nullptr && file->wal->append(numPages, data) == 0) return -1;
+
+        reserveExtent(numPages + 2);
+        if (writeBlock((off_t) (1+numPages)*PAGE_SIZE, data) != 0) return -1;
         appendPageCounter++;
-        numPages++;
-        writeHiddenPage();
+        file->numPages++;   // readers may use the page from here on
+        markHeaderDirty();
+        return 0;
+    }
+
+    RC FileHandle::allocatePage(const void* data, PageNum &pageNum) {
+        if (fd < 0 || isMapped()) return -1;
+        std::lock_guard<std::mutex> guard(file->writeLatch);
+
+        if (file->freePages.empty()) {
+            if (appendNewPage(data) != 0) return -1;
+            pageNum = file->numPages - 1;
+            return 0;
+        }
+
+        // Reuse the most recently freed page, it is the most likely to still be cached by the OS
+        PageNum freePageNum = file->freePages.back();
+        if (BufferPoolManager::instance().writePage(*this, freePageNum, data) != 0) return -1;
+        file->freePages.pop_back();
+        file->freePageMap[freePageNum] = false;
+        markHeaderDirty();
+        pageNum = freePageNum;
+        return 0;
+    }
+
+    RC FileHandle::freePage(PageNum pageNum) {
+        if (fd < 0 || isMapped()) return -1;
+        std::lock_guard<std::mutex> guard(file->writeLatch);
+
+        if (pageNum >= file->numPages) return -1;
+        if (pageNum < file->freePageMap.size() && file->freePageMap[pageNum]) return -1;     // freed twice
+        if (file->freePages.size() >= PFM_MAX_FREE_PAGES) return -1;     // no room left, the page stays in use
+
+#if defined(FALLOC_FL_PUNCH_HOLE) && defined(FALLOC_FL_KEEP_SIZE)
+        // The page reads back as zeros, the file keeps its size.
+        // A cached copy must not be written back over the hole later, otherwise it stays as the page's last contents.
+        if (PagedFileManager::instance().getPunchHoles() && !file->isCompressed) {
+            if (BufferPoolManager::instance().discardPage(*this, pageNum) != 0) return -1;
+            fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t) (1+pageNum)*PAGE_SIZE, PAGE_SIZE);
+        }
+#endif
+        // A compressed page gives its sectors back instead
+        if (PagedFileManager::instance().getPunchHoles() && file->isCompressed) {
+            if (BufferPoolManager::instance().discardPage(*this, pageNum) != 0) return -1;
+            if (file->pageMap->discardPage(pageNum) != 0) return -1;
+        }
+        // Either way the page now reads as zeros
+        if (PagedFileManager::instance().getPunchHoles() && file->checksums != nullptr) {
+            std::vector<char> zeroPage(PAGE_SIZE, 0);
+            if (file->checksums->update(pageNum, 1, zeroPage.data()) != 0) return -1;
+        }
+
+        file->freePages.push_back(pageNum);
+        if (pageNum >= file->freePageMap.size()) file->freePageMap.resize(pageNum + 1, false);
+        file->freePageMap[pageNum] = true;
+        markHeaderDirty();
         return 0;
     }
 
+    bool FileHandle::isPageFree(PageNum pageNum) {
+        if (file == nullptr) return false;
+        std::lock_guard<std::mutex> guard(file->writeLatch);
+        return pageNum < file->freePageMap.size() && file->freePageMap[pageNum];
+    }
+
+    unsigned FileHandle::getNumberOfFreePages() {
+        if (file == nullptr) return 0;
+        std::lock_guard<std::mutex> guard(file->writeLatch);
+        return file->freePages.size();
+    }
+
     unsigned FileHandle::getNumberOfPages() {
-        return numPages;
+        if (file == nullptr) return 0;
+        return file->numPages;
+    }
+
+    void FileHandle::setChecksumVerification(bool verifyChecksums) {
+        if (file == nullptr || file->checksums == nullptr) return;
+        file->verifyChecksums = verifyChecksums;
+    }
+
+    bool FileHandle::getChecksumVerification() {
+        return file != nullptr && file->checksums != nullptr && file->verifyChecksums;
     }
 
     RC FileHandle::collectCounterValues(unsigned &readPageCount, unsigned &writePageCount, unsigned &appendPageCount) {
@@ -163,16 +3115,40 @@ namespace PeterDB {
         return 0;
     }
 
+    RC FileHandle::collectCounterValues(unsigned &readPageCount, unsigned &writePageCount, unsigned &appendPageCount,
+                                        unsigned &hitCount, unsigned &missCount) {
+        collectCounterValues(readPageCount, writePageCount, appendPageCount);
+        hitCount = hitCounter;
+        missCount = missCounter;
+        return 0;
+    }
+
+    RC FileHandle::collectCounterValues(unsigned &readPageCount, unsigned &writePageCount, unsigned &appendPageCount,
+                                        unsigned &hitCount, unsigned &missCount, unsigned &checksumErrorCount) {
+        collectCounterValues(readPageCount, writePageCount, appendPageCount, hitCount, missCount);
+        checksumErrorCount = checksumErrorCounter;
+        return 0;
+    }
+
+    RC FileHandle::collectCounterValues(unsigned long long &readPageCount, unsigned long long &writePageCount,
+                                        unsigned long long &appendPageCount) {
+        readPageCount = readPageCounter;
+        writePageCount = writePageCounter;
+        appendPageCount = appendPageCounter;
+        return 0;
+    }
+
+    RC FileHandle::collectIOStatistics(IOStatistics &stats) {
+        if (file == nullptr) return -1;
+        file->ioStats.collect(stats);
+        return 0;
+    }
+
     void FileHandle::readHiddenPage() {
-        char* buffer = new char[PAGE_SIZE];
-        fileToBeHandled->seekg(0,std::ios::beg);
-        fileToBeHandled->read(buffer,4*sizeof(unsigned));
-
-        readPageCounter = ((unsigned*) buffer)[0];
-        writePageCounter = ((unsigned*) buffer)[1];
-        appendPageCounter = ((unsigned*) buffer)[2];
-        numPages = ((unsigned*) buffer)[3];
-        delete[] buffer;
+        // The open file already holds the hidden page, it is read from disk once per open descriptor
+        readPageCounter = file->readPageCounter;
+        writePageCounter = file->writePageCounter;
+        appendPageCounter = file->appendPageCounter;
 
         readPageCounter++;  // increment because hidden page is read
     }
@@ -180,15 +3156,47 @@ namespace PeterDB {
     void FileHandle::writeHiddenPage() {
         writePageCounter++; // increment because hidden page is written
 
-        unsigned* buffer = new unsigned[PAGE_SIZE/sizeof(unsigned)];
-        // buffer[0] = static_cast<char>(readPageCounter);
-        buffer[0] = readPageCounter;
-        buffer[1] = writePageCounter;
-        buffer[2] = appendPageCounter;
-        buffer[3] = numPages;
-        fileToBeHandled->seekp(0, std::ios::beg);
-        fileToBeHandled->write((char*) buffer, PAGE_SIZE);
-        delete[] buffer;
+        // Reaches the disk when the open file is synced or closed
+        file->readPageCounter = readPageCounter;
+        file->writePageCounter = writePageCounter;
+        file->appendPageCounter = appendPageCounter;
+        file->headerDirty = true;
+    }
+
+    RC FileHandle::readBlock(off_t offset, void* data) {
+        return readBlocks(offset, 1, data);
+    }
+
+    RC FileHandle::writeBlock(off_t offset, const void* data) {
+        return writeBlocks(offset, 1, data);
+    }
+
+    RC FileHandle::readBlocks(off_t offset, unsigned count, void* data) {
+        if (PagedFileManager::readBlocks(file, offset, count, data) != 0) return -1;
+        if (file->checksums == nullptr || !file->verifyChecksums) return 0;
+
+        // A page written while we read it may mismatch, read it once more before calling it corrupt
+        PageNum firstPageNum = offset / PAGE_SIZE - 1;
+        PageNum badPageNum;
+        while (file->checksums->verify(firstPageNum, count, data, badPageNum) > 0) {
+            char* page = (char*) data + (size_t) (badPageNum-firstPageNum)*PAGE_SIZE;
+            off_t pageOffset = (off_t) (1+badPageNum)*PAGE_SIZE;
+            PageNum checkedPageNum;
+            if (PagedFileManager::readBlocks(file, pageOffset, 1, page) != 0) return -1;
+            if (file->checksums->verify(badPageNum, 1, page, checkedPageNum) > 0) {
+                checksumErrorCounter++;
+                return -1;
+            }
+            // Pages before the bad one are fine, go on with the rest
+            count -= badPageNum - firstPageNum + 1;
+            data = page + PAGE_SIZE;
+            firstPageNum = badPageNum + 1;
+        }
+        return 0;
+    }
+
+    RC FileHandle::writeBlocks(off_t offset, unsigned count, const void* data) {
+        return PagedFileManager::writeBlocks(file, offset, count, data);
     }
 
 } // namespace PeterDB
\ No newline at end of file
@@ -61,7 +61,7 @@ namespace PeterDB {
         return -1; // targetAttrName does not match any of the attribute names
     }
 
-    void parseTuple(void* tupleBuffer, std::vector<Attribute> attrs, std::string conditionAttr, int &keyOffset, short &tupleLength) {
+    void parseTuple(void* tupleBuffer, std::vector<Attribute> attrs, std::string conditionAttr, int &keyOffset, PageOffset &tupleLength) {
         // read nullIndicator from tupleBuffer
         unsigned numAttrs = attrs.size();
         unsigned nullIndicatorSize = ceil((double) numAttrs/8);
@@ -95,7 +95,7 @@ namespace PeterDB {
         free(nullIndicator);
     }
 
-    void generateJoinedTuple(void* leftTuple, void* rightTuple, short leftTupleLength, short rightTupleLength,
+    void generateJoinedTuple(void* leftTuple, void* rightTuple, PageOffset leftTupleLength, PageOffset rightTupleLength,
                              std::vector<Attribute> leftAttrs, std::vector<Attribute> rightAttrs, void* data){
         // get leftNullIndicator from left tuple
         unsigned leftNullIndicatorSize = ceil((double) leftAttrs.size()/8);
@@ -437,7 +437,7 @@ namespace PeterDB {
             }
             // parse right tuple
             int keyOffset;
-            short rightTupleLength;
+            PageOffset rightTupleLength;
             parseTuple(rightTuple, rightAttrs, condition.rhsAttr, keyOffset, rightTupleLength);
 
             TupleInfo leftTupleInfo;
@@ -526,7 +526,7 @@ namespace PeterDB {
         while (leftIn->getNextTuple((char*) blockBuffer + offsetOnBlock) != RM_EOF){
             // parse tuple and build tupleInfo
             int keyOffset;
-            short tupleLength;
+            PageOffset tupleLength;
             parseTuple((char*) blockBuffer + offsetOnBlock, leftAttrs, condition.lhsAttr, keyOffset, tupleLength);
             TupleInfo tupleInfo;
             tupleInfo.offsetOnBlock = offsetOnBlock;
@@ -636,8 +636,8 @@ namespace PeterDB {
 
             // parse left and right tuples, then join together, return 0
             int dumKeyPtr;
-            short leftTupleLength;
-            short rightTupleLength;
+            PageOffset leftTupleLength;
+            PageOffset rightTupleLength;
             parseTuple(leftTuple, leftAttrs, condition.lhsAttr, dumKeyPtr, leftTupleLength);
             parseTuple(rightTuple, rightAttrs, condition.rhsAttr, dumKeyPtr, rightTupleLength);
 
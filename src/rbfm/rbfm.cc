@@ -21,8 +21,8 @@ namespace PeterDB {
         return pfm->destroyFile(fileName);
     }
 
-    RC RecordBasedFileManager::openFile(const std::string &fileName, FileHandle &fileHandle) {
-        return pfm->openFile(fileName,fileHandle);
+    RC RecordBasedFileManager::openFile(const std::string &fileName, FileHandle &fileHandle, FileOpenMode mode) {
+        return pfm->openFile(fileName, fileHandle, mode);
     }
 
     RC RecordBasedFileManager::closeFile(FileHandle &fileHandle) {
@@ -31,65 +31,112 @@ namespace PeterDB {
 
     RC RecordBasedFileManager::insertRecord(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor,
                                             const void* data, RID &rid) {
-        short recordLength = generateRecordLength(recordDescriptor, data);
+        PageOffset recordLength = generateRecordLength(recordDescriptor, data);
         //std::cout << "Inside insertRecord: Record length is " << recordLength << std::endl;
 
         void* recordBuffer = malloc(recordLength);
         generateRecord(recordDescriptor, data, recordBuffer);
 
+        // The free space map names a page with room, so only the map page and that page are read
         void* pageBuffer = malloc(PAGE_SIZE);
-        unsigned numPages = fileHandle.getNumberOfPages();
+        void* fsmBuffer = malloc(PAGE_SIZE);
+        int fsmPageNum = -1;
         unsigned pageToBeWritten = 0;
-        short recordOffset = 0;
-        //std::cout << "Inside insertRecord: pageNum is " << pageNum << std::endl;
-        bool recordInserted = false;
-        if (numPages > 0) {
-            pageToBeWritten = numPages-1; // ID of page to be written
-            fileHandle.readPage(pageToBeWritten, pageBuffer);
-            unsigned short freeBytes = getFreeBytes(pageBuffer);
-            short bytesNeeded = recordLength;
-            if (!hasEmptySlot(pageBuffer)) bytesNeeded = recordLength + REC_OFF_SIZE + REC_LEN_SIZE;
+        PageOffset recordOffset = 0;
+        RC errCode = placeRecord(fileHandle, recordBuffer, recordLength, pageBuffer, pageToBeWritten, recordOffset,
+                                 fsmBuffer, fsmPageNum);
+        free(recordBuffer);
+        if (errCode != 0) {
+            free(pageBuffer);
+            free(fsmBuffer);
+            return errCode;
+        }
+
+        rid.pageNum = pageToBeWritten;
+        rid.slotNum = reuseOrInsertSlot(recordOffset, recordLength, pageBuffer);
+
+        errCode = fileHandle.writePage(pageToBeWritten, pageBuffer);
+        if (errCode == 0) {
+            errCode = updateFreeSpaceMap(fileHandle, pageToBeWritten, getFreeSpaceClass(pageBuffer), fsmBuffer, fsmPageNum);
+        }
+        free(pageBuffer);
+        free(fsmBuffer);
+        return errCode;
+    }
+
+    RC RecordBasedFileManager::insertRecords(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor,
+                                             const std::vector<const void*> &batch, std::vector<RID> &rids,
+                                             float fillFactor) {
+        rids.clear();
+        if (fillFactor <= 0 || fillFactor > 1) return -1;
+        rids.reserve(batch.size());
+
+        // Records are formatted straight into one page image, each full page is appended with a single write
+        const unsigned usableBytes = PAGE_SIZE - N_SIZE - F_SIZE;
+        const unsigned targetBytes = usableBytes * fillFactor;
+        void* pageBuffer = malloc(PAGE_SIZE);
+        void* fsmBuffer = malloc(PAGE_SIZE);
+        int fsmPageNum = -1;
+        bool fsmDirty = false;
+        RC errCode = 0;
 
-            //std::cout << "Inside insertRecord(): (1) freeBytes: " << freeBytes << std::endl;
-            //std::cout << "Inside insertRecord(): (1) bytesNeeded: " << bytesNeeded << std::endl;
-            if (freeBytes >= bytesNeeded) {
-                recordInserted = insertRecordToPage(recordBuffer, recordOffset, recordLength, pageBuffer);
+        memset(pageBuffer, 0, PAGE_SIZE);
+        PageCount numSlots = 0;
+        unsigned usedBytes = 0;
+        size_t firstOnPage = 0;     // batch index of the first record on the page being built
+        for (size_t i = 0; i <= batch.size() && errCode == 0; i++) {
+            PageOffset recordLength = 0;
+            unsigned bytesNeeded = 0;
+            if (i < batch.size()) {
+                recordLength = generateRecordLength(recordDescriptor, batch[i]);
+                bytesNeeded = recordLength + REC_OFF_SIZE + REC_LEN_SIZE;
+                if (bytesNeeded > usableBytes) {
+                    errCode = -1;
+                    break;
+                }
             }
-            else {
-                for (pageToBeWritten = 0; pageToBeWritten < numPages-1; pageToBeWritten++) {
-                    fileHandle.readPage(pageToBeWritten, pageBuffer);
-                    freeBytes = getFreeBytes(pageBuffer);
-                    //std::cout << "Inside insertRecord(): (2) freeBytes: " << freeBytes << std::endl;
-                    //std::cout << "Inside insertRecord(): (2) bytesNeeded: " << bytesNeeded << std::endl;
-                    bytesNeeded = recordLength;
-                    if (!hasEmptySlot(pageBuffer)) bytesNeeded = recordLength + REC_OFF_SIZE + REC_LEN_SIZE;
-
-                    if (freeBytes >= bytesNeeded) {
-                        recordInserted = insertRecordToPage(recordBuffer, recordOffset, recordLength, pageBuffer);
-                        break;
-                    }
+
+            // Page is at its fill factor or the batch is done, an empty page always takes the next record
+            bool pageDone = i == batch.size() || (numSlots > 0 && usedBytes + bytesNeeded > targetBytes);
+            if (pageDone && numSlots > 0) {
+                setNumSlots(pageBuffer, numSlots);
+                setFreeBytes(pageBuffer, usableBytes - usedBytes);
+                unsigned pageNum;
+                errCode = appendRecordPage(fileHandle, pageBuffer, pageNum, fsmBuffer, fsmPageNum, fsmDirty);
+                if (errCode != 0) break;
+                for (size_t j = firstOnPage; j < i; j++) {
+                    RID rid;
+                    rid.pageNum = pageNum;
+                    rid.slotNum = j - firstOnPage;
+                    rids.push_back(rid);
                 }
+
+                memset(pageBuffer, 0, PAGE_SIZE);
+                numSlots = 0;
+                usedBytes = 0;
+                firstOnPage = i;
             }
+            if (i == batch.size()) break;
+
+            // Records are packed from the start of the page, in batch order
+            PageOffset recordOffset = usedBytes - numSlots*(REC_OFF_SIZE + REC_LEN_SIZE);
+            generateRecord(recordDescriptor, batch[i], (char*) pageBuffer + recordOffset);
+            setRecordOffset(pageBuffer, numSlots, recordOffset);
+            setRecordLength(pageBuffer, numSlots, recordLength);
+            numSlots++;
+            usedBytes += bytesNeeded;
         }
-        if (!recordInserted) {
-            initNewPage(recordBuffer, recordLength, pageBuffer);
-            fileHandle.appendPage(pageBuffer);
-            pageToBeWritten = numPages;
-        }
-        free(recordBuffer);
-
-        rid.pageNum = pageToBeWritten;
-        rid.slotNum = reuseOrInsertSlot(recordOffset, recordLength, pageBuffer);
 
-        fileHandle.writePage(pageToBeWritten, pageBuffer);
+        if (errCode == 0 && fsmDirty) errCode = fileHandle.writePage(fsmPageNum, fsmBuffer);
         free(pageBuffer);
-        return 0;
+        free(fsmBuffer);
+        return errCode;
     }
 
     RC RecordBasedFileManager::readRecord(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor,
                                           const RID &rid, void* data) {
         void* pageBuffer = malloc(PAGE_SIZE);
-        short recordOffset, recordLength;
+        PageOffset recordOffset, recordLength;
         RID newRid = rid;
         RC errCode = checkAndFindRecord(fileHandle, pageBuffer, recordOffset, recordLength, newRid);
         if (errCode != 0) {
@@ -103,8 +150,8 @@ namespace PeterDB {
 
         char* nullIndicator = new char[nullIndicatorSize];
         int attrOffPtr = recordOffset + NUM_ATTR_SIZE;
-        int attrCounter = 0;
-        for (int byteIndex = 0; byteIndex < nullIndicatorSize; byteIndex++) {
+        unsigned attrCounter = 0;
+        for (unsigned byteIndex = 0; byteIndex < nullIndicatorSize; byteIndex++) {
             char init = 0;
             for (int bitIndex = 0; bitIndex < 8 && attrCounter < numAttrs; bitIndex++) {
                 int attrOffset;
@@ -133,7 +180,7 @@ namespace PeterDB {
     RC RecordBasedFileManager::deleteRecord(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor,
                                             const RID &rid) {
         void* pageBuffer = malloc(PAGE_SIZE);
-        short recordOffset, recordLength;
+        PageOffset recordOffset, recordLength;
         RID newRid = rid;
         RC errCode = checkAndFindRecord(fileHandle, pageBuffer, recordOffset, recordLength, newRid);
         if (errCode != 0) {
@@ -141,22 +188,22 @@ namespace PeterDB {
             return errCode;
         }
 
-        // shift all records after
-        shiftRecord(pageBuffer, recordOffset, recordLength, -recordLength);
-
-        // label record as deleted
-        setRecordOffset(pageBuffer, newRid.slotNum, -1);
-        setRecordLength(pageBuffer, newRid.slotNum, 0);
-
-        // update freeBytes
-        unsigned short freeBytes = getFreeBytes(pageBuffer);
-        unsigned short newFreeBytes = freeBytes+recordLength;
-        setFreeBytes(pageBuffer, newFreeBytes);
+        removeRecord(pageBuffer, newRid.slotNum);
 
         // write page back to disk
         fileHandle.writePage(newRid.pageNum, pageBuffer);
+
+        // Nothing on the page can be reached any more, give it back to the file.
+        // A freed page is only handed out again by allocatePage, so the map must not offer it.
+        unsigned char spaceClass = getFreeSpaceClass(pageBuffer);
+        if (isPageDead(pageBuffer) && fileHandle.freePage(newRid.pageNum) == 0) spaceClass = 0;
         free(pageBuffer);
-        return 0;
+
+        void* fsmBuffer = malloc(PAGE_SIZE);
+        int fsmPageNum = -1;
+        errCode = updateFreeSpaceMap(fileHandle, newRid.pageNum, spaceClass, fsmBuffer, fsmPageNum);
+        free(fsmBuffer);
+        return errCode;
     }
 
     RC RecordBasedFileManager::printRecord(const std::vector<Attribute> &recordDescriptor, const void* data,
@@ -165,10 +212,10 @@ namespace PeterDB {
         unsigned nullIndicatorSize = ceil((double) numAttrs/8);
         auto * nullIndicator = (unsigned char*) malloc(nullIndicatorSize);
 
-        int attrCounter = 0;
+        unsigned attrCounter = 0;
         memcpy(nullIndicator, (char*) data, nullIndicatorSize);
         int attrPtr = nullIndicatorSize;
-        for (int byteIndex = 0; byteIndex < nullIndicatorSize; byteIndex++) {
+        for (unsigned byteIndex = 0; byteIndex < nullIndicatorSize; byteIndex++) {
             for (int bitIndex = 0; bitIndex < 8 && attrCounter < numAttrs; bitIndex++) {
                 bool NullBit = nullIndicator[byteIndex] & (short) 1 << (short) (7 - bitIndex);
                 Attribute attr = recordDescriptor[attrCounter];
@@ -211,7 +258,7 @@ namespace PeterDB {
     RC RecordBasedFileManager::updateRecord(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor,
                                             const void* data, const RID &rid) {
         void* pageBuffer = malloc(PAGE_SIZE);
-        short recordOffset, recordLength;
+        PageOffset recordOffset, recordLength;
         RID newRid = rid;
         RC errCode = checkAndFindRecord(fileHandle, pageBuffer, recordOffset, recordLength, newRid);
         if (errCode != 0) {
@@ -219,14 +266,16 @@ namespace PeterDB {
             return errCode;
         }
 
-        short newRecordLength = generateRecordLength(recordDescriptor, data);
-        short distance = newRecordLength - recordLength;
-        unsigned short freeBytes = getFreeBytes(pageBuffer);
-        unsigned short newFreeBytes = freeBytes - distance;
+        PageOffset newRecordLength = generateRecordLength(recordDescriptor, data);
+        PageOffset distance = newRecordLength - recordLength;
+        PageCount freeBytes = getFreeBytes(pageBuffer);
+        PageCount newFreeBytes = freeBytes - distance;
         void* newRecordBuffer = malloc(newRecordLength);
         generateRecord(recordDescriptor, data,newRecordBuffer);
-        // record can stay in current page
-        if (freeBytes >= distance){
+        void* fsmBuffer = malloc(PAGE_SIZE);
+        int fsmPageNum = -1;
+        // record can stay in current page, compared as int because distance is negative when it shrinks
+        if ((int) freeBytes >= distance){
             shiftRecord(pageBuffer, recordOffset, recordLength, distance);
             memcpy((char*) pageBuffer+recordOffset, newRecordBuffer, newRecordLength);
             setFreeBytes(pageBuffer, newFreeBytes);
@@ -235,33 +284,30 @@ namespace PeterDB {
         // record must be moved to another page
         else{
             void* newPageBuffer = malloc(PAGE_SIZE);
-            unsigned numPages = fileHandle.getNumberOfPages();
             unsigned pageToBeUpdated = 0;
-            short newRecordOffset = 0;
-            bool recordUpdated = false;
-            if (numPages > 1) {
-                for (pageToBeUpdated = 0; pageToBeUpdated < numPages; pageToBeUpdated++){
-                    fileHandle.readPage(pageToBeUpdated, newPageBuffer);
-                    unsigned short curFreeBytes = getFreeBytes(newPageBuffer);
-                    short bytesNeeded = newRecordLength;
-                    if (!hasEmptySlot(newPageBuffer)) bytesNeeded = newRecordLength + REC_OFF_SIZE + REC_LEN_SIZE;
-
-                    if (curFreeBytes >= bytesNeeded){
-                        recordUpdated = insertRecordToPage(newRecordBuffer, newRecordOffset, newRecordLength, newPageBuffer);
-                        break;
-                    }
-                }
-            }
-            if(!recordUpdated){
-                initNewPage(newRecordBuffer, newRecordLength, newPageBuffer);
-                fileHandle.appendPage(newPageBuffer);
-                pageToBeUpdated = numPages;
+            PageOffset newRecordOffset = 0;
+            errCode = placeRecord(fileHandle, newRecordBuffer, newRecordLength, newPageBuffer, pageToBeUpdated,
+                                  newRecordOffset, fsmBuffer, fsmPageNum);
+            if (errCode != 0) {
+                free(newPageBuffer);
+                free(newRecordBuffer);
+                free(fsmBuffer);
+                free(pageBuffer);
+                return errCode;
             }
 
             unsigned newPageNum = pageToBeUpdated;
             unsigned short newSlotNum = reuseOrInsertSlot(newRecordOffset, newRecordLength, newPageBuffer);
             fileHandle.writePage(pageToBeUpdated, newPageBuffer);
+            errCode = updateFreeSpaceMap(fileHandle, pageToBeUpdated, getFreeSpaceClass(newPageBuffer),
+                                         fsmBuffer, fsmPageNum);
             free(newPageBuffer);
+            if (errCode != 0) {
+                free(newRecordBuffer);
+                free(fsmBuffer);
+                free(pageBuffer);
+                return errCode;
+            }
 
             // set the original page (pageBuffer)
             shiftRecord(pageBuffer, recordOffset, recordLength, PTR_PN_SIZE+PTR_SN_SIZE-recordLength);
@@ -275,14 +321,16 @@ namespace PeterDB {
         }
         free(newRecordBuffer);
         fileHandle.writePage(newRid.pageNum, pageBuffer);
+        errCode = updateFreeSpaceMap(fileHandle, newRid.pageNum, getFreeSpaceClass(pageBuffer), fsmBuffer, fsmPageNum);
+        free(fsmBuffer);
         free(pageBuffer);
-        return 0;
+        return errCode;
     }
 
     RC RecordBasedFileManager::readAttribute(FileHandle &fileHandle, const std::vector<Attribute> &recordDescriptor,
                                              const RID &rid, const std::string &attributeName, void* data) {
         void* pageBuffer = malloc(PAGE_SIZE);
-        short recordOffset, recordLength;
+        PageOffset recordOffset, recordLength;
         RID newRid = rid;
         RC errCode = checkAndFindRecord(fileHandle, pageBuffer, recordOffset, recordLength, newRid);
         if (errCode != 0) {
@@ -336,60 +384,167 @@ namespace PeterDB {
                                             compOp, value, attributeNames, this);
     }
 
+    RC RecordBasedFileManager::scan(const std::vector<Attribute> &recordDescriptor,
+                                    const std::vector<ScanCondition> &conditions,
+                                    const std::vector<std::string> &attributeNames,
+                                    RBFM_ScanIterator &rbfm_ScanIterator, bool anyCondition) {
+        return rbfm_ScanIterator.initialize(recordDescriptor, conditions, anyCondition, attributeNames, this);
+    }
+
+    RC RecordBasedFileManager::parallelScan(const std::string &fileName, const std::vector<Attribute> &recordDescriptor,
+                                            const std::vector<ScanCondition> &conditions,
+                                            const std::vector<std::string> &attributeNames, unsigned numPartitions,
+                                            const ScanConsumer &consumer, bool anyCondition) {
+        if (numPartitions == 0) numPartitions = std::max(1u, std::thread::hardware_concurrency());
+
+        // Projected record size when VarChars keep to their declared length
+        size_t maxRecordSize = (attributeNames.size() + 7) / 8;
+        for (const std::string &attributeName : attributeNames) {
+            for (const Attribute &attr : recordDescriptor) {
+                if (attr.name != attributeName) continue;
+                maxRecordSize += attr.type == TypeVarChar ? VC_LEN_SIZE + attr.length : INT_OR_FLT_SIZE;
+                break;
+            }
+        }
+
+        FileHandle fileHandle;
+        RC errCode = openFile(fileName, fileHandle);
+        if (errCode != 0) return errCode;
+        unsigned numPages = fileHandle.getNumberOfPages();
+        numPartitions = std::max(1u, std::min(numPartitions, numPages));
+
+        // Each partition is a disjoint page range with its own iterator and file handle.
+        // A moved record is returned from the page it lives on, so every record belongs to exactly one range.
+        std::atomic<bool> stopped(false);
+        std::vector<RC> results(numPartitions, 0);
+        std::vector<std::thread> workers;
+        for (unsigned partition = 0; partition < numPartitions; partition++) {
+            unsigned firstPageNum = (unsigned long long) numPages * partition / numPartitions;
+            unsigned endPageNum = (unsigned long long) numPages * (partition + 1) / numPartitions;
+            workers.emplace_back([&, partition, firstPageNum, endPageNum]() {
+                RBFM_ScanIterator iterator;
+                RC result = iterator.initialize(recordDescriptor, conditions, anyCondition, attributeNames, this);
+                if (result == 0) result = openFile(fileName, iterator.fileHandle);
+                if (result != 0) {
+                    stopped = true;
+                    results[partition] = result;
+                    return;
+                }
+                iterator.setPageRange(firstPageNum, endPageNum);
+
+                std::vector<char> data(maxRecordSize);
+                RID rid;
+                unsigned count;
+                while (!stopped) {
+                    result = iterator.getNextBatch(&rid, data.data(), data.size(), 1, count);
+                    if (result == RBFM_EOF) {
+                        result = 0;
+                        break;
+                    }
+                    // a VarChar longer than its declared length, the record is fetched again
+                    if (result == RBFM_BUFFER_TOO_SMALL) {
+                        data.resize(2 * data.size());
+                        continue;
+                    }
+                    if (result == 0) result = consumer(partition, rid, data.data());
+                    if (result != 0) {
+                        stopped = true;
+                        break;
+                    }
+                }
+                iterator.close();
+                if (closeFile(iterator.fileHandle) != 0 && result == 0) result = -1;
+                results[partition] = result;
+            });
+        }
+        for (std::thread &worker : workers) worker.join();
+
+        errCode = closeFile(fileHandle);
+        for (RC result : results) {
+            if (result != 0) return result;
+        }
+        return errCode;
+    }
+
+    RC RecordBasedFileManager::vacuum(FileHandle &fileHandle, unsigned &pageNum, unsigned maxPages) {
+        VacuumStatistics stats;
+        return vacuum(fileHandle, pageNum, maxPages, stats);
+    }
+
+    RC RecordBasedFileManager::vacuum(FileHandle &fileHandle, unsigned &pageNum, unsigned maxPages,
+                                      VacuumStatistics &stats) {
+        stats = VacuumStatistics();
+        void* fsmBuffer = malloc(PAGE_SIZE);
+        int fsmPageNum = -1;
+        RC errCode = 0;
+        for (unsigned numVacuumed = 0; numVacuumed < maxPages && pageNum < fileHandle.getNumberOfPages(); pageNum++) {
+            if (fileHandle.isPageFree(pageNum) || isFreeSpaceMapPage(pageNum)) continue;
+            errCode = vacuumPage(fileHandle, pageNum, fsmBuffer, fsmPageNum, stats);
+            if (errCode != 0) break;
+            numVacuumed++;
+        }
+        free(fsmBuffer);
+        return errCode;
+    }
+
     /*********************************************/
     /*****    Getter and Setter functions  *******/
     /*********************************************/
-    unsigned short RecordBasedFileManager::getNumSlots(void* pageBuffer) {
-        unsigned short numSlots;
+    PageCount RecordBasedFileManager::getNumSlots(void* pageBuffer) {
+        PageCount numSlots;
         memcpy(&numSlots, (char*) pageBuffer+PAGE_SIZE-N_SIZE-F_SIZE, N_SIZE);
         return numSlots;
     }
 
-    unsigned short RecordBasedFileManager::getFreeBytes(void* pageBuffer) {
-        unsigned short freeBytes;
+    PageCount RecordBasedFileManager::getFreeBytes(void* pageBuffer) {
+        PageCount freeBytes;
         memcpy(&freeBytes, (char*) pageBuffer+PAGE_SIZE-F_SIZE, F_SIZE);
         return freeBytes;
     }
 
-    short RecordBasedFileManager::getRecordLength(void* pageBuffer, unsigned short slotNum) {
-        short recordLength;
-        memcpy(&recordLength, (char*) pageBuffer+PAGE_SIZE-(3+2*slotNum)*sizeof(short), REC_LEN_SIZE);
+    PageOffset RecordBasedFileManager::getRecordLength(void* pageBuffer, unsigned short slotNum) {
+        PageOffset recordLength;
+        memcpy(&recordLength, (char*) pageBuffer+PAGE_SIZE-N_SIZE-F_SIZE-slotNum*(REC_OFF_SIZE+REC_LEN_SIZE)-REC_LEN_SIZE, REC_LEN_SIZE);
         return recordLength;
     }
 
-    short RecordBasedFileManager::getRecordOffset(void* pageBuffer, unsigned short slotNum) {
-        short recordOffset;
-        memcpy(&recordOffset, (char*) pageBuffer+PAGE_SIZE-(4+2*slotNum)*sizeof(short), REC_OFF_SIZE);
+    PageOffset RecordBasedFileManager::getRecordOffset(void* pageBuffer, unsigned short slotNum) {
+        PageOffset recordOffset;
+        memcpy(&recordOffset, (char*) pageBuffer+PAGE_SIZE-N_SIZE-F_SIZE-(slotNum+1)*(REC_OFF_SIZE+REC_LEN_SIZE), REC_OFF_SIZE);
         return recordOffset;
     }
 
-    void RecordBasedFileManager::setNumSlots(void* pageBuffer, unsigned short numSlots) {
+    void RecordBasedFileManager::setNumSlots(void* pageBuffer, PageCount numSlots) {
         memcpy((char*) pageBuffer+PAGE_SIZE-N_SIZE-F_SIZE, &numSlots, N_SIZE);
     }
 
-    void RecordBasedFileManager::setFreeBytes(void* pageBuffer, unsigned short freeBytes) {
+    void RecordBasedFileManager::setFreeBytes(void* pageBuffer, PageCount freeBytes) {
         memcpy((char*) pageBuffer+PAGE_SIZE-F_SIZE, &freeBytes, F_SIZE);
     }
 
-    void RecordBasedFileManager::setRecordLength(void* pageBuffer, unsigned short slotNum, short recordLength) {
-        memcpy((char*) pageBuffer+PAGE_SIZE-(3+2*slotNum)*sizeof(short), &recordLength, REC_LEN_SIZE);
+    void RecordBasedFileManager::setRecordLength(void* pageBuffer, unsigned short slotNum, PageOffset recordLength) {
+        memcpy((char*) pageBuffer+PAGE_SIZE-N_SIZE-F_SIZE-slotNum*(REC_OFF_SIZE+REC_LEN_SIZE)-REC_LEN_SIZE, &recordLength, REC_LEN_SIZE);
+    }
+
+    void RecordBasedFileManager::setRecordOffset(void* pageBuffer, unsigned short slotNum, PageOffset recordOffset) {
+        memcpy((char*) pageBuffer+PAGE_SIZE-N_SIZE-F_SIZE-(slotNum+1)*(REC_OFF_SIZE+REC_LEN_SIZE), &recordOffset, REC_OFF_SIZE);
     }
 
-    void RecordBasedFileManager::setRecordOffset(void* pageBuffer, unsigned short slotNum, short recordOffset) {
-        memcpy((char*) pageBuffer+PAGE_SIZE-(4+2*slotNum)*sizeof(short), &recordOffset, REC_OFF_SIZE);
+    bool RecordBasedFileManager::isFreeSpaceMapPage(unsigned pageNum) {
+        return pageNum % (FSM_PAGE_SPAN + 1) == 0;
     }
 
     /**********************************/
     /*****    Helper functions  *******/
     /**********************************/
-    short RecordBasedFileManager::generateRecordLength(const std::vector<Attribute> &recordDescriptor, const void* data) {
+    PageOffset RecordBasedFileManager::generateRecordLength(const std::vector<Attribute> &recordDescriptor, const void* data) {
         // Get nullIndicator
         const unsigned numAttrs = recordDescriptor.size();
         int nullIndicatorSize = ceil(((double) numAttrs)/8);
         char* nullIndicatorBuffer = new char[nullIndicatorSize];
         memcpy(nullIndicatorBuffer, data, nullIndicatorSize);
 
-        short recordLength = NUM_ATTR_SIZE;
+        PageOffset recordLength = NUM_ATTR_SIZE;
         char* attrPtr = (char*) data + nullIndicatorSize;
         unsigned attrCounter = 0;
         for (int byteIndex = 0; byteIndex < nullIndicatorSize; byteIndex++) {
@@ -510,12 +665,12 @@ namespace PeterDB {
         delete[] nullIndicatorBuffer;
     }
 
-    short RecordBasedFileManager::getInsertStartOffset(void* pageBuffer) {
-        unsigned short numSlots = getNumSlots(pageBuffer);
+    PageOffset RecordBasedFileManager::getInsertStartOffset(void* pageBuffer) {
+        PageCount numSlots = getNumSlots(pageBuffer);
 
-        short currRecordOffset;
-        short maxRecordOffset = 0;
-        short recordLenWithMaxOffset = 0;
+        PageOffset currRecordOffset;
+        PageOffset maxRecordOffset = 0;
+        PageOffset recordLenWithMaxOffset = 0;
 
         // find maxRecordOffset and its record length
         for (unsigned short slotNum = 0; slotNum < numSlots; slotNum++) {
@@ -532,8 +687,8 @@ namespace PeterDB {
     }
 
     bool RecordBasedFileManager::hasEmptySlot(void* pageBuffer) {
-        unsigned short numSlots = getNumSlots(pageBuffer);
-        short currRecordOffset;
+        PageCount numSlots = getNumSlots(pageBuffer);
+        PageOffset currRecordOffset;
         for (unsigned short slotNum = 0; slotNum < numSlots; slotNum++) {
             currRecordOffset = getRecordOffset(pageBuffer, slotNum);
             if (currRecordOffset == -1) return true;
@@ -541,30 +696,39 @@ namespace PeterDB {
         return false;
     }
 
+    bool RecordBasedFileManager::isPageDead(void* pageBuffer) {
+        // Deleted slots only, forwarding pointers still lead to records
+        PageCount numSlots = getNumSlots(pageBuffer);
+        for (unsigned short slotNum = 0; slotNum < numSlots; slotNum++) {
+            if (getRecordOffset(pageBuffer, slotNum) != -1) return false;
+        }
+        return true;
+    }
+
     void RecordBasedFileManager::initNewPage(void* recordBuffer, unsigned recordLength, void* pageBuffer) {
         memset(pageBuffer, 0, PAGE_SIZE);
         memcpy(pageBuffer, recordBuffer, recordLength);
-        unsigned short freeBytes = PAGE_SIZE-recordLength-N_SIZE-F_SIZE;
-        unsigned short numSlots = 0;
+        PageCount freeBytes = PAGE_SIZE-recordLength-N_SIZE-F_SIZE;
+        PageCount numSlots = 0;
         setNumSlots(pageBuffer, numSlots);
         setFreeBytes(pageBuffer, freeBytes);
     }
 
-    bool RecordBasedFileManager::insertRecordToPage(void* recordBuffer, short& recordOffset, short recordLength, void* pageBuffer) {
+    bool RecordBasedFileManager::insertRecordToPage(void* recordBuffer, PageOffset& recordOffset, PageOffset recordLength, void* pageBuffer) {
         recordOffset = getInsertStartOffset(pageBuffer);
         memcpy((char*) pageBuffer+recordOffset, recordBuffer, recordLength);
 
         // set new freeBytes
-        unsigned short newFreeBytes = getFreeBytes(pageBuffer)-recordLength;
+        PageCount newFreeBytes = getFreeBytes(pageBuffer)-recordLength;
         setFreeBytes(pageBuffer, newFreeBytes);
         return true;
     }
 
-    unsigned short RecordBasedFileManager::reuseOrInsertSlot(short recordOffset, short recordLength, void* pageBuffer) {
-        unsigned short numSlots = getNumSlots(pageBuffer);
+    PageCount RecordBasedFileManager::reuseOrInsertSlot(PageOffset recordOffset, PageOffset recordLength, void* pageBuffer) {
+        PageCount numSlots = getNumSlots(pageBuffer);
 
         if (numSlots != 0) {
-            short currRecordOffset;
+            PageOffset currRecordOffset;
             // find maxRecordOffset and its record length
             for (unsigned short slotNum = 0; slotNum < numSlots; slotNum++) {
                 currRecordOffset = getRecordOffset(pageBuffer, slotNum);
@@ -583,19 +747,19 @@ namespace PeterDB {
         setRecordLength(pageBuffer, numSlots, recordLength);
 
         // set new numSlots and freeBytes
-        unsigned short newNumSlots = numSlots + 1;
-        unsigned short newFreeBytes = getFreeBytes(pageBuffer)-REC_OFF_SIZE-REC_LEN_SIZE;
+        PageCount newNumSlots = numSlots + 1;
+        PageCount newFreeBytes = getFreeBytes(pageBuffer)-REC_OFF_SIZE-REC_LEN_SIZE;
         setNumSlots(pageBuffer, newNumSlots);
         setFreeBytes(pageBuffer, newFreeBytes);
         return newNumSlots-1;
     }
 
-    void RecordBasedFileManager::shiftRecord(void* pageBuffer, short recordOffset, short recordLength, short distance) {
+    void RecordBasedFileManager::shiftRecord(void* pageBuffer, PageOffset recordOffset, PageOffset recordLength, PageOffset distance) {
         // Negative distance means shift left; positive distance means shift right
-        unsigned short numSlots = getNumSlots(pageBuffer);
-        unsigned short sizeToBeShifted = 0;
-        short currRecordOffset;
-        short currRecordLength;
+        PageCount numSlots = getNumSlots(pageBuffer);
+        PageCount sizeToBeShifted = 0;
+        PageOffset currRecordOffset;
+        PageOffset currRecordLength;
         for (unsigned short slotNum = 0; slotNum < numSlots; slotNum++) {
             currRecordOffset = getRecordOffset(pageBuffer, slotNum);
             if (currRecordOffset > recordOffset) {
@@ -615,17 +779,17 @@ namespace PeterDB {
     }
 
     RC RecordBasedFileManager::checkAndFindRecord(FileHandle &fileHandle, void* pageBuffer,
-                                                  short &recordOffset, short &recordLength, RID &rid) {
+                                                  PageOffset &recordOffset, PageOffset &recordLength, RID &rid) {
         // validate pageNum
         unsigned numPages = fileHandle.getNumberOfPages();
         //std::cout<<"inside checkAndFindRecord rid.pageNum is "<<rid.pageNum<<std::endl;
         //std::cout<<"inside checkAndFindRecord numPages is "<<numPages<<std::endl;
-        if (rid.pageNum >= numPages) return -1;
+        if (rid.pageNum >= numPages || isFreeSpaceMapPage(rid.pageNum)) return -1;
 
         fileHandle.readPage(rid.pageNum, pageBuffer);
 
         // validate slotNum
-        unsigned short numSlots = getNumSlots(pageBuffer);
+        PageCount numSlots = getNumSlots(pageBuffer);
         //std::cout<<"inside checkAndFindRecord rid.slotNum is "<<rid.slotNum<<std::endl;
         //std::cout<<"inside checkAndFindRecord numSlots is "<<numSlots<<std::endl;
         if (rid.slotNum >= numSlots) return -1;
@@ -634,7 +798,7 @@ namespace PeterDB {
     }
 
     RC RecordBasedFileManager::findRecord(FileHandle &fileHandle, void* pageBuffer,
-                                            short &recordOffset, short &recordLength, RID &rid) {
+                                            PageOffset &recordOffset, PageOffset &recordLength, RID &rid) {
         // get record offset. If is -1, record is already deleted.
         recordOffset = getRecordOffset(pageBuffer, rid.slotNum);
         if (recordOffset == -1) return -1;
@@ -661,22 +825,335 @@ namespace PeterDB {
         return 0;
     }
 
+    unsigned char RecordBasedFileManager::getFreeSpaceClass(void* pageBuffer) {
+        // Bytes a new record can use, a new slot has to come out of them when no slot is free
+        unsigned available = getFreeBytes(pageBuffer);
+        if (!hasEmptySlot(pageBuffer)) {
+            if (available < REC_OFF_SIZE + REC_LEN_SIZE) return 0;
+            available -= REC_OFF_SIZE + REC_LEN_SIZE;
+        }
+        unsigned spaceClass = available / FSM_CLASS_BYTES;
+        return spaceClass < FSM_NUM_CLASSES ? spaceClass : FSM_NUM_CLASSES - 1;
+    }
+
+    RC RecordBasedFileManager::findPageWithSpace(FileHandle &fileHandle, PageOffset recordLength, unsigned &pageNum,
+                                                 void* fsmBuffer, int &fsmPageNum) {
+        unsigned numPages = fileHandle.getNumberOfPages();
+        if (numPages <= 1) return -1;
+        unsigned neededClass = (recordLength + FSM_CLASS_BYTES - 1) / FSM_CLASS_BYTES;
+        if (neededClass >= FSM_NUM_CLASSES) return -1;
+
+        // Newest map page first, it covers the pages most likely to have room
+        unsigned lastPageNum = numPages - 1;
+        int mapPageNum = lastPageNum - lastPageNum % (FSM_PAGE_SPAN + 1);
+        for (; mapPageNum >= 0; mapPageNum -= FSM_PAGE_SPAN + 1) {
+            if (fsmPageNum != mapPageNum) {
+                if (fileHandle.readPage(mapPageNum, fsmBuffer) != 0) return -1;
+                fsmPageNum = mapPageNum;
+            }
+            unsigned numEntries = std::min<unsigned>(FSM_PAGE_SPAN, lastPageNum - mapPageNum);
+            auto* entries = (unsigned char*) fsmBuffer;
+            for (unsigned entry = 0; entry < numEntries; entry++) {
+                unsigned bitOffset = entry * FSM_CLASS_BITS;
+                // a zero byte holds only full pages
+                if (bitOffset % 8 == 0 && entries[bitOffset / 8] == 0) {
+                    entry += 8 / FSM_CLASS_BITS - 1;
+                    continue;
+                }
+                unsigned spaceClass = (entries[bitOffset / 8] >> (bitOffset % 8)) & (FSM_NUM_CLASSES - 1);
+                if (spaceClass < neededClass) continue;
+                if (fileHandle.isPageFree(mapPageNum + 1 + entry)) continue;
+                pageNum = mapPageNum + 1 + entry;
+                return 0;
+            }
+        }
+        return -1;
+    }
+
+    RC RecordBasedFileManager::updateFreeSpaceMap(FileHandle &fileHandle, unsigned pageNum, unsigned char spaceClass,
+                                                  void* fsmBuffer, int &fsmPageNum) {
+        int mapPageNum = pageNum - pageNum % (FSM_PAGE_SPAN + 1);
+        if (fsmPageNum != mapPageNum) {
+            if (fileHandle.readPage(mapPageNum, fsmBuffer) != 0) return -1;
+            fsmPageNum = mapPageNum;
+        }
+
+        // most inserts leave the class unchanged, the map page is then not written at all
+        if (!setFreeSpaceEntry(fsmBuffer, pageNum, spaceClass)) return 0;
+        return fileHandle.writePage(mapPageNum, fsmBuffer);
+    }
+
+    bool RecordBasedFileManager::setFreeSpaceEntry(void* fsmBuffer, unsigned pageNum, unsigned char spaceClass) {
+        unsigned bitOffset = (pageNum % (FSM_PAGE_SPAN + 1) - 1) * FSM_CLASS_BITS;
+        unsigned char &entries = ((unsigned char*) fsmBuffer)[bitOffset / 8];
+        unsigned char newEntries = (entries & ~((FSM_NUM_CLASSES - 1) << (bitOffset % 8))) | (spaceClass << (bitOffset % 8));
+        if (newEntries == entries) return false;
+        entries = newEntries;
+        return true;
+    }
+
+    RC RecordBasedFileManager::appendRecordPage(FileHandle &fileHandle, void* pageBuffer, unsigned &pageNum,
+                                                void* fsmBuffer, int &fsmPageNum, bool &fsmDirty) {
+        // The map page is written once when the load moves past it, not once per appended page
+        pageNum = fileHandle.getNumberOfPages();
+        int mapPageNum = pageNum - pageNum % (FSM_PAGE_SPAN + 1);
+        if (fsmPageNum != mapPageNum) {
+            if (fsmDirty && fileHandle.writePage(fsmPageNum, fsmBuffer) != 0) return -1;
+            fsmDirty = false;
+            if (isFreeSpaceMapPage(pageNum)) {
+                memset(fsmBuffer, 0, PAGE_SIZE);
+                if (fileHandle.appendPage(fsmBuffer) != 0) return -1;
+                pageNum++;
+            }
+            else if (fileHandle.readPage(mapPageNum, fsmBuffer) != 0) return -1;
+            fsmPageNum = mapPageNum;
+        }
+
+        if (fileHandle.appendPage(pageBuffer) != 0) return -1;
+        if (setFreeSpaceEntry(fsmBuffer, pageNum, getFreeSpaceClass(pageBuffer))) fsmDirty = true;
+        return 0;
+    }
+
+    RC RecordBasedFileManager::allocateRecordPage(FileHandle &fileHandle, void* pageBuffer, unsigned &pageNum) {
+        // Growing the file onto a map page position appends an empty map page first
+        if (fileHandle.getNumberOfFreePages() == 0 && isFreeSpaceMapPage(fileHandle.getNumberOfPages())) {
+            void* fsmBuffer = calloc(1, PAGE_SIZE);
+            RC errCode = fileHandle.appendPage(fsmBuffer);
+            free(fsmBuffer);
+            if (errCode != 0) return errCode;
+        }
+        return fileHandle.allocatePage(pageBuffer, pageNum);
+    }
+
+    RC RecordBasedFileManager::placeRecord(FileHandle &fileHandle, void* recordBuffer, PageOffset recordLength,
+                                           void* pageBuffer, unsigned &pageNum, PageOffset &recordOffset,
+                                           void* fsmBuffer, int &fsmPageNum) {
+        // The map only promises a class, the page itself has the final say.
+        // A stale entry is corrected and the search goes on, it will not name that page again.
+        while (findPageWithSpace(fileHandle, recordLength, pageNum, fsmBuffer, fsmPageNum) == 0) {
+            if (fileHandle.readPage(pageNum, pageBuffer) != 0) return -1;
+            PageOffset bytesNeeded = recordLength;
+            if (!hasEmptySlot(pageBuffer)) bytesNeeded = recordLength + REC_OFF_SIZE + REC_LEN_SIZE;
+            if (getFreeBytes(pageBuffer) >= bytesNeeded) {
+                insertRecordToPage(recordBuffer, recordOffset, recordLength, pageBuffer);
+                return 0;
+            }
+            if (updateFreeSpaceMap(fileHandle, pageNum, getFreeSpaceClass(pageBuffer), fsmBuffer, fsmPageNum) != 0) {
+                return -1;
+            }
+        }
+
+        // No page has room, reuse a freed page before growing the file
+        recordOffset = 0;
+        initNewPage(recordBuffer, recordLength, pageBuffer);
+        return allocateRecordPage(fileHandle, pageBuffer, pageNum);
+    }
+
+    void RecordBasedFileManager::removeRecord(void* pageBuffer, unsigned short slotNum) {
+        PageOffset recordOffset = getRecordOffset(pageBuffer, slotNum);
+        PageOffset recordLength = getRecordLength(pageBuffer, slotNum);
+        if (recordLength == -1) recordLength = PTR_PN_SIZE + PTR_SN_SIZE;
+
+        // shift all records after
+        shiftRecord(pageBuffer, recordOffset, recordLength, -recordLength);
+
+        // label record as deleted
+        setRecordOffset(pageBuffer, slotNum, -1);
+        setRecordLength(pageBuffer, slotNum, 0);
+
+        // update freeBytes
+        setFreeBytes(pageBuffer, getFreeBytes(pageBuffer) + recordLength);
+    }
+
+    PageCount RecordBasedFileManager::trimDeadSlots(void* pageBuffer) {
+        // Only the tail of the directory can go, earlier slot numbers must keep their place
+        PageCount numSlots = getNumSlots(pageBuffer);
+        PageCount numTrimmed = 0;
+        while (numSlots > 0 && getRecordOffset(pageBuffer, numSlots - 1) == -1) {
+            numSlots--;
+            numTrimmed++;
+        }
+        setNumSlots(pageBuffer, numSlots);
+        setFreeBytes(pageBuffer, getFreeBytes(pageBuffer) + numTrimmed*(REC_OFF_SIZE + REC_LEN_SIZE));
+        return numTrimmed;
+    }
+
+    RC RecordBasedFileManager::writeVacuumedPage(FileHandle &fileHandle, unsigned pageNum, void* pageBuffer,
+                                                 void* fsmBuffer, int &fsmPageNum, VacuumStatistics &stats) {
+        if (fileHandle.writePage(pageNum, pageBuffer) != 0) return -1;
+        unsigned char spaceClass = getFreeSpaceClass(pageBuffer);
+        if (isPageDead(pageBuffer) && fileHandle.freePage(pageNum) == 0) {
+            spaceClass = 0;
+            stats.pagesFreed++;
+        }
+        return updateFreeSpaceMap(fileHandle, pageNum, spaceClass, fsmBuffer, fsmPageNum);
+    }
+
+    RC RecordBasedFileManager::removeSlot(FileHandle &fileHandle, const RID &rid, void* fsmBuffer, int &fsmPageNum,
+                                          VacuumStatistics &stats) {
+        void* pageBuffer = malloc(PAGE_SIZE);
+        RC errCode = fileHandle.readPage(rid.pageNum, pageBuffer);
+        if (errCode == 0) {
+            removeRecord(pageBuffer, rid.slotNum);
+            errCode = writeVacuumedPage(fileHandle, rid.pageNum, pageBuffer, fsmBuffer, fsmPageNum, stats);
+        }
+        free(pageBuffer);
+        return errCode;
+    }
+
+    RC RecordBasedFileManager::vacuumPage(FileHandle &fileHandle, unsigned pageNum, void* fsmBuffer, int &fsmPageNum,
+                                          VacuumStatistics &stats) {
+        void* pageBuffer = malloc(PAGE_SIZE);
+        RC errCode = fileHandle.readPage(pageNum, pageBuffer);
+        PageCount numSlots = errCode == 0 ? getNumSlots(pageBuffer) : 0;
+        for (unsigned short slotNum = 0; slotNum < numSlots && errCode == 0; slotNum++) {
+            if (fileHandle.isPageFree(pageNum)) break;
+            if (getRecordOffset(pageBuffer, slotNum) == -1 || getRecordLength(pageBuffer, slotNum) != -1) continue;
+            // the chain touches other pages and maybe this one, it works on the file, so reload afterwards
+            errCode = collapseForwarding(fileHandle, pageNum, slotNum, fsmBuffer, fsmPageNum, stats);
+            if (errCode == 0) errCode = fileHandle.readPage(pageNum, pageBuffer);
+        }
+
+        if (errCode == 0 && !fileHandle.isPageFree(pageNum)) {
+            PageCount numTrimmed = trimDeadSlots(pageBuffer);
+            if (numTrimmed > 0) {
+                stats.slotsReclaimed += numTrimmed;
+                errCode = writeVacuumedPage(fileHandle, pageNum, pageBuffer, fsmBuffer, fsmPageNum, stats);
+            }
+        }
+        free(pageBuffer);
+        return errCode;
+    }
+
+    RC RecordBasedFileManager::collapseForwarding(FileHandle &fileHandle, unsigned pageNum, unsigned short slotNum,
+                                                  void* fsmBuffer, int &fsmPageNum, VacuumStatistics &stats) {
+        void* homeBuffer = malloc(PAGE_SIZE);
+        void* hopBuffer = malloc(PAGE_SIZE);
+        void* recordBuffer = nullptr;
+        RC errCode = fileHandle.readPage(pageNum, homeBuffer);
+
+        // Follow the chain, the stubs on the way are only reachable through this one
+        PageOffset stubOffset = getRecordOffset(homeBuffer, slotNum);
+        RID target;
+        memcpy(&target.pageNum, (char*) homeBuffer + stubOffset, PTR_PN_SIZE);
+        memcpy(&target.slotNum, (char*) homeBuffer + stubOffset + PTR_PN_SIZE, PTR_SN_SIZE);
+        std::vector<RID> hops;
+        bool targetDeleted = false;
+        PageOffset recordOffset = 0, recordLength = 0;
+        while (errCode == 0) {
+            if (target.pageNum >= fileHandle.getNumberOfPages() || hops.size() > fileHandle.getNumberOfPages()) {
+                errCode = -1;
+                break;
+            }
+            errCode = fileHandle.readPage(target.pageNum, hopBuffer);
+            if (errCode != 0) break;
+            if (target.slotNum >= getNumSlots(hopBuffer) || getRecordOffset(hopBuffer, target.slotNum) == -1) {
+                targetDeleted = true;
+                break;
+            }
+            recordOffset = getRecordOffset(hopBuffer, target.slotNum);
+            recordLength = getRecordLength(hopBuffer, target.slotNum);
+            if (recordLength != -1) break;
+            hops.push_back(target);
+            memcpy(&target.pageNum, (char*) hopBuffer + recordOffset, PTR_PN_SIZE);
+            memcpy(&target.slotNum, (char*) hopBuffer + recordOffset + PTR_PN_SIZE, PTR_SN_SIZE);
+        }
+
+        bool hadIntermediates = !hops.empty();
+        bool removeTarget = false;
+        if (errCode == 0 && !targetDeleted) {
+            PageCount homeFreeBytes = getFreeBytes(homeBuffer);
+            PageCount targetUsedBytes = PAGE_SIZE - N_SIZE - F_SIZE - getFreeBytes(hopBuffer);
+            // The home page has room again: the record comes back and no hop is left
+            if ((int) homeFreeBytes + (int) (PTR_PN_SIZE + PTR_SN_SIZE) >= recordLength) {
+                PageOffset distance = recordLength - (PTR_PN_SIZE + PTR_SN_SIZE);
+                shiftRecord(homeBuffer, stubOffset, PTR_PN_SIZE + PTR_SN_SIZE, distance);
+                memcpy((char*) homeBuffer + stubOffset, (char*) hopBuffer + recordOffset, recordLength);
+                setRecordLength(homeBuffer, slotNum, recordLength);
+                setFreeBytes(homeBuffer, homeFreeBytes - distance);
+                removeTarget = true;
+                stats.recordsMovedHome++;
+            }
+            // The record sits on a nearly empty page: move it on so that page can drain and be freed.
+            // The page is hidden from the map meanwhile, otherwise the record could land on it again.
+            else if (target.pageNum != pageNum && targetUsedBytes < RBFM_VACUUM_DRAIN_BYTES) {
+                recordBuffer = malloc(recordLength);
+                memcpy(recordBuffer, (char*) hopBuffer + recordOffset, recordLength);
+                errCode = updateFreeSpaceMap(fileHandle, target.pageNum, 0, fsmBuffer, fsmPageNum);
+                unsigned newPageNum = 0;
+                PageOffset newRecordOffset = 0;
+                if (errCode == 0) {
+                    errCode = placeRecord(fileHandle, recordBuffer, recordLength, hopBuffer, newPageNum,
+                                          newRecordOffset, fsmBuffer, fsmPageNum);
+                }
+                if (errCode == 0) {
+                    RID newTarget;
+                    newTarget.pageNum = newPageNum;
+                    newTarget.slotNum = reuseOrInsertSlot(newRecordOffset, recordLength, hopBuffer);
+                    errCode = fileHandle.writePage(newPageNum, hopBuffer);
+                    if (errCode == 0) {
+                        errCode = updateFreeSpaceMap(fileHandle, newPageNum, getFreeSpaceClass(hopBuffer),
+                                                     fsmBuffer, fsmPageNum);
+                    }
+                    // the home page may have been picked, pick up its new state before changing the stub
+                    if (errCode == 0 && newPageNum == pageNum) errCode = fileHandle.readPage(pageNum, homeBuffer);
+                    hops.push_back(target);
+                    target = newTarget;
+                    stats.recordsRelocated++;
+                }
+            }
+        }
+
+        // Point the stub straight at the record, or bring the record home, then drop what it no longer needs
+        if (errCode == 0 && (removeTarget || !hops.empty())) {
+            if (!removeTarget) {
+                memcpy((char*) homeBuffer + stubOffset, &target.pageNum, PTR_PN_SIZE);
+                memcpy((char*) homeBuffer + stubOffset + PTR_PN_SIZE, &target.slotNum, PTR_SN_SIZE);
+            }
+            errCode = writeVacuumedPage(fileHandle, pageNum, homeBuffer, fsmBuffer, fsmPageNum, stats);
+            if (removeTarget) hops.push_back(target);
+            for (unsigned i = 0; i < hops.size() && errCode == 0; i++) {
+                errCode = removeSlot(fileHandle, hops[i], fsmBuffer, fsmPageNum, stats);
+            }
+            if (hadIntermediates) stats.chainsCollapsed++;
+        }
+        free(recordBuffer);
+        free(homeBuffer);
+        free(hopBuffer);
+        return errCode;
+    }
+
     /*************************************************/
     /*****    functions of rbfm_Scan_Iterator  *******/
     /*************************************************/
     RC RBFM_ScanIterator::initialize(const std::vector<Attribute> &recordDescriptor,
                                      const std::string &conditionAttribute, const CompOp compOp, const void* value,
                                      const std::vector<std::string> &attributeNames, RecordBasedFileManager* rbfm) {
+        ScanCondition condition;
+        condition.attribute = conditionAttribute;
+        condition.compOp = compOp;
+        condition.value = value;
+        return initialize(recordDescriptor, std::vector<ScanCondition>(1, condition), false, attributeNames, rbfm);
+    }
+
+    RC RBFM_ScanIterator::initialize(const std::vector<Attribute> &recordDescriptor,
+                                     const std::vector<ScanCondition> &conditions, bool anyCondition,
+                                     const std::vector<std::string> &attributeNames, RecordBasedFileManager* rbfm) {
         this->rbfm = rbfm;
         this->recordDescriptor = recordDescriptor;
-        this->compOp = compOp;
-
-        if (value == NULL || value == nullptr) this->value = nullptr;
-        else this->value = value;
-
         this->attributeNames = attributeNames;
         this->currPageNum = 0;
         this->currSlotNum = 0;
+        this->pageBuffer.resize(PAGE_SIZE);
+        this->bufferedPageNum = UINT_MAX;
+        this->nullIndicatorSize = (attributeNames.size() + 7) / 8;
+        this->attrDataOffset = NUM_ATTR_SIZE + recordDescriptor.size()*ATTR_OFF_SIZE;
+        this->targetAttrIdxs.clear();
+        this->conditions.clear();
+        this->anyCondition = anyCondition;
+        this->matchesAll = false;
+        this->numMatched = 0;
+        this->endPageNum = UINT_MAX;
 
         // initialize targetAttrIdxs
         int numAttrs = recordDescriptor.size();
@@ -691,131 +1168,199 @@ namespace PeterDB {
             if (attrIdx == numAttrs) return -1;   // attributeName not found
         }
 
-        // initialize conditionAttrIdx and conditionType
-        for (attrIdx = 0; attrIdx < numAttrs; attrIdx++){
-            if (recordDescriptor[attrIdx].name == conditionAttribute){
-                this->conditionAttrIdx = attrIdx;
-                this->conditionType = recordDescriptor[attrIdx].type;
-                break;
+        // compile every condition, NO_OP needs no attribute and holds for every record
+        for (const ScanCondition &condition : conditions) {
+            if (condition.compOp == NO_OP) {
+                if (anyCondition) this->matchesAll = true;
+                continue;
             }
+            for (attrIdx = 0; attrIdx < numAttrs; attrIdx++){
+                if (recordDescriptor[attrIdx].name == condition.attribute) break;
+            }
+            if (attrIdx == numAttrs) return -1;   // condition attribute not found
+
+            CompiledCondition compiled;
+            compiled.attrIdx = attrIdx;
+            compiled.compOp = condition.compOp;
+            compiled.value = condition.value;
+            compiled.predicate = compilePredicate(recordDescriptor[attrIdx].type, condition.compOp);
+            compiled.numChecked = 0;
+            compiled.numPassed = 0;
+            this->conditions.push_back(compiled);
         }
-        if (attrIdx == numAttrs){
-            if (compOp == NO_OP) this->conditionAttrIdx = -1;
-            else return -1;
-        }
+        if (this->conditions.empty()) this->matchesAll = true;
 
+        orderConditions();
         return 0;
     }
 
-    RC RBFM_ScanIterator::getNextRecord(RID &rid, void* data) {
-        void* pageBuffer = malloc(PAGE_SIZE);
-        unsigned numPages = fileHandle.getNumberOfPages();
-        int pageNum = 0;
-        short slotNum = 0;
-        short recordOffset;
-        short recordLength;
-        bool foundCondAttr = false;
-        int numAttrs = recordDescriptor.size();
-        short numSlots = -1;
-
-        for (pageNum = currPageNum; pageNum < numPages; pageNum++){
-            //std::cout<<"inside getNextRecord after enter outer for loop, currPageNum is "<<currPageNum<< ", pageNum is " << pageNum <<std::endl;
-            RC errCode = fileHandle.readPage(pageNum, pageBuffer);
-            if (errCode != 0) return errCode;
-            numSlots = rbfm->getNumSlots(pageBuffer);
-
-            for (slotNum = currSlotNum; slotNum < numSlots; slotNum++) {
-                recordOffset = rbfm->getRecordOffset(pageBuffer, slotNum);
-                recordLength = rbfm->getRecordLength(pageBuffer, slotNum);
+    RC RBFM_ScanIterator::setPageRange(unsigned firstPageNum, unsigned endPageNum) {
+        if (firstPageNum > endPageNum) return -1;
+        this->currPageNum = firstPageNum;
+        this->currSlotNum = 0;
+        this->endPageNum = endPageNum;
+        return 0;
+    }
 
-                //parseRecord(pageBuffer, slotNum, recordOffset, recordLength);
+    RC RBFM_ScanIterator::getNextRecord(RID &rid, void* data) {
+        // A batch of one, the caller's buffer is assumed to fit the record
+        unsigned count = 0;
+        return getNextBatch(&rid, data, SIZE_MAX, 1, count);
+    }
 
-                if (recordOffset == -1 || recordLength == -1) continue;
-                if (conditionAttrIdx == -1){
-                    foundCondAttr = true;
-                    break;
-                }
-                else{
-                    short attrOffset = 0;
-                    short attrLen = 0;
-                    RC errCode = parseAttr(attrLen, attrOffset, pageBuffer, recordOffset, conditionAttrIdx, numAttrs);
+    RC RBFM_ScanIterator::getNextBatch(RID* rids, void* buffer, size_t bufferSize, unsigned maxRecords, unsigned &count) {
+        count = 0;
+        if (maxRecords == 0) return 0;
+        size_t usedBytes = 0;
+        unsigned numPages = std::min(fileHandle.getNumberOfPages(), endPageNum);
+
+        for (; currPageNum < numPages; currPageNum++, currSlotNum = 0) {
+            // Freed pages and free space map pages hold no records
+            if (fileHandle.isPageFree(currPageNum) || rbfm->isFreeSpaceMapPage(currPageNum)) continue;
+
+            // Mapped files are scanned in place, otherwise the page is copied out once
+            // and the following calls walk its slots in memory until the scan moves on
+            void* pageBuffer;
+            if (fileHandle.isMapped()) {
+                pageBuffer = (void*) fileHandle.pageView(currPageNum);
+                if (pageBuffer == nullptr) return -1;
+            }
+            else {
+                pageBuffer = this->pageBuffer.data();
+                if (currPageNum != bufferedPageNum) {
+                    bufferedPageNum = UINT_MAX;
+                    RC errCode = fileHandle.readPage(currPageNum, pageBuffer);
                     if (errCode != 0) return errCode;
-
-                    // Conditional attribute in current record is not null
-                    if (attrOffset != -1){
-                        void* attrBuffer = malloc(attrLen);
-                        memcpy((char*) attrBuffer, (char*) pageBuffer + recordOffset + NUM_ATTR_SIZE + numAttrs*ATTR_OFF_SIZE + attrOffset, attrLen);
-                        foundCondAttr = findCondAttr(attrBuffer, attrLen);
-                        free(attrBuffer);
-                    }
-                    // Conditional attribute in current record is null
-                    else {
-                        if (compOp != NE_OP) foundCondAttr = value == nullptr;
-                        else foundCondAttr = value != nullptr;
-                        //else return -1;
-                    }
-                    if (foundCondAttr) break;
+                    bufferedPageNum = currPageNum;
                 }
             }
-            if (foundCondAttr) break;
 
-            if (slotNum == numSlots) currSlotNum = 0;
-        }
+            // Every qualifying record of the page is projected in this one pass, as far as the batch allows
+            PageCount numSlots = rbfm->getNumSlots(pageBuffer);
+            for (; currSlotNum < numSlots; currSlotNum++) {
+                if (count == maxRecords) return 0;
 
-        if (foundCondAttr){
-            rid.pageNum = pageNum;
-            rid.slotNum = slotNum;
+                PageOffset recordOffset = rbfm->getRecordOffset(pageBuffer, currSlotNum);
+                PageOffset recordLength = rbfm->getRecordLength(pageBuffer, currSlotNum);
+                if (recordOffset == -1 || recordLength == -1) continue;
+                if (!matchRecord(pageBuffer, recordOffset)) continue;
 
-            if (slotNum == numSlots){
-                currSlotNum = 0;
-                currPageNum = pageNum+1;
-            }
-            else {
-                currSlotNum = slotNum+1;
-                currPageNum = pageNum;
-            }
-
-            int newNullIndicatorSize = ceil(((double) attributeNames.size())/8);
-            //std::cout<<"inside getNextRecord inside if found, newNullIndicatorSize is "<< newNullIndicatorSize << std::endl;
-            auto * newNullIndicator = (unsigned char*)malloc(newNullIndicatorSize);
-            memset(newNullIndicator,0, newNullIndicatorSize);
-            int dataPtr = newNullIndicatorSize;
-            //std::cout<<"inside getNextRecord inside if found, dataPtr is "<< dataPtr<<std::endl;
-
-            for (short i = 0; i < attributeNames.size(); i++){
-                short attrLen = 0;
-                short attrOffset = 0;
-                RC errCode = parseAttr(attrLen, attrOffset, pageBuffer, recordOffset, targetAttrIdxs[i], numAttrs);
-                if (errCode != 0) return errCode;
-
-                // Target attribute in current record is not null
-                if (attrOffset != -1){
-                    memcpy((char*) data + dataPtr, (char*) pageBuffer + recordOffset + NUM_ATTR_SIZE + numAttrs*ATTR_OFF_SIZE + attrOffset, attrLen);
-                    dataPtr += attrLen;
-                }
-                // Target attribute in current record is null
-                else{
-                    int byteIndex = i / 8;
-                    int bitIndex = i % 8;
-                    newNullIndicator[byteIndex] += pow(2, 7-bitIndex);
+                size_t projectedSize = getProjectedSize(pageBuffer, recordOffset);
+                if (usedBytes + projectedSize > bufferSize) {
+                    // the record is picked up by the next call
+                    return count > 0 ? 0 : RBFM_BUFFER_TOO_SMALL;
                 }
+                projectRecord(pageBuffer, recordOffset, (char*) buffer + usedBytes);
+                usedBytes += projectedSize;
+
+                rids[count].pageNum = currPageNum;
+                rids[count].slotNum = currSlotNum;
+                count++;
+            }
+            if (count == maxRecords) {
+                currPageNum++;
+                currSlotNum = 0;
+                return 0;
             }
-            free(pageBuffer);
-            memcpy((char*) data, newNullIndicator, newNullIndicatorSize);
-            free(newNullIndicator);
-            return 0;
         }
-        free(pageBuffer);
-        return RBFM_EOF;
+        return count > 0 ? 0 : RBFM_EOF;
     }
 
     RC RBFM_ScanIterator::close(){
         targetAttrIdxs.clear();
+        std::vector<char>().swap(pageBuffer);
+        bufferedPageNum = UINT_MAX;
         return 0;
     }
 
-    RC RBFM_ScanIterator::parseAttr(short &attrLen, short &attrOffset, void* pageBuffer, short recordOffset, short idx, int numAttrs){
-        memcpy(&attrOffset, (char*) pageBuffer + recordOffset + NUM_ATTR_SIZE + idx*ATTR_OFF_SIZE, ATTR_OFF_SIZE);
+    bool RBFM_ScanIterator::matchCondition(const CompiledCondition &condition, void* pageBuffer, PageOffset recordOffset) {
+        int attrOffset;
+        memcpy(&attrOffset, (char*) pageBuffer + recordOffset + NUM_ATTR_SIZE + condition.attrIdx*ATTR_OFF_SIZE, ATTR_OFF_SIZE);
+
+        // Conditional attribute in current record is null
+        if (attrOffset == -1) {
+            if (condition.compOp != NE_OP) return condition.value == nullptr;
+            return condition.value != nullptr;
+        }
+        // A null constant only equals null attributes
+        if (condition.value == nullptr) return condition.compOp == NE_OP;
+
+        // compared where it lies in the page
+        return condition.predicate((const char*) pageBuffer + recordOffset + attrDataOffset + attrOffset,
+                                   (const char*) condition.value);
+    }
+
+    bool RBFM_ScanIterator::matchRecord(void* pageBuffer, PageOffset recordOffset) {
+        if (matchesAll) return true;
+        if (conditions.size() > 1 && ++numMatched >= RBFM_REORDER_INTERVAL) orderConditions();
+
+        // The first failing condition rejects an ANDed record, the first holding one accepts an ORed record
+        for (CompiledCondition &condition : conditions) {
+            bool passed = matchCondition(condition, pageBuffer, recordOffset);
+            condition.numChecked++;
+            if (passed) condition.numPassed++;
+            if (passed == anyCondition) return passed;
+        }
+        return !anyCondition;
+    }
+
+    void RBFM_ScanIterator::orderConditions() {
+        numMatched = 0;
+        bool anyCondition = this->anyCondition;
+        // Before any record is seen: equality is the most selective, then ranges, then inequality,
+        // and fixed size attributes are cheaper to compare than VarChar.
+        // Later the observed pass rates take over. ANDed conditions go from rarely to often holding, ORed ones reversed.
+        auto estimate = [this, anyCondition](const CompiledCondition &condition) {
+            double passRate;
+            if (condition.numChecked > 0) passRate = (double) condition.numPassed / condition.numChecked;
+            else if (condition.compOp == EQ_OP) passRate = 0.1;
+            else if (condition.compOp == NE_OP) passRate = 0.9;
+            else passRate = 0.5;
+            return anyCondition ? 1 - passRate : passRate;
+        };
+        std::stable_sort(conditions.begin(), conditions.end(),
+                         [this, &estimate](const CompiledCondition &a, const CompiledCondition &b) {
+            double estimateA = estimate(a), estimateB = estimate(b);
+            if (estimateA != estimateB) return estimateA < estimateB;
+            return recordDescriptor[a.attrIdx].type != TypeVarChar && recordDescriptor[b.attrIdx].type == TypeVarChar;
+        });
+    }
+
+    size_t RBFM_ScanIterator::getProjectedSize(void* pageBuffer, PageOffset recordOffset) {
+        size_t projectedSize = nullIndicatorSize;
+        for (short attrIdx : targetAttrIdxs) {
+            PageOffset attrLen = 0;
+            PageOffset attrOffset = 0;
+            parseAttr(attrLen, attrOffset, pageBuffer, recordOffset, attrIdx, recordDescriptor.size());
+            projectedSize += attrLen;
+        }
+        return projectedSize;
+    }
+
+    void RBFM_ScanIterator::projectRecord(void* pageBuffer, PageOffset recordOffset, void* data) {
+        auto* nullIndicator = (unsigned char*) data;
+        memset(nullIndicator, 0, nullIndicatorSize);
+        size_t dataPtr = nullIndicatorSize;
+        for (unsigned i = 0; i < targetAttrIdxs.size(); i++) {
+            PageOffset attrLen = 0;
+            PageOffset attrOffset = 0;
+            parseAttr(attrLen, attrOffset, pageBuffer, recordOffset, targetAttrIdxs[i], recordDescriptor.size());
+
+            // Target attribute in current record is null
+            if (attrOffset == -1) {
+                nullIndicator[i / 8] |= 1 << (7 - i % 8);
+                continue;
+            }
+            memcpy((char*) data + dataPtr, (char*) pageBuffer + recordOffset + attrDataOffset + attrOffset, attrLen);
+            dataPtr += attrLen;
+        }
+    }
+
+    RC RBFM_ScanIterator::parseAttr(PageOffset &attrLen, PageOffset &attrOffset, void* pageBuffer, PageOffset recordOffset, short idx, int numAttrs){
+        // attribute offsets are stored as int, read the whole field before narrowing
+        int storedAttrOffset;
+        memcpy(&storedAttrOffset, (char*) pageBuffer + recordOffset + NUM_ATTR_SIZE + idx*ATTR_OFF_SIZE, ATTR_OFF_SIZE);
+        attrOffset = storedAttrOffset;
         // Attribute is not null
         if (attrOffset != -1) {
             // Attribute is of type varChar
@@ -840,96 +1385,68 @@ namespace PeterDB {
         return 0;
     }
 
-    bool RBFM_ScanIterator::findCondAttr(const void* checkAttr, short attrLen){
-        bool found = false;
-        // Attribute is of type varChar
-        if (conditionType == TypeVarChar) {
-            unsigned checkVarCharLen = attrLen - VC_LEN_SIZE;
-            char* checkVarChar = (char*) malloc(checkVarCharLen);
-            memcpy(checkVarChar, (char*) checkAttr + VC_LEN_SIZE, checkVarCharLen);
-
-            unsigned valueVarCharLen;
-            memcpy(&valueVarCharLen, (char*) value, VC_LEN_SIZE);
-            char* valueVarChar = (char*) malloc(valueVarCharLen);
-            memcpy(valueVarChar, (char*) value + VC_LEN_SIZE, valueVarCharLen);
-            switch(compOp) {
-                case EQ_OP:
-                    found = std::string(valueVarChar, valueVarCharLen) == std::string(checkVarChar, checkVarCharLen);
-                    break;
-                case LT_OP:
-                    found = std::string(valueVarChar, valueVarCharLen) > std::string(checkVarChar, checkVarCharLen);
-                    break;
-                case LE_OP:
-                    found = std::string(valueVarChar, valueVarCharLen) >= std::string(checkVarChar, checkVarCharLen);
-                    break;
-                case GT_OP:
-                    found = std::string(valueVarChar, valueVarCharLen) < std::string(checkVarChar, checkVarCharLen);
-                    break;
-                case GE_OP:
-                    found = std::string(valueVarChar, valueVarCharLen) <= std::string(checkVarChar, checkVarCharLen);
-                    break;
-                case NE_OP:
-                    found = std::string(valueVarChar, valueVarCharLen) != std::string(checkVarChar, checkVarCharLen);
-                    break;
-            }
-            free(checkVarChar);
-            free(valueVarChar);
-        }
-        // Attribute is of type int
-        else if (conditionType == TypeInt) {
-            int check;
-            memcpy(&check, (char*) checkAttr, INT_SIZE);
-            int data;
-            memcpy(&data, (char*) value, INT_SIZE);
-            switch(compOp) {
-                case EQ_OP:
-                    found = data == check;
-                    break;
-                case LT_OP:
-                    found = data > check;
-                    break;
-                case LE_OP:
-                    found = data >= check;
-                    break;
-                case GT_OP:
-                    found = data < check;
-                    break;
-                case GE_OP:
-                    found = data <= check;
-                    break;
-                case NE_OP:
-                    found = data != check;
-                    break;
-            }
+    /*****    Compiled scan predicates  *******/
+    // One instance per type and operator, chosen when the scan starts.
+    // attr and value are the stored forms: 4 bytes for Int and Real, [length][characters] for VarChar.
+    struct EqualOp { template<typename T> bool operator()(const T &a, const T &b) const { return a == b; } };
+    struct LessOp { template<typename T> bool operator()(const T &a, const T &b) const { return a < b; } };
+    struct LessEqualOp { template<typename T> bool operator()(const T &a, const T &b) const { return a <= b; } };
+    struct GreaterOp { template<typename T> bool operator()(const T &a, const T &b) const { return a > b; } };
+    struct GreaterEqualOp { template<typename T> bool operator()(const T &a, const T &b) const { return a >= b; } };
+    struct NotEqualOp { template<typename T> bool operator()(const T &a, const T &b) const { return a != b; } };
+
+    template<typename T, typename Op>
+    static bool compareValue(const char* attr, const char* value) {
+        T attrValue, constValue;
+        memcpy(&attrValue, attr, sizeof(T));
+        memcpy(&constValue, value, sizeof(T));
+        return Op()(attrValue, constValue);
+    }
+
+    template<typename Op>
+    static bool compareVarChar(const char* attr, const char* value) {
+        unsigned attrLength, constLength;
+        memcpy(&attrLength, attr, VC_LEN_SIZE);
+        memcpy(&constLength, value, VC_LEN_SIZE);
+        // byte order as std::string compares, a shorter string comes first when it is a prefix
+        int cmp = memcmp(attr + VC_LEN_SIZE, value + VC_LEN_SIZE, std::min(attrLength, constLength));
+        if (cmp == 0) cmp = (attrLength > constLength) - (attrLength < constLength);
+        return Op()(cmp, 0);
+    }
+
+    static bool matchAll(const char*, const char*) {
+        return true;
+    }
+
+    template<typename Op>
+    static RBFM_ScanIterator::Predicate compileForType(AttrType type) {
+        switch (type) {
+            case TypeInt:
+                return compareValue<int, Op>;
+            case TypeReal:
+                return compareValue<float, Op>;
+            default:
+                return compareVarChar<Op>;
         }
-        // Attribute is of type real
-        else {
-            float check;
-            memcpy(&check, (char*)checkAttr, FLT_SIZE);
-            float data;
-            memcpy(&data, (char*)value, FLT_SIZE);
-            switch(compOp) {
-                case EQ_OP:
-                    found = data == check;
-                    break;
-                case LT_OP:
-                    found = data > check;
-                    break;
-                case LE_OP:
-                    found = data >= check;
-                    break;
-                case GT_OP:
-                    found = data < check;
-                    break;
-                case GE_OP:
-                    found = data <= check;
-                    break;
-                case NE_OP:
-                    found = data != check;
-                    break;
-            }
+    }
+
+    RBFM_ScanIterator::Predicate RBFM_ScanIterator::compilePredicate(AttrType type, CompOp compOp) {
+        switch (compOp) {
+            case EQ_OP:
+                return compileForType<EqualOp>(type);
+            case LT_OP:
+                return compileForType<LessOp>(type);
+            case LE_OP:
+                return compileForType<LessEqualOp>(type);
+            case GT_OP:
+                return compileForType<GreaterOp>(type);
+            case GE_OP:
+                return compileForType<GreaterEqualOp>(type);
+            case NE_OP:
+                return compileForType<NotEqualOp>(type);
+            default:
+                return matchAll;
         }
-        return found;
     }
 
 } // namespace PeterDB
@@ -770,7 +770,7 @@ namespace PeterDB {
         errCode = buildAttrDescriptor(tableName, attributeName, attribute);
         if (errCode != 0) return errCode;
 
-        unsigned short entryLength;
+        PageCount entryLength;
         if (attribute.type == TypeVarChar) {
             unsigned varCharLen;
             memcpy(&varCharLen, (char*) entryData+1, VC_LEN_SIZE);
@@ -830,6 +830,7 @@ namespace PeterDB {
         RC errCode = ix_scanIterator.close();
         if (errCode != 0) return errCode;
 
+        if (ix_scanIterator.ixFileHandle == nullptr) return 0;
         errCode = ix_scanIterator.ixFileHandle->fileHandle.closeFile();
         if (errCode != 0) return errCode;
         return 0;
@@ -129,4 +129,790 @@ namespace PeterDBTesting {
         ASSERT_GT(getFileSize(fileName), 0) << "File Size should not be zero at this moment.";
     }
 
+    TEST_F (PFM_Private_Test, check_header_flushed_on_close) {
+        // Functions Tested:
+        // 1. Append Page and Write Page leave their pages in the buffer pool
+        // 2. Closing the last handle writes the pages and the hidden page to disk
+
+        unsigned numPages = 4;
+        inBuffer = malloc(PAGE_SIZE);
+        outBuffer = malloc(PAGE_SIZE);
+        for (unsigned i = 0; i < numPages; i++) {
+            generateData(inBuffer, PAGE_SIZE, 11 + i, 29 - i);
+            ASSERT_EQ(fileHandle.appendPage(inBuffer), success) << "Appending a page should succeed.";
+        }
+        generateData(inBuffer, PAGE_SIZE, 17, 23);
+        ASSERT_EQ(fileHandle.writePage(numPages - 1, inBuffer), success) << "Writing a page should succeed.";
+        ASSERT_EQ(pfm.closeFile(fileHandle), success) << "Closing the file should succeed.";
+
+        // Read the file behind the pool's back
+        unsigned header[4];
+        {
+            std::ifstream fileIn(fileName, std::ios::binary);
+            fileIn.read((char*) header, sizeof(header));
+            fileIn.seekg((std::streamoff) numPages * PAGE_SIZE);
+            fileIn.read((char*) outBuffer, PAGE_SIZE);
+            ASSERT_TRUE(fileIn.good()) << "The file should hold every page.";
+        }
+        ASSERT_EQ(header[3], numPages) << "The hidden page should hold the number of pages.";
+        ASSERT_GE(header[1], 1) << "The hidden page should hold the write counter.";
+        ASSERT_GE(header[2], numPages) << "The hidden page should hold the append counter.";
+        ASSERT_EQ(memcmp(inBuffer, outBuffer, PAGE_SIZE), 0) << "The written page should be on disk.";
+
+        ASSERT_EQ(pfm.openFile(fileName, fileHandle), success) << "Opening the file should succeed.";
+    }
+
+    TEST_F (PFM_Private_Test, check_mapped_page_view) {
+        // Functions Tested:
+        // 1. Append Page
+        // 2. Open File in mapped read only mode
+        // 3. Page View
+        // 4. Read Page / Write Page / Append Page on a mapped file
+
+        inBuffer = malloc(PAGE_SIZE);
+        outBuffer = malloc(PAGE_SIZE);
+        int numPages = 10;
+        for (int i = 0; i < numPages; i++) {
+            generateData(inBuffer, PAGE_SIZE, 31 + i, 19 - i);
+            ASSERT_EQ(fileHandle.appendPage(inBuffer), success) << "Appending a page should succeed.";
+        }
+
+        ASSERT_EQ(pfm.closeFile(fileHandle), success) << "Closing the file should not fail.";
+        fileHandle = PeterDB::FileHandle();
+        ASSERT_EQ(pfm.openFile(fileName, fileHandle, PeterDB::MappedReadOnlyMode), success)
+                                    << "Opening the file mapped should not fail: " << fileName;
+        ASSERT_TRUE(fileHandle.isMapped()) << "The file should be mapped.";
+        ASSERT_EQ(fileHandle.getNumberOfPages(), numPages) << "The page count should be " << numPages;
+
+        for (int i = 0; i < numPages; i++) {
+            generateData(inBuffer, PAGE_SIZE, 31 + i, 19 - i);
+            const void *view = fileHandle.pageView(i);
+            ASSERT_NE(view, nullptr) << "Viewing an existing page should succeed.";
+            ASSERT_EQ(memcmp(inBuffer, view, PAGE_SIZE), 0) << "Checking the integrity of the view should succeed.";
+            ASSERT_EQ(fileHandle.readPage(i, outBuffer), success) << "Reading a page should succeed.";
+            ASSERT_EQ(memcmp(inBuffer, outBuffer, PAGE_SIZE), 0) << "Checking the integrity of the page should succeed.";
+        }
+        ASSERT_EQ(fileHandle.pageView(numPages), nullptr) << "Viewing a non-existing page should fail.";
+
+        ASSERT_NE(fileHandle.writePage(0, inBuffer), success) << "Writing a mapped file should fail.";
+        ASSERT_NE(fileHandle.appendPage(inBuffer), success) << "Appending to a mapped file should fail.";
+    }
+
+    TEST_F (PFM_Private_Test, check_vectored_read_write) {
+        // Functions Tested:
+        // 1. Append Page
+        // 2. Write Pages
+        // 3. Read Pages / Read Page
+        // 4. Get Counter Values
+
+        int numPages = 20;
+        inBuffer = malloc(PAGE_SIZE * numPages);
+        outBuffer = malloc(PAGE_SIZE * numPages);
+        for (int i = 0; i < numPages; i++) {
+            generateData((char *) inBuffer + i * PAGE_SIZE, PAGE_SIZE, 11 + i, 29 - i);
+            ASSERT_EQ(fileHandle.appendPage((char *) inBuffer + i * PAGE_SIZE), success)
+                                        << "Appending a page should succeed.";
+        }
+
+        // Overwrite pages 5 to 14 in one call
+        for (int i = 5; i < 15; i++) {
+            generateData((char *) inBuffer + i * PAGE_SIZE, PAGE_SIZE, 41 + i, 7 + i);
+        }
+        ASSERT_EQ(fileHandle.writePages(5, 10, (char *) inBuffer + 5 * PAGE_SIZE), success)
+                                    << "Writing pages should succeed.";
+        ASSERT_NE(fileHandle.writePages(15, 10, inBuffer), success) << "Writing past the last page should fail.";
+
+        unsigned readPageCount = 0, writePageCount = 0, appendPageCount = 0;
+        unsigned readPageCount1 = 0, writePageCount1 = 0, appendPageCount1 = 0;
+        ASSERT_EQ(fileHandle.collectCounterValues(readPageCount, writePageCount, appendPageCount), success)
+                                    << "Collecting counters should succeed.";
+
+        ASSERT_EQ(fileHandle.readPages(0, numPages, outBuffer), success) << "Reading pages should succeed.";
+        ASSERT_EQ(memcmp(inBuffer, outBuffer, PAGE_SIZE * numPages), 0)
+                                    << "Checking the integrity of the pages should succeed.";
+        ASSERT_NE(fileHandle.readPages(numPages - 1, 2, outBuffer), success) << "Reading past the last page should fail.";
+
+        ASSERT_EQ(fileHandle.collectCounterValues(readPageCount1, writePageCount1, appendPageCount1), success)
+                                    << "Collecting counters should succeed.";
+        ASSERT_EQ(readPageCount1 - readPageCount, numPages) << "Every page read should be counted.";
+
+        // Single page reads see the vectored writes too
+        ASSERT_EQ(fileHandle.readPage(7, outBuffer), success) << "Reading a page should succeed.";
+        ASSERT_EQ(memcmp((char *) inBuffer + 7 * PAGE_SIZE, outBuffer, PAGE_SIZE), 0)
+                                    << "Checking the integrity of the page should succeed.";
+    }
+
+    TEST_F (PFM_Private_Test, check_async_read_write) {
+        // Functions Tested:
+        // 1. Append Page
+        // 2. Write Page Async
+        // 3. Read Page Async
+        // 4. Get Counter Values
+        // 5. Prefetch Pages brings pages into the buffer pool
+
+        int numPages = 16;
+        inBuffer = malloc(PAGE_SIZE * numPages);
+        outBuffer = malloc(PAGE_SIZE * numPages);
+        for (int i = 0; i < numPages; i++) {
+            generateData((char *) inBuffer + i * PAGE_SIZE, PAGE_SIZE, 7 + i, 41 - i);
+            ASSERT_EQ(fileHandle.appendPage(outBuffer), success) << "Appending a page should succeed.";
+        }
+
+        unsigned readPageCount = 0, writePageCount = 0, appendPageCount = 0;
+        unsigned readPageCount1 = 0, writePageCount1 = 0, appendPageCount1 = 0;
+        ASSERT_EQ(fileHandle.collectCounterValues(readPageCount, writePageCount, appendPageCount), success)
+                                    << "Collecting counters should succeed.";
+
+        // The pages are copied on submission, so the futures can be waited on in any order
+        std::vector<std::future<PeterDB::RC>> writes;
+        for (int i = 0; i < numPages; i++) {
+            writes.push_back(fileHandle.writePageAsync(i, (char *) inBuffer + i * PAGE_SIZE));
+        }
+        for (auto &write : writes) {
+            ASSERT_EQ(write.get(), success) << "Writing a page asynchronously should succeed.";
+        }
+
+        std::vector<std::future<PeterDB::RC>> reads;
+        for (int i = 0; i < numPages; i++) {
+            reads.push_back(fileHandle.readPageAsync(i, (char *) outBuffer + i * PAGE_SIZE));
+        }
+        for (auto &read : reads) {
+            ASSERT_EQ(read.get(), success) << "Reading a page asynchronously should succeed.";
+        }
+        ASSERT_EQ(memcmp(inBuffer, outBuffer, PAGE_SIZE * numPages), 0)
+                                    << "Checking the integrity of the pages should succeed.";
+        ASSERT_NE(fileHandle.readPageAsync(numPages, outBuffer).get(), success)
+                                    << "Reading a non-existing page should fail.";
+
+        ASSERT_EQ(fileHandle.collectCounterValues(readPageCount1, writePageCount1, appendPageCount1), success)
+                                    << "Collecting counters should succeed.";
+        ASSERT_EQ(readPageCount1 - readPageCount, numPages) << "Every asynchronous read should be counted.";
+        ASSERT_EQ(writePageCount1 - writePageCount, numPages) << "Every asynchronous write should be counted.";
+
+        // Prefetched pages are brought back into the pool
+        PeterDB::BufferPoolManager &bpm = PeterDB::BufferPoolManager::instance();
+        ASSERT_EQ(bpm.flushFile(fileHandle), success) << "Flushing the file should succeed.";
+        ASSERT_EQ(bpm.discardFile(fileName), success) << "Discarding the unpinned pages should succeed.";
+        std::vector<PeterDB::PageNum> pageNums;
+        for (int i = numPages - 1; i >= 0; i -= 2) pageNums.push_back(i);
+        pageNums.push_back(numPages - 1);
+        ASSERT_EQ(bpm.prefetchPages(fileHandle, pageNums), success) << "Prefetching pages should succeed.";
+        ASSERT_EQ(bpm.overlayPages(fileHandle, 0, numPages, outBuffer), numPages / 2)
+                                    << "Every distinct prefetched page should be in the pool.";
+        pageNums.push_back(numPages);
+        ASSERT_NE(bpm.prefetchPages(fileHandle, pageNums), success) << "Prefetching a non-existing page should fail.";
+
+        // Pinned pages are not dropped from under their user
+        void *pageData = nullptr;
+        ASSERT_EQ(bpm.fetchPage(fileHandle, 0, pageData), success) << "Fetching a page should succeed.";
+        ASSERT_NE(bpm.discardFile(fileName), success) << "Discarding a file with a pinned page should fail.";
+        ASSERT_EQ(bpm.unpinPage(fileHandle, 0, false), success) << "Unpinning a page should succeed.";
+        ASSERT_EQ(bpm.discardFile(fileName), success) << "Discarding the unpinned pages should succeed.";
+    }
+
+    TEST_F (PFM_Private_Test, check_concurrent_readers_and_writer) {
+        // Functions Tested:
+        // 1. Append Page and Write Page from one thread
+        // 2. Read Page from several threads sharing the same handle
+        // 3. Get Counter Values
+
+        // Pages 0 to numPages-1 start as the first version and are overwritten with the second one,
+        // which follows the pages that are appended
+        int numPages = 32, numReaders = 4, numRounds = 8;
+        inBuffer = malloc(PAGE_SIZE * numPages * 3);
+        for (int i = 0; i < numPages * 3; i++) {
+            generateData((char *) inBuffer + i * PAGE_SIZE, PAGE_SIZE, 13 + i, 37 - i);
+        }
+        for (int i = 0; i < numPages; i++) {
+            ASSERT_EQ(fileHandle.appendPage((char *) inBuffer + i * PAGE_SIZE), success)
+                                        << "Appending a page should succeed.";
+        }
+
+        unsigned readPageCount = 0, writePageCount = 0, appendPageCount = 0;
+        unsigned readPageCount1 = 0, writePageCount1 = 0, appendPageCount1 = 0;
+        ASSERT_EQ(fileHandle.collectCounterValues(readPageCount, writePageCount, appendPageCount), success)
+                                    << "Collecting counters should succeed.";
+
+        // Readers touch the first numPages pages while the writer overwrites them and appends behind them
+        std::atomic<int> numMismatches(0);
+        std::vector<std::thread> readers;
+        for (int r = 0; r < numReaders; r++) {
+            readers.emplace_back([&, r]() {
+                char page[PAGE_SIZE];
+                for (int round = 0; round < numRounds; round++) {
+                    for (int i = 0; i < numPages; i++) {
+                        int pageNum = (i + r * 7) % numPages;
+                        if (fileHandle.readPage(pageNum, page) != success ||
+                            (memcmp(page, (char *) inBuffer + pageNum * PAGE_SIZE, PAGE_SIZE) != 0 &&
+                             memcmp(page, (char *) inBuffer + (2 * numPages + pageNum) * PAGE_SIZE, PAGE_SIZE) != 0)) {
+                            numMismatches++;
+                        }
+                    }
+                }
+            });
+        }
+        int numWrites = 0;
+        for (int round = 0; round < numRounds; round++) {
+            for (int i = 0; i < numPages; i++) {
+                int version = round % 2 == 0 ? 2 * numPages + i : i;
+                ASSERT_EQ(fileHandle.writePage(i, (char *) inBuffer + version * PAGE_SIZE), success)
+                                            << "Writing a page should succeed.";
+                numWrites++;
+            }
+            int firstAppend = numPages + round * numPages / numRounds;
+            for (int i = firstAppend; i < firstAppend + numPages / numRounds; i++) {
+                ASSERT_EQ(fileHandle.appendPage((char *) inBuffer + i * PAGE_SIZE), success)
+                                            << "Appending a page should succeed.";
+            }
+        }
+        for (auto &reader : readers) reader.join();
+
+        ASSERT_EQ(numMismatches, 0) << "Every concurrent read should return a whole version of the page.";
+        ASSERT_EQ(fileHandle.getNumberOfPages(), numPages * 2) << "Every append should be kept.";
+        ASSERT_EQ(fileHandle.collectCounterValues(readPageCount1, writePageCount1, appendPageCount1), success)
+                                    << "Collecting counters should succeed.";
+        ASSERT_EQ(readPageCount1 - readPageCount, numPages * numReaders * numRounds)
+                                    << "No read should be lost from the counter.";
+        ASSERT_EQ(writePageCount1 - writePageCount, numWrites) << "No write should be lost from the counter.";
+        ASSERT_EQ(appendPageCount1 - appendPageCount, numPages) << "No append should be lost from the counter.";
+    }
+
+    TEST_F (PFM_Private_Test, check_shared_open_file) {
+        // Functions Tested:
+        // 1. Open the same file with a second handle
+        // 2. Append Page through one handle, Read Page through the other
+        // 3. Close and reopen with idle files kept open and closed right away
+
+        inBuffer = malloc(PAGE_SIZE);
+        outBuffer = malloc(PAGE_SIZE);
+        generateData(inBuffer, PAGE_SIZE, 5, 17);
+
+        PeterDB::FileHandle otherHandle;
+        ASSERT_EQ(pfm.openFile(fileName, otherHandle), success) << "Opening the file twice should succeed.";
+        unsigned numPages = fileHandle.getNumberOfPages();
+        ASSERT_EQ(otherHandle.getNumberOfPages(), numPages) << "Both handles should see the same pages.";
+
+        ASSERT_EQ(fileHandle.appendPage(inBuffer), success) << "Appending a page should succeed.";
+        ASSERT_EQ(otherHandle.getNumberOfPages(), numPages + 1) << "The append should be seen by the other handle.";
+        ASSERT_EQ(otherHandle.readPage(numPages, outBuffer), success) << "Reading the new page should succeed.";
+        ASSERT_EQ(memcmp(inBuffer, outBuffer, PAGE_SIZE), 0) << "Checking the integrity of the page should succeed.";
+        ASSERT_EQ(pfm.closeFile(otherHandle), success) << "Closing the second handle should succeed.";
+
+        // Reopening counts the hidden page read whether or not the descriptor was kept open
+        unsigned maxIdleFiles = pfm.getMaxIdleFiles();
+        for (unsigned idleFiles : {maxIdleFiles, 0u}) {
+            pfm.setMaxIdleFiles(idleFiles);
+            unsigned readPageCount = 0, writePageCount = 0, appendPageCount = 0;
+            unsigned readPageCount1 = 0, writePageCount1 = 0, appendPageCount1 = 0;
+            ASSERT_EQ(fileHandle.collectCounterValues(readPageCount, writePageCount, appendPageCount), success)
+                                        << "Collecting counters should succeed.";
+            ASSERT_EQ(pfm.closeFile(fileHandle), success) << "Closing the file should succeed.";
+            fileHandle = PeterDB::FileHandle();
+            ASSERT_EQ(pfm.openFile(fileName, fileHandle), success) << "Reopening the file should succeed.";
+            ASSERT_EQ(fileHandle.collectCounterValues(readPageCount1, writePageCount1, appendPageCount1), success)
+                                        << "Collecting counters should succeed.";
+            ASSERT_EQ(readPageCount1, readPageCount + 1) << "Reopening should read the hidden page once.";
+            ASSERT_EQ(writePageCount1, writePageCount + 1) << "Closing should write the hidden page once.";
+            ASSERT_EQ(appendPageCount1, appendPageCount) << "The append counter should be kept.";
+            ASSERT_EQ(fileHandle.getNumberOfPages(), numPages + 1) << "The page count should be kept.";
+        }
+        pfm.setMaxIdleFiles(maxIdleFiles);
+    }
+
+    TEST_F (PFM_Private_Test, check_free_page_reuse) {
+        // Functions Tested:
+        // 1. Allocate Page
+        // 2. Free Page
+        // 3. Reuse of freed pages after reopening the file
+
+        int numPages = 8;
+        PeterDB::PageNum pageNum;
+        inBuffer = malloc(PAGE_SIZE);
+        outBuffer = malloc(PAGE_SIZE);
+        unsigned firstPageNum = fileHandle.getNumberOfPages();
+        for (int i = 0; i < numPages; i++) {
+            generateData(inBuffer, PAGE_SIZE, 3 + i, 23 - i);
+            ASSERT_EQ(fileHandle.allocatePage(inBuffer, pageNum), success) << "Allocating a page should succeed.";
+            ASSERT_EQ(pageNum, firstPageNum + i) << "Without free pages the file should grow.";
+        }
+
+        ASSERT_EQ(fileHandle.freePage(firstPageNum + 2), success) << "Freeing a page should succeed.";
+        ASSERT_EQ(fileHandle.freePage(firstPageNum + 5), success) << "Freeing a page should succeed.";
+        ASSERT_NE(fileHandle.freePage(firstPageNum + 5), success) << "Freeing a page twice should fail.";
+        ASSERT_NE(fileHandle.freePage(firstPageNum + numPages), success) << "Freeing a non-existing page should fail.";
+        ASSERT_TRUE(fileHandle.isPageFree(firstPageNum + 2)) << "The freed page should be on the free list.";
+        ASSERT_FALSE(fileHandle.isPageFree(firstPageNum + 3)) << "A page in use should not be on the free list.";
+
+        // The free list is kept in the hidden page
+        reopenFile();
+        ASSERT_EQ(fileHandle.getNumberOfFreePages(), 2) << "The free list should survive reopening the file.";
+
+        size_t fileSize = getFileSize(fileName);
+        generateData(inBuffer, PAGE_SIZE, 91, 7);
+        ASSERT_EQ(fileHandle.allocatePage(inBuffer, pageNum), success) << "Allocating a page should succeed.";
+        ASSERT_EQ(pageNum, firstPageNum + 5) << "The most recently freed page should be reused first.";
+        ASSERT_EQ(fileHandle.allocatePage(inBuffer, pageNum), success) << "Allocating a page should succeed.";
+        ASSERT_EQ(pageNum, firstPageNum + 2) << "The other freed page should be reused next.";
+        ASSERT_EQ(getFileSize(fileName), fileSize) << "Reusing free pages should not grow the file.";
+        ASSERT_EQ(fileHandle.getNumberOfFreePages(), 0) << "The free list should be empty.";
+
+        ASSERT_EQ(fileHandle.readPage(firstPageNum + 2, outBuffer), success) << "Reading a page should succeed.";
+        ASSERT_EQ(memcmp(inBuffer, outBuffer, PAGE_SIZE), 0) << "A reused page should hold the new data.";
+    }
+
+    TEST_F (PFM_Private_Test, check_write_ahead_log) {
+        // Functions Tested:
+        // 1. Append Page and Write Page with the write-ahead log enabled
+        // 2. Recovery from a copy of the file and its log taken before the pages reached the file
+        // 3. Sync empties the log
+
+        std::string walFileName = "pfm_private_wal_file";
+        std::string copyFileName = "pfm_private_wal_copy";
+        std::string walSuffix = PFM_WAL_SUFFIX;
+        for (const std::string &name : {walFileName, copyFileName}) {
+            if (fileExists(name)) ASSERT_EQ(pfm.destroyFile(name), success) << "Destroying the file should succeed.";
+        }
+
+        pfm.setWALEnabled(true);
+        ASSERT_EQ(pfm.createFile(walFileName), success) << "Creating the file should succeed.";
+        PeterDB::FileHandle walHandle;
+        ASSERT_EQ(pfm.openFile(walFileName, walHandle), success) << "Opening the file should succeed.";
+
+        unsigned numPages = 8;
+        inBuffer = malloc(PAGE_SIZE);
+        outBuffer = malloc(PAGE_SIZE);
+        for (unsigned i = 0; i < numPages; i++) {
+            generateData(inBuffer, PAGE_SIZE, 11 + i, 31 - i);
+            ASSERT_EQ(walHandle.appendPage(inBuffer), success) << "Appending a page should succeed.";
+        }
+        for (unsigned i = 0; i < numPages / 2; i++) {
+            generateData(inBuffer, PAGE_SIZE, 61 + i, 13 + i);
+            ASSERT_EQ(walHandle.writePage(i, inBuffer), success) << "Writing a page should succeed.";
+        }
+        ASSERT_EQ(walHandle.commit(), success) << "Committing should succeed.";
+        ASSERT_GT(getFileSize(walFileName + walSuffix), 0) << "The writes should be in the log.";
+
+        // Crash: only what is on disk right now survives
+        {
+            std::ifstream fileIn(walFileName, std::ios::binary), logIn(walFileName + walSuffix, std::ios::binary);
+            std::ofstream fileOut(copyFileName, std::ios::binary), logOut(copyFileName + walSuffix, std::ios::binary);
+            fileOut << fileIn.rdbuf();
+            logOut << logIn.rdbuf();
+        }
+
+        ASSERT_EQ(walHandle.sync(), success) << "Syncing should succeed.";
+        ASSERT_EQ(getFileSize(walFileName + walSuffix), 0) << "A checkpoint should empty the log.";
+        ASSERT_EQ(pfm.closeFile(walHandle), success) << "Closing the file should succeed.";
+
+        PeterDB::FileHandle copyHandle;
+        ASSERT_EQ(pfm.openFile(copyFileName, copyHandle), success) << "Opening the copy should recover it.";
+        ASSERT_EQ(copyHandle.getNumberOfPages(), numPages) << "Every logged append should be recovered.";
+        for (unsigned i = 0; i < numPages; i++) {
+            if (i < numPages / 2) generateData(inBuffer, PAGE_SIZE, 61 + i, 13 + i);
+            else generateData(inBuffer, PAGE_SIZE, 11 + i, 31 - i);
+            ASSERT_EQ(copyHandle.readPage(i, outBuffer), success) << "Reading a page should succeed.";
+            ASSERT_EQ(memcmp(inBuffer, outBuffer, PAGE_SIZE), 0) << "The recovered page should hold the last write.";
+        }
+        ASSERT_EQ(pfm.closeFile(copyHandle), success) << "Closing the copy should succeed.";
+        pfm.setWALEnabled(false);
+
+        ASSERT_EQ(pfm.destroyFile(walFileName), success) << "Destroying the file should succeed.";
+        ASSERT_EQ(pfm.destroyFile(copyFileName), success) << "Destroying the copy should succeed.";
+        ASSERT_FALSE(fileExists(walFileName + walSuffix)) << "The log should be destroyed with the file.";
+        ASSERT_FALSE(fileExists(copyFileName + walSuffix)) << "The log should be destroyed with the file.";
+    }
+
+    TEST_F (PFM_Private_Test, check_log_truncation) {
+        // Functions Tested:
+        // 1. Append and Flush log records
+        // 2. Truncate drops the records up to the checkpoint and keeps the later ones
+        // 3. Records appended after the truncation follow the kept ones
+
+        std::string logName = "pfm_private_log_file";
+        PeterDB::WriteAheadLog wal;
+        ASSERT_EQ(wal.open(logName, 0), success) << "Opening the log should succeed.";
+
+        unsigned numRecords = 8, checkpointLSN = 6;
+        inBuffer = malloc(PAGE_SIZE * (numRecords + 1));
+        for (unsigned i = 0; i < numRecords + 1; i++) {
+            generateData((char *) inBuffer + i * PAGE_SIZE, PAGE_SIZE, 23 + i, 47 - i);
+        }
+        for (unsigned i = 0; i < numRecords; i++) {
+            ASSERT_EQ(wal.append(i, (char *) inBuffer + i * PAGE_SIZE), i + 1) << "Appending a record should succeed.";
+        }
+        ASSERT_EQ(wal.flush(numRecords), success) << "Flushing the log should succeed.";
+        off_t recordSize = wal.getLogSize() / numRecords;
+        ASSERT_GT(recordSize, PAGE_SIZE) << "A record should hold a page image.";
+
+        ASSERT_EQ(wal.truncate(checkpointLSN), success) << "Truncating the log should succeed.";
+        ASSERT_EQ(wal.getLogSize(), (numRecords - checkpointLSN) * recordSize)
+                                    << "Only the records after the checkpoint should be kept.";
+        ASSERT_EQ(wal.append(numRecords, (char *) inBuffer + numRecords * PAGE_SIZE), numRecords + 1)
+                                    << "Appending a record should succeed.";
+        ASSERT_EQ(wal.flush(numRecords + 1), success) << "Flushing the log should succeed.";
+        ASSERT_EQ(getFileSize(logName), (numRecords + 1 - checkpointLSN) * recordSize)
+                                    << "The log file should hold the kept and the new records.";
+
+        // The page images follow their record headers
+        std::ifstream logIn(logName, std::ios::binary);
+        std::vector<char> record(recordSize);
+        for (unsigned lsn = checkpointLSN + 1; lsn <= numRecords + 1; lsn++) {
+            ASSERT_TRUE(logIn.read(record.data(), recordSize)) << "Reading a record should succeed.";
+            ASSERT_EQ(memcmp(record.data() + recordSize - PAGE_SIZE, (char *) inBuffer + (lsn - 1) * PAGE_SIZE,
+                             PAGE_SIZE), 0) << "The log should hold the records after the checkpoint in order.";
+        }
+        ASSERT_EQ(wal.close(), success) << "Closing the log should succeed.";
+        ASSERT_EQ(remove(logName.c_str()), 0) << "Removing the log should succeed.";
+    }
+
+    TEST_F (PFM_Private_Test, check_background_writer) {
+        // Functions Tested:
+        // 1. Write Page leaves dirty pages in the buffer pool
+        // 2. The background writer cleans them once the pool is dirtier than the target
+        // 3. A periodic checkpoint empties the log of a file with no dirty pages left
+
+        PeterDB::BufferPoolManager &bpm = PeterDB::BufferPoolManager::instance();
+        std::string walFileName = "pfm_private_writer_file";
+        std::string walSuffix = PFM_WAL_SUFFIX;
+        if (fileExists(walFileName)) ASSERT_EQ(pfm.destroyFile(walFileName), success);
+
+        pfm.setWALEnabled(true);
+        ASSERT_EQ(pfm.createFile(walFileName), success) << "Creating the file should succeed.";
+        PeterDB::FileHandle walHandle;
+        ASSERT_EQ(pfm.openFile(walFileName, walHandle), success) << "Opening the file should succeed.";
+        pfm.setWALEnabled(false);
+
+        unsigned numPages = 16;
+        inBuffer = malloc(PAGE_SIZE);
+        outBuffer = malloc(PAGE_SIZE);
+        for (unsigned i = 0; i < numPages; i++) {
+            generateData(inBuffer, PAGE_SIZE, 7 + i, 41 - i);
+            ASSERT_EQ(walHandle.appendPage(inBuffer), success) << "Appending a page should succeed.";
+            generateData(inBuffer, PAGE_SIZE, 19 + i, 3 + i);
+            ASSERT_EQ(walHandle.writePage(i, inBuffer), success) << "Writing a page should succeed.";
+        }
+        ASSERT_GE(bpm.getNumDirtyFrames(), numPages) << "Written pages should stay dirty in the pool.";
+
+        unsigned targetDirtyPercent = bpm.getTargetDirtyPercent();
+        unsigned checkpointInterval = bpm.getCheckpointInterval();
+        bpm.setTargetDirtyPercent(0);
+        bpm.setCheckpointInterval(50);
+        for (int i = 0; i < 100 && (bpm.getNumDirtyFrames() > 0 || getFileSize(walFileName + walSuffix) > 0); i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        bpm.setTargetDirtyPercent(targetDirtyPercent);
+        bpm.setCheckpointInterval(checkpointInterval);
+        ASSERT_EQ(bpm.getNumDirtyFrames(), 0) << "The background writer should clean every page.";
+        ASSERT_EQ(getFileSize(walFileName + walSuffix), 0) << "A checkpoint should empty the log.";
+
+        for (unsigned i = 0; i < numPages; i++) {
+            generateData(inBuffer, PAGE_SIZE, 19 + i, 3 + i);
+            ASSERT_EQ(walHandle.readPage(i, outBuffer), success) << "Reading a page should succeed.";
+            ASSERT_EQ(memcmp(inBuffer, outBuffer, PAGE_SIZE), 0) << "Checking the integrity of the page should succeed.";
+        }
+        ASSERT_EQ(pfm.closeFile(walHandle), success) << "Closing the file should succeed.";
+        ASSERT_EQ(pfm.destroyFile(walFileName), success) << "Destroying the file should succeed.";
+    }
+
+    TEST_F (PFM_Private_Test, check_dirty_eviction) {
+        // Functions Tested:
+        // 1. Write Page in a pool that only holds dirty pages writes a victim back to make room
+        // 2. The evicted pages are read back with their latest contents
+
+        PeterDB::BufferPoolManager &bpm = PeterDB::BufferPoolManager::instance();
+        unsigned numFrames = bpm.getNumFrames();
+        unsigned targetDirtyPercent = bpm.getTargetDirtyPercent();
+        ASSERT_EQ(bpm.setNumFrames(4), success) << "Resizing the pool should succeed.";
+        bpm.setTargetDirtyPercent(100);
+
+        unsigned numPages = 16;
+        inBuffer = malloc(PAGE_SIZE);
+        outBuffer = malloc(PAGE_SIZE);
+        unsigned firstPageNum = fileHandle.getNumberOfPages();
+        for (unsigned i = 0; i < numPages; i++) {
+            generateData(inBuffer, PAGE_SIZE, 23 + i, 31 - i);
+            ASSERT_EQ(fileHandle.appendPage(inBuffer), success) << "Appending a page should succeed.";
+        }
+        unsigned long long numWriteBacks = bpm.getNumWriteBacks();
+        for (unsigned i = 0; i < numPages; i++) {
+            generateData(inBuffer, PAGE_SIZE, 29 + i, 5 + i);
+            ASSERT_EQ(fileHandle.writePage(firstPageNum + i, inBuffer), success) << "Writing a page should succeed.";
+        }
+        ASSERT_GE(bpm.getNumWriteBacks() - numWriteBacks, numPages - 4) << "Dirty victims should be written back.";
+
+        for (unsigned i = 0; i < numPages; i++) {
+            generateData(inBuffer, PAGE_SIZE, 29 + i, 5 + i);
+            ASSERT_EQ(fileHandle.readPage(firstPageNum + i, outBuffer), success) << "Reading a page should succeed.";
+            ASSERT_EQ(memcmp(inBuffer, outBuffer, PAGE_SIZE), 0) << "Checking the integrity of the page should succeed.";
+        }
+        bpm.setTargetDirtyPercent(targetDirtyPercent);
+        ASSERT_EQ(bpm.setNumFrames(numFrames), success) << "Resizing the pool should succeed.";
+    }
+
+    TEST_F (PFM_Private_Test, check_page_size_in_header) {
+        // Functions Tested:
+        // 1. Create File records the page size in the hidden page
+        // 2. Open File rejects a file that was built with another page size, also when mapped
+
+        std::string copyFileName = "pfm_private_page_size_file";
+        if (fileExists(copyFileName)) ASSERT_EQ(pfm.destroyFile(copyFileName), success);
+
+        unsigned header[8];
+        {
+            std::ifstream fileIn(fileName, std::ios::binary);
+            fileIn.read((char*) header, sizeof(header));
+            ASSERT_TRUE(fileIn.good()) << "The hidden page should be readable.";
+        }
+        ASSERT_EQ(header[7], PAGE_SIZE) << "The hidden page should hold the page size.";
+
+        // Same file, but claiming another page size
+        {
+            std::ifstream fileIn(fileName, std::ios::binary);
+            std::ofstream fileOut(copyFileName, std::ios::binary);
+            fileOut << fileIn.rdbuf();
+            header[7] = PAGE_SIZE == 4096 ? 8192 : PAGE_SIZE / 2;
+            fileOut.seekp(0);
+            fileOut.write((char*) header, sizeof(header));
+        }
+        PeterDB::FileHandle copyHandle;
+        ASSERT_NE(pfm.openFile(copyFileName, copyHandle), success) << "Opening a file with another page size should fail.";
+        ASSERT_NE(pfm.openFile(copyFileName, copyHandle, PeterDB::MappedReadOnlyMode), success)
+                                    << "Mapping a file with another page size should fail.";
+        ASSERT_FALSE(copyHandle.isMapped()) << "A rejected mapping should not be kept.";
+        ASSERT_EQ(pfm.destroyFile(copyFileName), success) << "Destroying the file should succeed.";
+    }
+
+    TEST_F (PFM_Private_Test, check_compressed_pages) {
+        // Functions Tested:
+        // 1. Append Page and Write Page on a file created with compression enabled
+        // 2. The file takes less space than its pages
+        // 3. Page numbers stay stable when a page stops compressing, also after reopening
+        // 4. The I/O statistics count the compressed bytes
+        // 5. A compressed file can't be mapped
+
+        std::string compressedFileName = "pfm_private_compressed_file";
+        std::string mapSuffix = PFM_MAP_SUFFIX;
+        if (fileExists(compressedFileName)) ASSERT_EQ(pfm.destroyFile(compressedFileName), success);
+
+        pfm.setCompressionEnabled(true);
+        ASSERT_EQ(pfm.createFile(compressedFileName), success) << "Creating the file should succeed.";
+        pfm.setCompressionEnabled(false);
+        ASSERT_TRUE(fileExists(compressedFileName + mapSuffix)) << "A compressed file should have a page map.";
+
+        PeterDB::FileHandle compressedHandle;
+        ASSERT_EQ(pfm.openFile(compressedFileName, compressedHandle), success) << "Opening the file should succeed.";
+        unsigned numPages = 32;
+        inBuffer = malloc(PAGE_SIZE);
+        outBuffer = malloc(PAGE_SIZE);
+        for (unsigned i = 0; i < numPages; i++) {
+            generateData(inBuffer, PAGE_SIZE, 37 + i, 59 - i);
+            ASSERT_EQ(compressedHandle.appendPage(inBuffer), success) << "Appending a page should succeed.";
+        }
+        ASSERT_EQ(compressedHandle.sync(), success) << "Syncing the file should succeed.";
+        ASSERT_LT(getFileSize(compressedFileName), (std::streamoff) (numPages + 1) * PAGE_SIZE / 2)
+                                    << "Compressed pages should take less than half the space.";
+        PeterDB::IOStatistics stats;
+        ASSERT_EQ(compressedHandle.collectIOStatistics(stats), success) << "Collecting statistics should succeed.";
+        ASSERT_EQ(stats.pagesAppended, numPages) << "The appends should be counted.";
+        ASSERT_LT(stats.bytesWritten, (unsigned long long) numPages * PAGE_SIZE / 2)
+                                    << "Only the compressed bytes should be counted as written.";
+
+        // Page 5 no longer compresses and has to move
+        unsigned movedPageNum = 5;
+        srand(17);
+        for (unsigned i = 0; i < PAGE_SIZE; i++) ((char*) inBuffer)[i] = (char) rand();
+        ASSERT_EQ(compressedHandle.writePage(movedPageNum, inBuffer), success) << "Writing a page should succeed.";
+        ASSERT_EQ(pfm.closeFile(compressedHandle), success) << "Closing the file should succeed.";
+
+        ASSERT_EQ(pfm.openFile(compressedFileName, compressedHandle), success) << "Opening the file should succeed.";
+        ASSERT_EQ(compressedHandle.getNumberOfPages(), numPages) << "The file should have all its pages.";
+        ASSERT_EQ(compressedHandle.readPage(movedPageNum, outBuffer), success) << "Reading a page should succeed.";
+        ASSERT_EQ(memcmp(inBuffer, outBuffer, PAGE_SIZE), 0) << "Checking the integrity of the page should succeed.";
+        for (unsigned i = 0; i < numPages; i++) {
+            if (i == movedPageNum) continue;
+            generateData(inBuffer, PAGE_SIZE, 37 + i, 59 - i);
+            ASSERT_EQ(compressedHandle.readPage(i, outBuffer), success) << "Reading a page should succeed.";
+            ASSERT_EQ(memcmp(inBuffer, outBuffer, PAGE_SIZE), 0) << "Checking the integrity of the page should succeed.";
+        }
+        ASSERT_EQ(pfm.closeFile(compressedHandle), success) << "Closing the file should succeed.";
+
+        PeterDB::FileHandle mappedHandle;
+        ASSERT_NE(pfm.openFile(compressedFileName, mappedHandle, PeterDB::MappedReadOnlyMode), success)
+                                    << "Mapping a compressed file should fail.";
+        ASSERT_FALSE(mappedHandle.isMapped()) << "A rejected mapping should not be kept.";
+        ASSERT_NE(mappedHandle.appendPage(inBuffer), success) << "A rejected mapping should not be writable.";
+        ASSERT_EQ(pfm.destroyFile(compressedFileName), success) << "Destroying the file should succeed.";
+        ASSERT_FALSE(fileExists(compressedFileName + mapSuffix)) << "The page map should be destroyed with the file.";
+    }
+
+    TEST_F (PFM_Private_Test, check_page_checksums) {
+        // Functions Tested:
+        // 1. Append Page and Write Page on a file created with checksums enabled
+        // 2. A page corrupted on disk fails to be read and is counted
+        // 3. Reading it succeeds again with verification turned off
+
+        std::string checksumFileName = "pfm_private_checksum_file";
+        std::string crcSuffix = PFM_CRC_SUFFIX;
+        if (fileExists(checksumFileName)) ASSERT_EQ(pfm.destroyFile(checksumFileName), success);
+
+        pfm.setChecksumsEnabled(true);
+        ASSERT_EQ(pfm.createFile(checksumFileName), success) << "Creating the file should succeed.";
+        pfm.setChecksumsEnabled(false);
+        ASSERT_TRUE(fileExists(checksumFileName + crcSuffix)) << "A checksummed file should have checksums.";
+
+        PeterDB::FileHandle checksumHandle;
+        ASSERT_EQ(pfm.openFile(checksumFileName, checksumHandle), success) << "Opening the file should succeed.";
+        ASSERT_TRUE(checksumHandle.getChecksumVerification()) << "Verification should be on by default.";
+        unsigned numPages = 8;
+        inBuffer = malloc(PAGE_SIZE);
+        outBuffer = malloc(PAGE_SIZE);
+        for (unsigned i = 0; i < numPages; i++) {
+            generateData(inBuffer, PAGE_SIZE, 29 + i, 31 - i);
+            ASSERT_EQ(checksumHandle.appendPage(inBuffer), success) << "Appending a page should succeed.";
+        }
+        generateData(inBuffer, PAGE_SIZE, 7, 11);
+        ASSERT_EQ(checksumHandle.writePage(2, inBuffer), success) << "Writing a page should succeed.";
+        ASSERT_EQ(pfm.closeFile(checksumHandle), success) << "Closing the file should succeed.";
+
+        // Close the descriptor too, so no page of the file stays cached
+        unsigned maxIdleFiles = pfm.getMaxIdleFiles();
+        pfm.setMaxIdleFiles(0);
+        pfm.setMaxIdleFiles(maxIdleFiles);
+
+        // Flip a byte of page 5 behind our back
+        unsigned corruptPageNum = 5;
+        {
+            std::fstream fileStream(checksumFileName, std::ios::in | std::ios::out | std::ios::binary);
+            fileStream.seekg((std::streamoff) (1 + corruptPageNum) * PAGE_SIZE + 100);
+            char byte = (char) fileStream.get();
+            fileStream.seekp((std::streamoff) (1 + corruptPageNum) * PAGE_SIZE + 100);
+            fileStream.put((char) ~byte);
+        }
+
+        ASSERT_EQ(pfm.openFile(checksumFileName, checksumHandle), success) << "Opening the file should succeed.";
+        ASSERT_EQ(checksumHandle.readPage(2, outBuffer), success) << "Reading a page should succeed.";
+        ASSERT_EQ(memcmp(inBuffer, outBuffer, PAGE_SIZE), 0) << "Checking the integrity of the page should succeed.";
+        ASSERT_NE(checksumHandle.readPage(corruptPageNum, outBuffer), success)
+                                    << "Reading a corrupted page should fail.";
+        unsigned readPageCount, writePageCount, appendPageCount, hitCount, missCount, checksumErrorCount;
+        ASSERT_EQ(checksumHandle.collectCounterValues(readPageCount, writePageCount, appendPageCount, hitCount,
+                                                      missCount, checksumErrorCount), success)
+                                    << "Collecting counters should succeed.";
+        ASSERT_EQ(checksumErrorCount, 1) << "The corrupted page should be counted.";
+
+        checksumHandle.setChecksumVerification(false);
+        ASSERT_EQ(checksumHandle.readPage(corruptPageNum, outBuffer), success)
+                                    << "Reading without verification should succeed.";
+        ASSERT_EQ(pfm.closeFile(checksumHandle), success) << "Closing the file should succeed.";
+        ASSERT_EQ(pfm.destroyFile(checksumFileName), success) << "Destroying the file should succeed.";
+        ASSERT_FALSE(fileExists(checksumFileName + crcSuffix)) << "The checksums should be destroyed with the file.";
+    }
+
+    TEST_F (PFM_Private_Test, check_temp_file) {
+        // Functions Tested:
+        // 1. Create Temp File, Append Page and Read Page while the pages are in memory
+        // 2. Append Page past the memory limit spills the file, the pages are still there
+        // 3. Write Page and Read Page after spilling
+
+        PeterDB::FileHandle tempHandle;
+        unsigned maxMemoryPages = 8;
+        ASSERT_EQ(pfm.createTempFile(tempHandle, maxMemoryPages * PAGE_SIZE), success)
+                                    << "Creating a temporary file should succeed.";
+        ASSERT_TRUE(tempHandle.isTemporary()) << "The file should be temporary.";
+        ASSERT_EQ(tempHandle.getNumberOfPages(), 0) << "A new temporary file should be empty.";
+
+        inBuffer = malloc(PAGE_SIZE);
+        outBuffer = malloc(PAGE_SIZE);
+        for (unsigned i = 0; i < maxMemoryPages; i++) {
+            generateData(inBuffer, PAGE_SIZE, 13 + i, 19 - i);
+            ASSERT_EQ(tempHandle.appendPage(inBuffer), success) << "Appending a page should succeed.";
+        }
+        ASSERT_FALSE(tempHandle.isSpilled()) << "Pages within the limit should stay in memory.";
+
+        unsigned numPages = 3 * maxMemoryPages;
+        for (unsigned i = maxMemoryPages; i < numPages; i++) {
+            generateData(inBuffer, PAGE_SIZE, 13 + i, 19 - i);
+            ASSERT_EQ(tempHandle.appendPage(inBuffer), success) << "Appending a page should succeed.";
+        }
+        ASSERT_TRUE(tempHandle.isSpilled()) << "Pages past the limit should spill the file.";
+        ASSERT_EQ(tempHandle.getNumberOfPages(), numPages) << "The file should have all its pages.";
+
+        generateData(inBuffer, PAGE_SIZE, 3, 7);
+        ASSERT_EQ(tempHandle.writePage(1, inBuffer), success) << "Writing a page should succeed.";
+        ASSERT_EQ(tempHandle.readPage(1, outBuffer), success) << "Reading a page should succeed.";
+        ASSERT_EQ(memcmp(inBuffer, outBuffer, PAGE_SIZE), 0) << "Checking the integrity of the page should succeed.";
+
+        // Read them all back with one call
+        std::vector<char> pages((size_t) numPages * PAGE_SIZE);
+        ASSERT_EQ(tempHandle.readPages(0, numPages, pages.data()), success) << "Reading pages should succeed.";
+        for (unsigned i = 0; i < numPages; i++) {
+            if (i == 1) continue;
+            generateData(inBuffer, PAGE_SIZE, 13 + i, 19 - i);
+            ASSERT_EQ(memcmp(inBuffer, pages.data() + (size_t) i * PAGE_SIZE, PAGE_SIZE), 0)
+                                        << "Checking the integrity of the page should succeed.";
+        }
+        ASSERT_EQ(pfm.closeFile(tempHandle), success) << "Closing the file should succeed.";
+    }
+
+    TEST_F (PFM_Private_Test, check_io_statistics) {
+        // Functions Tested:
+        // 1. Append Page and Read Pages are counted as appends and reads of the file, with their bytes and latencies
+        // 2. Reads in page order are sequential, jumping back is random
+        // 3. The statistics of all files include those of the file
+        // 4. Pages of a temporary file that stay in memory are no disk I/O
+
+        pfm.resetIOStatistics();
+        inBuffer = malloc(PAGE_SIZE);
+        unsigned numPages = 16;
+        unsigned firstPageNum = fileHandle.getNumberOfPages();
+        for (unsigned i = 0; i < numPages; i++) {
+            generateData(inBuffer, PAGE_SIZE, 41 + i, 43 - i);
+            ASSERT_EQ(fileHandle.appendPage(inBuffer), success) << "Appending a page should succeed.";
+        }
+
+        std::vector<char> pages((size_t) numPages * PAGE_SIZE);
+        PeterDB::IOStatistics before, after, allFiles;
+        ASSERT_EQ(fileHandle.collectIOStatistics(before), success) << "Collecting statistics should succeed.";
+        ASSERT_EQ(fileHandle.readPages(firstPageNum + 1, numPages / 2 - 1, pages.data()), success);
+        ASSERT_EQ(fileHandle.readPages(firstPageNum + numPages / 2, numPages / 2, pages.data()), success);
+        ASSERT_EQ(fileHandle.readPages(firstPageNum, 1, pages.data()), success);
+        ASSERT_EQ(fileHandle.collectIOStatistics(after), success) << "Collecting statistics should succeed.";
+
+        ASSERT_GE(after.pagesAppended, numPages) << "The appends should be counted.";
+        ASSERT_GE(after.appendLatency.count, numPages) << "Every append should be timed.";
+        ASSERT_EQ(after.pagesRead - before.pagesRead, numPages) << "The pages read should be counted.";
+        ASSERT_EQ(after.bytesRead - before.bytesRead, (unsigned long long) numPages * PAGE_SIZE)
+                                    << "The bytes read should be counted.";
+        ASSERT_EQ(after.sequentialReads - before.sequentialReads, 1) << "The second read should be sequential.";
+        ASSERT_EQ(after.randomReads - before.randomReads, 2) << "The first and the last read should be random.";
+        ASSERT_EQ(after.readLatency.count - before.readLatency.count, 3) << "Every read should be timed.";
+        ASSERT_GE(PeterDB::IOStatsCollector::getLatencyPercentile(after.readLatency, 99), after.readLatency.maxMicros)
+                                    << "The slowest read should be within the 99th percentile bucket.";
+
+        pfm.collectIOStatistics(allFiles);
+        ASSERT_GE(allFiles.pagesRead, after.pagesRead) << "All files should include the reads of the file.";
+        ASSERT_GE(allFiles.pagesAppended, after.pagesAppended) << "All files should include the appends of the file.";
+
+        unsigned long long readPageCount, writePageCount, appendPageCount;
+        unsigned readPageCount32, writePageCount32, appendPageCount32;
+        ASSERT_EQ(fileHandle.collectCounterValues(readPageCount, writePageCount, appendPageCount), success);
+        ASSERT_EQ(fileHandle.collectCounterValues(readPageCount32, writePageCount32, appendPageCount32), success);
+        ASSERT_EQ(readPageCount, readPageCount32) << "Small counters should be the same either way.";
+        ASSERT_EQ(appendPageCount, appendPageCount32) << "Small counters should be the same either way.";
+
+        PeterDB::FileHandle tempHandle;
+        ASSERT_EQ(pfm.createTempFile(tempHandle, (size_t) numPages * PAGE_SIZE), success)
+                                    << "Creating a temporary file should succeed.";
+        for (unsigned i = 0; i < numPages; i++) {
+            ASSERT_EQ(tempHandle.appendPage(pages.data() + (size_t) i * PAGE_SIZE), success)
+                                        << "Appending a page should succeed.";
+        }
+        ASSERT_EQ(tempHandle.readPages(0, numPages, pages.data()), success) << "Reading pages should succeed.";
+        ASSERT_EQ(tempHandle.collectIOStatistics(after), success) << "Collecting statistics should succeed.";
+        ASSERT_FALSE(tempHandle.isSpilled()) << "Pages within the limit should stay in memory.";
+        ASSERT_EQ(after.bytesRead, 0) << "Reads from memory should not be counted as disk I/O.";
+        ASSERT_EQ(after.bytesWritten, 0) << "Writes to memory should not be counted as disk I/O.";
+        ASSERT_EQ(pfm.closeFile(tempHandle), success) << "Closing the file should succeed.";
+    }
+
 }
@@ -426,7 +426,7 @@ namespace PeterDBTesting {
         // 1. Create File - RBFM
         // 2. Open File
         // 3. insertRecord() - checks if we can't find an enough space in the last page,
-        //                     the system checks from the beginning of the file.
+        //                     the free space map sends the record to a new page.
         // 4. Close File
         // 5. Destroy File
 
@@ -434,10 +434,6 @@ namespace PeterDBTesting {
         unsigned updatedReadPageCount = 0, updatedWritePageCount = 0, updatedAppendPageCount = 0;
         unsigned deltaReadPageCount, deltaWritePageCount, deltaAppendPageCount;
 
-        // Get the initial number of pages in the file.
-        // If the file size is bigger than number of pages, we assume there are hidden pages.
-        bool hiddenPageExists = fileHandle.getNumberOfPages() < getFileSize(fileName) % PAGE_SIZE;
-
         PeterDB::RID rid;
         size_t recordSize = 0;
         inBuffer = malloc(3000);
@@ -480,19 +476,12 @@ namespace PeterDBTesting {
         deltaWritePageCount = updatedWritePageCount - writePageCount;
         deltaAppendPageCount = updatedAppendPageCount - appendPageCount;
 
-        // If a directory exists in hidden pages, then we need to read at least one page and append one page.
-        // Also, we need to update the directory structure. So, we need to have one write.
-        if (hiddenPageExists) {
-            ASSERT_TRUE(deltaReadPageCount >= 1 && deltaReadPageCount < numRecords)
-                                        << "The implementation regarding insertRecord() is not correct.";
-            ASSERT_GE(deltaWritePageCount, 1) << "The implementation regarding insertRecord() is not correct.";
-            ASSERT_GE(deltaAppendPageCount, 1) << "The implementation regarding insertRecord() is not correct.";
-
-        } else {
-            // Each page can only contain one record. So, deltaReadPageCount should be greater than or equal to 30
-            // since the system needs to go through all pages from the beginning.
-            ASSERT_GE(deltaReadPageCount, numRecords) << "The implementation regarding insertRecord() is not correct.";
-        }
+        // The free space map is the directory: reading it shows no page has room, so one page is appended.
+        // Also, we need to write the new page and its map entry.
+        ASSERT_TRUE(deltaReadPageCount >= 1 && deltaReadPageCount < numRecords)
+                                    << "The implementation regarding insertRecord() is not correct.";
+        ASSERT_GE(deltaWritePageCount, 1) << "The implementation regarding insertRecord() is not correct.";
+        ASSERT_GE(deltaAppendPageCount, 1) << "The implementation regarding insertRecord() is not correct.";
 
         ASSERT_GT(getFileSize(fileName), 0) << "File Size should not be zero at this moment.";
     }
@@ -634,5 +623,630 @@ namespace PeterDBTesting {
 
     }
 
+
+    TEST_F(RBFM_Private_Test, insert_with_free_space_map) {
+        // Functions Tested:
+        // 1. insertRecord() - a full file is not scanned, the free space map names the page
+        // 2. deleteRecord() - the space given back is offered by the map again
+        // 3. scan() - map pages are skipped
+
+        int numRecords = 4000;
+        std::vector<PeterDB::RID> rids;
+        PeterDB::RID rid;
+        size_t recordSize = 0;
+        inBuffer = malloc(100);
+        outBuffer = malloc(100);
+
+        std::vector<PeterDB::Attribute> recordDescriptor;
+        createRecordDescriptor(recordDescriptor);
+        nullsIndicator = initializeNullFieldsIndicator(recordDescriptor);
+        prepareRecord(recordDescriptor.size(), nullsIndicator, 8, "Anteater", 25, 177.8, 6200, inBuffer, recordSize);
+
+        unsigned readPageCount = 0, writePageCount = 0, appendPageCount = 0;
+        unsigned lastReadPageCount = 0;
+        for (int i = 0; i < numRecords; i++) {
+            ASSERT_EQ(rbfm.insertRecord(fileHandle, recordDescriptor, inBuffer, rid), success)
+                                        << "Inserting a record should succeed.";
+            ASSERT_FALSE(rbfm.isFreeSpaceMapPage(rid.pageNum)) << "A record should never land on a map page.";
+            rids.push_back(rid);
+
+            fileHandle.collectCounterValues(readPageCount, writePageCount, appendPageCount);
+            ASSERT_LE(readPageCount - lastReadPageCount, 2) << "insertRecord should read the map and one page.";
+            lastReadPageCount = readPageCount;
+        }
+        ASSERT_GT(fileHandle.getNumberOfPages(), 20) << "The records should span many pages.";
+
+        // Open up room on an early page
+        unsigned targetPageNum = rids[100].pageNum;
+        unsigned numDeleted = 0;
+        for (int i = 0; i < numRecords && numDeleted < 10; i++) {
+            if (rids[i].pageNum != targetPageNum) continue;
+            ASSERT_EQ(rbfm.deleteRecord(fileHandle, recordDescriptor, rids[i]), success)
+                                        << "Deleting a record should succeed.";
+            numDeleted++;
+        }
+
+        fileHandle.collectCounterValues(readPageCount, writePageCount, appendPageCount);
+        lastReadPageCount = readPageCount;
+        ASSERT_EQ(rbfm.insertRecord(fileHandle, recordDescriptor, inBuffer, rid), success)
+                                    << "Inserting a record should succeed.";
+        fileHandle.collectCounterValues(readPageCount, writePageCount, appendPageCount);
+        ASSERT_LE(readPageCount - lastReadPageCount, 2) << "insertRecord should read the map and one page.";
+        ASSERT_EQ(rid.pageNum, targetPageNum) << "The freed space should be reused.";
+
+        ASSERT_EQ(rbfm.readRecord(fileHandle, recordDescriptor, rid, outBuffer), success)
+                                    << "Reading a record should succeed.";
+        ASSERT_EQ(memcmp(inBuffer, outBuffer, recordSize), 0) << "Reading fields incorrectly.";
+
+        // Every live record and nothing else comes out of a scan
+        PeterDB::RBFM_ScanIterator rbfmScanIterator;
+        std::vector<std::string> attributeNames{"Age"};
+        ASSERT_EQ(rbfm.scan(recordDescriptor, "", PeterDB::NO_OP, NULL, attributeNames, rbfmScanIterator), success)
+                                    << "Scan should succeed.";
+        ASSERT_EQ(rbfm.openFile(fileName, rbfmScanIterator.fileHandle), success) << "Opening the file should succeed.";
+        int numScanned = 0;
+        while (rbfmScanIterator.getNextRecord(rid, outBuffer) != RBFM_EOF) numScanned++;
+        rbfmScanIterator.close();
+        ASSERT_EQ(rbfm.closeFile(rbfmScanIterator.fileHandle), success) << "Closing the file should succeed.";
+        ASSERT_EQ(numScanned, numRecords - numDeleted + 1) << "The scan should return every record once.";
+    }
+
+
+    TEST_F(RBFM_Private_Test, bulk_insert_records) {
+        // Functions Tested:
+        // 1. insertRecords() - pages are built in memory and appended with one write each
+        // 2. readRecord() - every returned RID leads to its record
+        // 3. insertRecord() - the partly filled pages are still found through the free space map
+
+        int numRecords = 10000;
+        size_t recordSize = 0;
+        outBuffer = malloc(100);
+
+        std::vector<PeterDB::Attribute> recordDescriptor;
+        createRecordDescriptor(recordDescriptor);
+        nullsIndicator = initializeNullFieldsIndicator(recordDescriptor);
+
+        std::vector<void*> records;
+        std::vector<const void*> batch;
+        std::vector<size_t> sizes;
+        for (int i = 0; i < numRecords; i++) {
+            void* record = malloc(100);
+            prepareRecord(recordDescriptor.size(), nullsIndicator, 8, "Anteater", i, 177.8 + i, 6200 + i, record,
+                          recordSize);
+            records.push_back(record);
+            batch.push_back(record);
+            sizes.push_back(recordSize);
+        }
+
+        unsigned readPageCount = 0, writePageCount = 0, appendPageCount = 0;
+        ASSERT_EQ(fileHandle.collectCounterValues(readPageCount, writePageCount, appendPageCount), success)
+                                    << "Collecting counters should succeed.";
+
+        std::vector<PeterDB::RID> rids;
+        ASSERT_EQ(rbfm.insertRecords(fileHandle, recordDescriptor, batch, rids, 0.8), success)
+                                    << "Inserting a batch should succeed.";
+        ASSERT_EQ(rids.size(), numRecords) << "Every record should get a RID.";
+
+        unsigned updatedReadPageCount = 0, updatedWritePageCount = 0, updatedAppendPageCount = 0;
+        ASSERT_EQ(fileHandle.collectCounterValues(updatedReadPageCount, updatedWritePageCount,
+                                                  updatedAppendPageCount), success)
+                                    << "Collecting counters should succeed.";
+        ASSERT_EQ(updatedReadPageCount - readPageCount, 0) << "A load into an empty file should not read pages.";
+        ASSERT_EQ(updatedAppendPageCount - appendPageCount, fileHandle.getNumberOfPages())
+                                    << "Each page should be appended once.";
+        ASSERT_LE(updatedWritePageCount - writePageCount, 1) << "Only the free space map should be rewritten.";
+
+        // RIDs come back in batch order and each page is filled before the next one
+        for (int i = 1; i < numRecords; i++) {
+            bool samePage = rids[i].pageNum == rids[i - 1].pageNum && rids[i].slotNum == rids[i - 1].slotNum + 1;
+            bool nextPage = rids[i].pageNum == rids[i - 1].pageNum + 1 && rids[i].slotNum == 0;
+            ASSERT_TRUE(samePage || nextPage) << "RIDs should follow the batch order.";
+        }
+        for (int i = 0; i < numRecords; i++) {
+            memset(outBuffer, 0, 100);
+            ASSERT_EQ(rbfm.readRecord(fileHandle, recordDescriptor, rids[i], outBuffer), success)
+                                        << "Reading a record should succeed.";
+            ASSERT_EQ(memcmp(records[i], outBuffer, sizes[i]), 0) << "Reading fields incorrectly.";
+        }
+
+        // The room left by the fill factor is used by later inserts
+        unsigned numPages = fileHandle.getNumberOfPages();
+        PeterDB::RID rid;
+        ASSERT_EQ(rbfm.insertRecord(fileHandle, recordDescriptor, records[0], rid), success)
+                                    << "Inserting a record should succeed.";
+        ASSERT_LT(rid.pageNum, numPages - 1) << "The record should go to a page of the batch.";
+        ASSERT_EQ(fileHandle.getNumberOfPages(), numPages) << "The file should not grow.";
+
+        for (void* record : records) free(record);
+    }
+
+
+    TEST_F(RBFM_Private_Test, scan_reads_each_page_once) {
+        // Functions Tested:
+        // 1. scan() - the current page stays in the iterator, each page is read exactly once
+
+        int numRecords = 3000;
+        PeterDB::RID rid;
+        size_t recordSize = 0;
+        inBuffer = malloc(100);
+        outBuffer = malloc(100);
+
+        std::vector<PeterDB::Attribute> recordDescriptor;
+        createRecordDescriptor(recordDescriptor);
+        nullsIndicator = initializeNullFieldsIndicator(recordDescriptor);
+
+        std::unordered_set<unsigned> pageNums;
+        for (int i = 0; i < numRecords; i++) {
+            prepareRecord(recordDescriptor.size(), nullsIndicator, 8, "Anteater", i, 177.8, 6200, inBuffer, recordSize);
+            ASSERT_EQ(rbfm.insertRecord(fileHandle, recordDescriptor, inBuffer, rid), success)
+                                        << "Inserting a record should succeed.";
+            pageNums.insert(rid.pageNum);
+        }
+
+        PeterDB::RBFM_ScanIterator rbfmScanIterator;
+        std::vector<std::string> attributeNames{"Age"};
+        int ageLimit = numRecords / 2;
+        ASSERT_EQ(rbfm.scan(recordDescriptor, "Age", PeterDB::GE_OP, &ageLimit, attributeNames, rbfmScanIterator),
+                  success) << "Scan should succeed.";
+        ASSERT_EQ(rbfm.openFile(fileName, rbfmScanIterator.fileHandle), success) << "Opening the file should succeed.";
+
+        unsigned readPageCount = 0, writePageCount = 0, appendPageCount = 0;
+        rbfmScanIterator.fileHandle.collectCounterValues(readPageCount, writePageCount, appendPageCount);
+        unsigned startReadPageCount = readPageCount;
+
+        int numScanned = 0;
+        while (rbfmScanIterator.getNextRecord(rid, outBuffer) != RBFM_EOF) {
+            int age;
+            memcpy(&age, (char*) outBuffer + 1, sizeof(int));
+            ASSERT_GE(age, ageLimit) << "The scan should only return matching records.";
+            numScanned++;
+        }
+        ASSERT_EQ(numScanned, numRecords - ageLimit) << "The scan should return every matching record.";
+
+        rbfmScanIterator.fileHandle.collectCounterValues(readPageCount, writePageCount, appendPageCount);
+        ASSERT_EQ(readPageCount - startReadPageCount, pageNums.size()) << "Each data page should be read once.";
+
+        rbfmScanIterator.close();
+        ASSERT_EQ(rbfm.closeFile(rbfmScanIterator.fileHandle), success) << "Closing the file should succeed.";
+    }
+
+
+    TEST_F(RBFM_Private_Test, scan_in_batches) {
+        // Functions Tested:
+        // 1. getNextBatch() - batches hold the same records, in the same order, as single getNextRecord() calls
+        // 2. getNextBatch() - a batch stops at maxRecords and at the end of the caller's buffer
+
+        int numRecords = 2000;
+        PeterDB::RID rid;
+        size_t recordSize = 0;
+        inBuffer = malloc(100);
+        outBuffer = malloc(100);
+
+        std::vector<PeterDB::Attribute> recordDescriptor;
+        createRecordDescriptor(recordDescriptor);
+        nullsIndicator = initializeNullFieldsIndicator(recordDescriptor);
+
+        for (int i = 0; i < numRecords; i++) {
+            prepareRecord(recordDescriptor.size(), nullsIndicator, i % 10, std::string(i % 10, 'a'), i, 177.8,
+                          i % 7 == 0 ? 0 : 6200, inBuffer, recordSize);
+            ASSERT_EQ(rbfm.insertRecord(fileHandle, recordDescriptor, inBuffer, rid), success)
+                                        << "Inserting a record should succeed.";
+        }
+
+        std::vector<std::string> attributeNames{"EmpName", "Age"};
+        int ageLimit = 500;
+
+        // Reference results, one record per call
+        std::vector<std::string> expected;
+        std::vector<unsigned> expectedPages;
+        PeterDB::RBFM_ScanIterator rbfmScanIterator;
+        ASSERT_EQ(rbfm.scan(recordDescriptor, "Age", PeterDB::GT_OP, &ageLimit, attributeNames, rbfmScanIterator),
+                  success) << "Scan should succeed.";
+        ASSERT_EQ(rbfm.openFile(fileName, rbfmScanIterator.fileHandle), success) << "Opening the file should succeed.";
+        while (rbfmScanIterator.getNextRecord(rid, outBuffer) != RBFM_EOF) {
+            unsigned nameLength;
+            memcpy(&nameLength, (char*) outBuffer + 1, sizeof(unsigned));
+            expected.emplace_back((char*) outBuffer, 1 + sizeof(unsigned) + nameLength + sizeof(int));
+            expectedPages.push_back(rid.pageNum);
+        }
+        rbfmScanIterator.close();
+        ASSERT_EQ(rbfm.closeFile(rbfmScanIterator.fileHandle), success) << "Closing the file should succeed.";
+        ASSERT_EQ(expected.size(), numRecords - ageLimit - 1) << "The scan should return every matching record.";
+
+        // The same scan in batches, the buffer is small enough to cut some batches short
+        const unsigned maxRecords = 64;
+        const size_t bufferSize = 1000;
+        std::vector<PeterDB::RID> rids(maxRecords);
+        char* batchBuffer = (char*) malloc(bufferSize);
+        ASSERT_EQ(rbfm.scan(recordDescriptor, "Age", PeterDB::GT_OP, &ageLimit, attributeNames, rbfmScanIterator),
+                  success) << "Scan should succeed.";
+        ASSERT_EQ(rbfm.openFile(fileName, rbfmScanIterator.fileHandle), success) << "Opening the file should succeed.";
+
+        unsigned numBatched = 0, count = 0;
+        PeterDB::RC rc;
+        while ((rc = rbfmScanIterator.getNextBatch(rids.data(), batchBuffer, bufferSize, maxRecords, count)) == success) {
+            ASSERT_GT(count, 0) << "A batch should hold at least one record.";
+            ASSERT_LE(count, maxRecords) << "A batch should not exceed maxRecords.";
+            size_t offset = 0;
+            for (unsigned i = 0; i < count; i++) {
+                unsigned nameLength;
+                memcpy(&nameLength, batchBuffer + offset + 1, sizeof(unsigned));
+                size_t length = 1 + sizeof(unsigned) + nameLength + sizeof(int);
+                ASSERT_LE(offset + length, bufferSize) << "Records should stay inside the buffer.";
+                ASSERT_EQ(std::string(batchBuffer + offset, length), expected[numBatched])
+                                            << "Batched records should match single record results.";
+                ASSERT_EQ(rids[i].pageNum, expectedPages[numBatched]) << "RIDs should match.";
+                offset += length;
+                numBatched++;
+            }
+        }
+        ASSERT_EQ(rc, RBFM_EOF) << "The batched scan should end with RBFM_EOF.";
+        ASSERT_EQ(numBatched, expected.size()) << "The batched scan should return every matching record.";
+
+        rbfmScanIterator.close();
+        ASSERT_EQ(rbfm.closeFile(rbfmScanIterator.fileHandle), success) << "Closing the file should succeed.";
+        free(batchBuffer);
+    }
+
+
+    TEST_F(RBFM_Private_Test, compiled_scan_predicates) {
+        // Functions Tested:
+        // 1. compilePredicate() - every type and operator agrees with a plain comparison
+        // 2. compilePredicate() - VarChar compares in std::string order, prefixes and empty strings included
+
+        std::vector<PeterDB::CompOp> ops{PeterDB::EQ_OP, PeterDB::LT_OP, PeterDB::LE_OP,
+                                         PeterDB::GT_OP, PeterDB::GE_OP, PeterDB::NE_OP};
+        auto expect = [](PeterDB::CompOp op, int cmp) {
+            switch (op) {
+                case PeterDB::EQ_OP: return cmp == 0;
+                case PeterDB::LT_OP: return cmp < 0;
+                case PeterDB::LE_OP: return cmp <= 0;
+                case PeterDB::GT_OP: return cmp > 0;
+                case PeterDB::GE_OP: return cmp >= 0;
+                case PeterDB::NE_OP: return cmp != 0;
+                default: return true;
+            }
+        };
+
+        std::vector<int> ints{INT32_MIN, -7, 0, 3, 42, INT32_MAX};
+        std::vector<float> reals{-1e9f, -0.5f, 0.0f, 1.25f, 3e7f};
+        std::vector<std::string> strings{"", "a", "ab", "abc", "abd", "b", std::string("\xff"), "Anteater"};
+
+        for (PeterDB::CompOp op : ops) {
+            PeterDB::RBFM_ScanIterator::Predicate intPredicate =
+                    PeterDB::RBFM_ScanIterator::compilePredicate(PeterDB::TypeInt, op);
+            for (int attr : ints) {
+                for (int value : ints) {
+                    ASSERT_EQ(intPredicate((const char*) &attr, (const char*) &value),
+                              expect(op, (attr > value) - (attr < value))) << "Int comparison is wrong.";
+                }
+            }
+
+            PeterDB::RBFM_ScanIterator::Predicate realPredicate =
+                    PeterDB::RBFM_ScanIterator::compilePredicate(PeterDB::TypeReal, op);
+            for (float attr : reals) {
+                for (float value : reals) {
+                    ASSERT_EQ(realPredicate((const char*) &attr, (const char*) &value),
+                              expect(op, (attr > value) - (attr < value))) << "Real comparison is wrong.";
+                }
+            }
+
+            PeterDB::RBFM_ScanIterator::Predicate varCharPredicate =
+                    PeterDB::RBFM_ScanIterator::compilePredicate(PeterDB::TypeVarChar, op);
+            for (const std::string &attr : strings) {
+                for (const std::string &value : strings) {
+                    std::string storedAttr(sizeof(unsigned), '\0'), storedValue(sizeof(unsigned), '\0');
+                    unsigned length = attr.size();
+                    memcpy(&storedAttr[0], &length, sizeof(unsigned));
+                    length = value.size();
+                    memcpy(&storedValue[0], &length, sizeof(unsigned));
+                    storedAttr += attr;
+                    storedValue += value;
+                    int cmp = attr.compare(value);
+                    ASSERT_EQ(varCharPredicate(storedAttr.data(), storedValue.data()), expect(op, (cmp > 0) - (cmp < 0)))
+                                                << "VarChar comparison is wrong: " << attr << " vs " << value;
+                }
+            }
+        }
+
+        // No condition lets every record through
+        PeterDB::RBFM_ScanIterator::Predicate noCondition =
+                PeterDB::RBFM_ScanIterator::compilePredicate(PeterDB::TypeInt, PeterDB::NO_OP);
+        int attr = 1, value = 2;
+        ASSERT_TRUE(noCondition((const char*) &attr, (const char*) &value)) << "NO_OP should match everything.";
+    }
+
+
+    TEST_F(RBFM_Private_Test, scan_with_multiple_conditions) {
+        // Functions Tested:
+        // 1. scan() - ANDed conditions on several attributes
+        // 2. scan() - ORed conditions, NO_OP conditions and null attributes
+        // 3. scan() - results stay the same while the conditions are reordered
+
+        int numRecords = 10000;
+        PeterDB::RID rid;
+        size_t recordSize = 0;
+        inBuffer = malloc(100);
+        outBuffer = malloc(100);
+
+        std::vector<PeterDB::Attribute> recordDescriptor;
+        createRecordDescriptor(recordDescriptor);
+        nullsIndicator = initializeNullFieldsIndicator(recordDescriptor);
+
+        for (int i = 0; i < numRecords; i++) {
+            std::string name = i % 3 == 0 ? "Anteater" : "Bruin";
+            prepareRecord(recordDescriptor.size(), nullsIndicator, name.size(), name, i, (float) (i % 100), 6200,
+                          inBuffer, recordSize);
+            ASSERT_EQ(rbfm.insertRecord(fileHandle, recordDescriptor, inBuffer, rid), success)
+                                        << "Inserting a record should succeed.";
+        }
+
+        int ageLimit = 2000;
+        float heightLimit = 10;
+        std::string name = "Anteater";
+        std::string storedName(sizeof(unsigned), '\0');
+        unsigned nameLength = name.size();
+        memcpy(&storedName[0], &nameLength, sizeof(unsigned));
+        storedName += name;
+
+        std::vector<PeterDB::ScanCondition> conditions(4);
+        conditions[0].attribute = "EmpName";
+        conditions[0].compOp = PeterDB::EQ_OP;
+        conditions[0].value = storedName.data();
+        conditions[1].attribute = "Age";
+        conditions[1].compOp = PeterDB::GE_OP;
+        conditions[1].value = &ageLimit;
+        conditions[2].attribute = "Height";
+        conditions[2].compOp = PeterDB::LT_OP;
+        conditions[2].value = &heightLimit;
+        conditions[3].attribute = "";
+        conditions[3].compOp = PeterDB::NO_OP;
+        conditions[3].value = nullptr;
+
+        std::vector<std::string> attributeNames{"Age"};
+        for (int anyCondition = 0; anyCondition <= 1; anyCondition++) {
+            // NO_OP would let every record through an OR, leave it out there
+            std::vector<PeterDB::ScanCondition> scanConditions(conditions.begin(),
+                                                               conditions.end() - (anyCondition ? 1 : 0));
+            int expected = 0;
+            for (int i = 0; i < numRecords; i++) {
+                bool isAnteater = i % 3 == 0, isOld = i >= ageLimit, isShort = (float) (i % 100) < heightLimit;
+                if (anyCondition ? (isAnteater || isOld || isShort) : (isAnteater && isOld && isShort)) expected++;
+            }
+
+            PeterDB::RBFM_ScanIterator rbfmScanIterator;
+            ASSERT_EQ(rbfm.scan(recordDescriptor, scanConditions, attributeNames, rbfmScanIterator, anyCondition),
+                      success) << "Scan should succeed.";
+            ASSERT_EQ(rbfm.openFile(fileName, rbfmScanIterator.fileHandle), success)
+                                        << "Opening the file should succeed.";
+            int numScanned = 0;
+            while (rbfmScanIterator.getNextRecord(rid, outBuffer) != RBFM_EOF) {
+                int age;
+                memcpy(&age, (char*) outBuffer + 1, sizeof(int));
+                bool isAnteater = age % 3 == 0, isOld = age >= ageLimit, isShort = (float) (age % 100) < heightLimit;
+                ASSERT_TRUE(anyCondition ? (isAnteater || isOld || isShort) : (isAnteater && isOld && isShort))
+                                            << "The scan should only return matching records.";
+                numScanned++;
+            }
+            rbfmScanIterator.close();
+            ASSERT_EQ(rbfm.closeFile(rbfmScanIterator.fileHandle), success) << "Closing the file should succeed.";
+            ASSERT_EQ(numScanned, expected) << "The scan should return every matching record.";
+        }
+
+        // An unknown condition attribute is rejected
+        PeterDB::RBFM_ScanIterator rbfmScanIterator;
+        conditions[1].attribute = "Weight";
+        ASSERT_NE(rbfm.scan(recordDescriptor, conditions, attributeNames, rbfmScanIterator), success)
+                                    << "Scan on an unknown attribute should fail.";
+        rbfmScanIterator.close();
+    }
+
+
+    TEST_F(RBFM_Private_Test, parallel_partitioned_scan) {
+        // Functions Tested:
+        // 1. parallelScan() - partitions together return every qualifying record exactly once
+        // 2. parallelScan() - moved records are returned once, from the page they live on
+        // 3. parallelScan() - a consumer error stops the scan
+
+        int numRecords = 20000;
+        PeterDB::RID rid;
+        size_t recordSize = 0;
+        inBuffer = malloc(200);
+        outBuffer = malloc(200);
+
+        std::vector<PeterDB::Attribute> recordDescriptor;
+        createRecordDescriptor(recordDescriptor);
+        nullsIndicator = initializeNullFieldsIndicator(recordDescriptor);
+
+        std::vector<PeterDB::RID> rids;
+        for (int i = 0; i < numRecords; i++) {
+            prepareRecord(recordDescriptor.size(), nullsIndicator, 8, "Anteater", i, 177.8, 6200, inBuffer, recordSize);
+            ASSERT_EQ(rbfm.insertRecord(fileHandle, recordDescriptor, inBuffer, rid), success)
+                                        << "Inserting a record should succeed.";
+            rids.push_back(rid);
+        }
+        // Grow some records so they move to other pages, past the declared name length on purpose
+        for (int i = 0; i < numRecords; i += 97) {
+            prepareRecord(recordDescriptor.size(), nullsIndicator, 60, std::string(60, 'z'), i, 177.8, 6200, inBuffer,
+                          recordSize);
+            ASSERT_EQ(rbfm.updateRecord(fileHandle, recordDescriptor, inBuffer, rids[i]), success)
+                                        << "Updating a record should succeed.";
+        }
+
+        int ageLimit = 100;
+        std::vector<PeterDB::ScanCondition> conditions(1);
+        conditions[0].attribute = "Age";
+        conditions[0].compOp = PeterDB::GE_OP;
+        conditions[0].value = &ageLimit;
+        std::vector<std::string> attributeNames{"Age", "EmpName"};
+
+        const unsigned numPartitions = 4;
+        std::vector<std::vector<int>> agesByPartition(numPartitions);
+        auto collect = [&](unsigned partition, const PeterDB::RID &rid, const void* data) {
+            int age;
+            memcpy(&age, (const char*) data + 1, sizeof(int));
+            agesByPartition[partition].push_back(age);
+            return 0;
+        };
+        ASSERT_EQ(rbfm.parallelScan(fileName, recordDescriptor, conditions, attributeNames, numPartitions, collect),
+                  success) << "Parallel scan should succeed.";
+
+        std::vector<int> ages;
+        for (const std::vector<int> &partitionAges : agesByPartition) {
+            ASSERT_FALSE(partitionAges.empty()) << "Every partition should get records.";
+            ages.insert(ages.end(), partitionAges.begin(), partitionAges.end());
+        }
+        std::sort(ages.begin(), ages.end());
+        ASSERT_EQ(ages.size(), numRecords - ageLimit) << "Every matching record should be returned.";
+        for (int i = 0; i < ages.size(); i++) {
+            ASSERT_EQ(ages[i], ageLimit + i) << "Each record should be returned exactly once.";
+        }
+
+        // The first error ends the scan and is returned
+        std::atomic<int> numConsumed(0);
+        auto failing = [&](unsigned partition, const PeterDB::RID &rid, const void* data) {
+            return ++numConsumed == 10 ? -1 : 0;
+        };
+        ASSERT_NE(rbfm.parallelScan(fileName, recordDescriptor, conditions, attributeNames, 0, failing), success)
+                                    << "A consumer error should fail the scan.";
+        ASSERT_LT(numConsumed, numRecords - ageLimit) << "The scan should stop early.";
+    }
+
+
+    TEST_F(RBFM_Private_Test, incremental_vacuum) {
+        // Functions Tested:
+        // 1. vacuum() - forwarding chains are cut to at most one hop, records come home when there is room
+        // 2. vacuum() - dead slots are reclaimed and emptied pages are freed
+        // 3. vacuum() - runs a few pages at a time, every RID from insertRecord() keeps its record
+
+        int numRecords = 3000;
+        PeterDB::RID rid;
+        size_t recordSize = 0;
+        inBuffer = malloc(1000);
+        outBuffer = malloc(1000);
+
+        std::vector<PeterDB::Attribute> recordDescriptor;
+        createRecordDescriptor(recordDescriptor);
+        nullsIndicator = initializeNullFieldsIndicator(recordDescriptor);
+
+        std::vector<PeterDB::RID> rids;
+        for (int i = 0; i < numRecords; i++) {
+            prepareRecord(recordDescriptor.size(), nullsIndicator, 8, "Anteater", i, 177.8, 6200, inBuffer, recordSize);
+            ASSERT_EQ(rbfm.insertRecord(fileHandle, recordDescriptor, inBuffer, rid), success)
+                                        << "Inserting a record should succeed.";
+            rids.push_back(rid);
+        }
+
+        // Grow every 25th record twice, the moved records fill their new pages so the second move leaves two hops
+        std::vector<int> nameLengths(numRecords, 8);
+        for (int nameLength : {100, 600}) {
+            for (int i = 0; i < numRecords; i += 25) {
+                prepareRecord(recordDescriptor.size(), nullsIndicator, nameLength, std::string(nameLength, 'z'), i,
+                              177.8, 6200, inBuffer, recordSize);
+                ASSERT_EQ(rbfm.updateRecord(fileHandle, recordDescriptor, inBuffer, rids[i]), success)
+                                            << "Updating a record should succeed.";
+                nameLengths[i] = nameLength;
+            }
+        }
+
+        // Make room on some home pages, and leave dead slots behind
+        std::vector<bool> deleted(numRecords, false);
+        for (int i = 0; i < numRecords; i += 50) {
+            for (int j = i + 1; j < i + 20 && j < numRecords; j++) {
+                if (j % 25 == 0) continue;
+                ASSERT_EQ(rbfm.deleteRecord(fileHandle, recordDescriptor, rids[j]), success)
+                                            << "Deleting a record should succeed.";
+                deleted[j] = true;
+            }
+        }
+
+        // A few pages per call, as a background task would
+        unsigned pageNum = 0;
+        unsigned numCalls = 0;
+        PeterDB::VacuumStatistics total, stats;
+        while (pageNum < fileHandle.getNumberOfPages()) {
+            ASSERT_EQ(rbfm.vacuum(fileHandle, pageNum, 4, stats), success) << "Vacuum should succeed.";
+            total.chainsCollapsed += stats.chainsCollapsed;
+            total.recordsMovedHome += stats.recordsMovedHome;
+            total.recordsRelocated += stats.recordsRelocated;
+            total.slotsReclaimed += stats.slotsReclaimed;
+            total.pagesFreed += stats.pagesFreed;
+            numCalls++;
+        }
+        ASSERT_GT(numCalls, 1) << "Vacuum should work incrementally.";
+        ASSERT_GT(total.chainsCollapsed, 0) << "Two hop chains should be collapsed.";
+        ASSERT_GT(total.recordsMovedHome, 0) << "Records should move back to home pages with room.";
+        ASSERT_GT(total.pagesFreed, 0) << "Pages left with only forwarding stubs should be freed.";
+
+        // Every record is where its RID says, at most one hop away
+        for (int i = 0; i < numRecords; i++) {
+            if (deleted[i]) {
+                ASSERT_NE(rbfm.readRecord(fileHandle, recordDescriptor, rids[i], outBuffer), success)
+                                            << "A deleted record should stay deleted.";
+                continue;
+            }
+            unsigned readPageCount = 0, writePageCount = 0, appendPageCount = 0;
+            fileHandle.collectCounterValues(readPageCount, writePageCount, appendPageCount);
+            unsigned lastReadPageCount = readPageCount;
+            ASSERT_EQ(rbfm.readRecord(fileHandle, recordDescriptor, rids[i], outBuffer), success)
+                                        << "Reading a record should succeed.";
+            fileHandle.collectCounterValues(readPageCount, writePageCount, appendPageCount);
+            ASSERT_LE(readPageCount - lastReadPageCount, 2) << "A record should be at most one hop away.";
+
+            prepareRecord(recordDescriptor.size(), nullsIndicator, nameLengths[i],
+                          nameLengths[i] == 8 ? "Anteater" : std::string(nameLengths[i], 'z'), i, 177.8, 6200,
+                          inBuffer, recordSize);
+            ASSERT_EQ(memcmp(inBuffer, outBuffer, recordSize), 0) << "Reading fields incorrectly.";
+        }
+
+        // Leave a single moved record on a page, the next pass moves it on and frees the page
+        std::unordered_map<unsigned, std::vector<int>> movedByPage;
+        PeterDB::RBFM_ScanIterator rbfmScanIterator;
+        std::vector<std::string> attributeNames{"Age"};
+        ASSERT_EQ(rbfm.scan(recordDescriptor, "", PeterDB::NO_OP, NULL, attributeNames, rbfmScanIterator), success)
+                                    << "Scan should succeed.";
+        ASSERT_EQ(rbfm.openFile(fileName, rbfmScanIterator.fileHandle), success) << "Opening the file should succeed.";
+        while (rbfmScanIterator.getNextRecord(rid, outBuffer) != RBFM_EOF) {
+            int age;
+            memcpy(&age, (char*) outBuffer + 1, sizeof(int));
+            if (rid.pageNum != rids[age].pageNum) movedByPage[rid.pageNum].push_back(age);
+        }
+        rbfmScanIterator.close();
+        ASSERT_EQ(rbfm.closeFile(rbfmScanIterator.fileHandle), success) << "Closing the file should succeed.";
+
+        bool pageEmptied = false;
+        for (const auto &page : movedByPage) {
+            if (page.second.size() < 2) continue;
+            for (unsigned j = 1; j < page.second.size(); j++) {
+                ASSERT_EQ(rbfm.deleteRecord(fileHandle, recordDescriptor, rids[page.second[j]]), success)
+                                            << "Deleting a record should succeed.";
+                deleted[page.second[j]] = true;
+            }
+            pageEmptied = true;
+            break;
+        }
+        ASSERT_TRUE(pageEmptied) << "Some page should hold several moved records.";
+
+        pageNum = 0;
+        ASSERT_EQ(rbfm.vacuum(fileHandle, pageNum, UINT_MAX, stats), success) << "Vacuum should succeed.";
+        ASSERT_GE(stats.recordsRelocated, 1) << "The lone moved record should leave its page.";
+        ASSERT_GE(stats.pagesFreed, 1) << "The emptied page should be freed.";
+        for (int i = 0; i < numRecords; i++) {
+            if (deleted[i]) continue;
+            ASSERT_EQ(rbfm.readRecord(fileHandle, recordDescriptor, rids[i], outBuffer), success)
+                                        << "Reading a record should succeed.";
+            prepareRecord(recordDescriptor.size(), nullsIndicator, nameLengths[i],
+                          nameLengths[i] == 8 ? "Anteater" : std::string(nameLengths[i], 'z'), i, 177.8, 6200,
+                          inBuffer, recordSize);
+            ASSERT_EQ(memcmp(inBuffer, outBuffer, recordSize), 0) << "Reading fields incorrectly.";
+        }
+
+        // A further pass finds nothing left to do
+        pageNum = 0;
+        ASSERT_EQ(rbfm.vacuum(fileHandle, pageNum, UINT_MAX, stats), success) << "Vacuum should succeed.";
+        ASSERT_EQ(stats.chainsCollapsed, 0) << "No chain should be left.";
+        ASSERT_EQ(stats.slotsReclaimed, 0) << "No dead slot should be left at a directory end.";
+    }
+
 }
 